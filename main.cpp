@@ -2,6 +2,7 @@
 
 #include <GL/glew.h>
 #include <GL/glut.h>
+#include <GL/freeglut_ext.h> // glutCloseFunc
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -30,6 +31,35 @@
 #include <set>
 #include <unordered_map>
 #include <map>
+#include <tuple>
+#include <type_traits>
+#include <memory>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 using namespace std;
 
 #pragma comment(lib, "freeglut")
@@ -62,21 +92,270 @@ using namespace std;
 float foreground_vel = -0.05;
 
 
-// Structure to hold collision point data
+
+// Logging without console I/O on the main thread
+// The game copies each line into a fixed size slot of a ring, a background thread drains the ring to
+// stderr (or the --log file), so logging costs a bounded copy rather than a flushed write
+// Single producer: only the main thread may log
+enum LogLevel : unsigned char { LOG_LEVEL_DEBUG, LOG_LEVEL_INFO, LOG_LEVEL_WARN, LOG_LEVEL_ERROR };
+
+// Lines below this level are compiled out, build with -DLOG_MIN_LEVEL=LOG_LEVEL_WARN to drop the chatter too
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+class RingLogger {
+public:
+	static const size_t CAPACITY = 4096; // Lines, a power of two
+	static const size_t LINE_LENGTH = 240; // Longer lines are truncated, marked with "..." and counted
+	static_assert(LINE_LENGTH < 256, "Line::length is a byte");
+
+	~RingLogger() {
+		stop();
+	}
+
+	// Lines written before start() wait in the ring
+	void start(FILE* out) {
+		m_out = out;
+		m_running.store(true, std::memory_order_release);
+		m_thread = std::thread([this]() { drainLoop(); });
+	}
+
+	void stop() {
+		if (!m_thread.joinable())
+			return;
+
+		m_running.store(false, std::memory_order_release);
+		m_thread.join();
+
+		if (m_out != stderr && m_out != stdout)
+			fclose(m_out);
+	}
+
+	// Each argument is appended as text, when the ring is full the line is dropped and counted
+	template<typename... Args>
+	void write(LogLevel level, const Args&... args) {
+		const size_t head = m_head.load(std::memory_order_relaxed);
+
+		if (head - m_tail.load(std::memory_order_acquire) == CAPACITY) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		Line& line = m_lines[head & (CAPACITY - 1)];
+		line.level = level;
+		line.length = 0;
+		line.truncated = false;
+		(append(line, args), ...);
+
+		if (line.truncated)
+			m_truncated.fetch_add(1, std::memory_order_relaxed);
+
+		m_head.store(head + 1, std::memory_order_release);
+	}
+
+	size_t dropped() const {
+		return m_dropped.load(std::memory_order_relaxed);
+	}
+
+	size_t truncated() const {
+		return m_truncated.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Line {
+		LogLevel level;
+		unsigned char length;
+		bool truncated;
+		char text[LINE_LENGTH];
+	};
+
+	static void appendText(Line& line, const char* text, size_t length) {
+		if (length > LINE_LENGTH - line.length) {
+			length = LINE_LENGTH - line.length;
+			line.truncated = true;
+		}
+
+		memcpy(line.text + line.length, text, length);
+		line.length = (unsigned char)(line.length + length);
+	}
+
+	template<typename T>
+	static void append(Line& line, const T& value) {
+		char number[32];
+		int length = 0;
+
+		if constexpr (std::is_convertible_v<const T&, const char*>)
+			return appendText(line, value, strlen(value));
+		else if constexpr (std::is_same_v<T, std::string>)
+			return appendText(line, value.data(), value.size());
+		else if constexpr (std::is_same_v<T, char>)
+			return appendText(line, &value, 1);
+		else if constexpr (std::is_same_v<T, bool>)
+			return appendText(line, value ? "true" : "false", value ? 4 : 5);
+		else if constexpr (std::is_floating_point_v<T>)
+			length = snprintf(number, sizeof(number), "%g", double(value));
+		else if constexpr (std::is_signed_v<T>)
+			length = snprintf(number, sizeof(number), "%lld", (long long)value);
+		else
+			length = snprintf(number, sizeof(number), "%llu", (unsigned long long)value);
+
+		appendText(line, number, size_t(max(length, 0)));
+	}
+
+	void drainLoop() {
+		// One last pass after stop(), so nothing written before it is lost
+		bool running = true;
+		while (running) {
+			running = m_running.load(std::memory_order_acquire);
+
+			if (!drain())
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+	}
+
+	bool drain() {
+		static const char* const prefixes[] = { "[debug] ", "[info] ", "[warn] ", "[error] " };
+
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		const size_t head = m_head.load(std::memory_order_acquire);
+
+		if (tail == head && m_dropped.load(std::memory_order_relaxed) == m_reportedDropped)
+			return false;
+
+		for (; tail != head; tail++) {
+			const Line& line = m_lines[tail & (CAPACITY - 1)];
+			fputs(prefixes[line.level], m_out);
+			fwrite(line.text, 1, line.length, m_out);
+			fputs(line.truncated ? "...\n" : "\n", m_out);
+		}
+
+		m_tail.store(tail, std::memory_order_release);
+
+		size_t dropped = m_dropped.load(std::memory_order_relaxed);
+		if (dropped != m_reportedDropped) {
+			fprintf(m_out, "[warn] log ring full, %zu lines dropped\n", dropped - m_reportedDropped);
+			m_reportedDropped = dropped;
+		}
+
+		// Truncated lines already end in "...", this says why, once per batch
+		size_t truncated = m_truncated.load(std::memory_order_relaxed);
+		if (truncated != m_reportedTruncated) {
+			fprintf(m_out, "[warn] %zu log lines over %zu characters truncated\n", truncated - m_reportedTruncated, LINE_LENGTH);
+			m_reportedTruncated = truncated;
+		}
+
+		fflush(m_out);
+		return true;
+	}
+
+	Line m_lines[CAPACITY];
+	std::atomic<size_t> m_head{ 0 };
+	std::atomic<size_t> m_tail{ 0 };
+	std::atomic<size_t> m_dropped{ 0 };
+	std::atomic<size_t> m_truncated{ 0 };
+	size_t m_reportedDropped = 0; // Drain thread only
+	size_t m_reportedTruncated = 0;
+
+	FILE* m_out = stderr;
+	std::atomic<bool> m_running{ false };
+	std::thread m_thread;
+};
+
+RingLogger gameLog;
+
+#define LOG_AT(level, ...) do { if constexpr ((level) >= LOG_MIN_LEVEL) gameLog.write((level), __VA_ARGS__); } while (0)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+
+// Every heap allocation in the program goes through here, so the frame loop can tell when a frame touched the heap
+// Counted per thread, the asset streamer's workers allocate whenever they like and that's not the frame's doing
+thread_local size_t heap_allocations = 0;
+
+void* operator new(std::size_t size) {
+	heap_allocations++;
+
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+// Steady state frames shouldn't allocate, everything they need lives in pools sized from the level config
+// Frames that spawn stamps or give a stamp its damage mask allocate on purpose, and say so with allowAllocations()
+// Only used from the main thread, so only the main thread's allocations are counted
+class FrameAllocationGuard {
+public:
+	static const int WARMUP_SECTIONS = 120; // Lazily created GPU objects, scratch buffers reaching their high water marks
+
+	void begin() {
+		m_start = heap_allocations;
+	}
+
+	void allowAllocations() {
+		m_allowed = true;
+	}
+
+	void end(const char* section) {
+		size_t count = heap_allocations - m_start;
+
+		if (count > 0 && !m_allowed && m_sections >= WARMUP_SECTIONS) {
+			m_hitches++;
+			LOG_WARN(section, " made ", count, " heap allocations in a steady state frame");
+
+#ifndef NDEBUG
+			assert(!"Heap allocation in a steady state frame");
+#endif
+		}
+
+		m_allowed = false;
+		m_sections++;
+	}
+
+	size_t hitches() const { return m_hitches; }
+
+private:
+	size_t m_start = 0;
+	bool m_allowed = false;
+	int m_sections = 0;
+	size_t m_hitches = 0;
+};
+
+FrameAllocationGuard frameAllocations;
+
+
+// One blackening splat, already in damage mask atlas coordinates
+// Laid out as two vec4s for the splat shader's SSBO
 struct BlackeningPoint {
-	float x, y;          // Texture coordinates
+	float x, y;          // Page texture coordinates
+	float radius;        // Page texture coordinates
 	float intensity;     // Collision intensity
+	float clipMinX, clipMinY, clipMaxX, clipMaxY; // The stamp's rect, splats never leave it
+	int page;            // Not uploaded, points are grouped by page before upload
 };
 
-// Map to store blackening points for each texture
-struct BlackeningData {
-	std::vector<BlackeningPoint> points;
-	int width;
-	int height;
-};
+// Blackening points collected during the frame, for all stamps
+// Capped at max_blackening_points, the rest of a frame's points are dropped and counted
+std::vector<BlackeningPoint> blackeningPoints;
+size_t blackeningPointsDropped = 0;
 
-// Map using texture ID as key to collect collision points for each stamp
-std::unordered_map<GLuint, BlackeningData> stampCollisionMap;
+// The same points packed for the splat shader's SSBO, 8 floats each
+std::vector<float> blackeningPointUpload;
 
 
 class vec2
@@ -193,6 +472,11 @@ vec2 get_curve_point(vector<vec2> points, float t)
 int WIDTH = 1920;
 int HEIGHT = 1080;
 
+// Internal resolution of the fluid textures, WIDTH x HEIGHT scaled by the resolution governor
+// Gameplay coordinates stay normalized to the window, only texel sizes and viewports use these
+int SIM_WIDTH = WIDTH;
+int SIM_HEIGHT = HEIGHT;
+
 glm::mat4 orthoMatrix;
 
 
@@ -204,6 +488,18 @@ const float DIFFUSION = 0.5f;    //  diffusion rate
 const float COLLISION_THRESHOLD = 0.5f; // Threshold for color-obstacle collision
 const float COLOR_DETECTION_THRESHOLD = 0.01f;  // How strict the color matching should be
 
+// Damage mask resolution as a fraction of the stamp size
+// The blackening is soft anyway, so the masks can be a lot smaller than the stamps
+const float SHIP_DAMAGE_MASK_SCALE = 0.5f;
+const float FOREGROUND_DAMAGE_MASK_SCALE = 0.25f;
+
+// What each kind of stamp writes into the obstacle texture's R channel
+// Everything else only checks for > 0, the GPU bullets use it to tell friend from foe
+const float OBSTACLE_ALLY = 0.25f;
+const float OBSTACLE_POWERUP = 0.5f;
+const float OBSTACLE_ENEMY = 0.75f;
+const float OBSTACLE_FOREGROUND = 1.0f;
+
 //std::chrono::high_resolution_clock::time_point app_start_time = std::chrono::high_resolution_clock::now();
 
 
@@ -221,8 +517,6 @@ int friendlyColorIndex = 0;      // Index for current friendly color texture
 GLuint backgroundTexture;
 GLuint backgroundTexture2;  // New second background texture
 GLuint processingFBO;
-GLuint tempTexture1;
-GLuint tempTexture2;
 
 GLuint vorticityTexture;
 GLuint vorticityForceTexture;
@@ -252,8 +546,8 @@ GLuint applyForceProgram;
 //GLuint blackeningMarkProgram;
 //GLuint blackeningCopyProgram;
 
-GLuint multiTargetBlackeningProgram;
-GLuint batchBlackeningProgram;
+GLuint blackeningSplatProgram;
+GLuint blackeningPointsSSBO = 0;
 
 GLuint vao, vbo;
 GLuint fbo;
@@ -298,507 +592,2777 @@ float eddyIntensity = 1.0;
 float eddyDensity = 10;
 
 
+// The knobs that trade looks for time, besides the fluid resolution
+struct QualityLevel {
+	const char* name;
+	int pressure_iterations;        // Jacobi iterations in solvePressure
+	int eddy_octaves[3];            // fbm octaves of the large, medium and small eddies
+	size_t explosion_sparks[2];     // Large and small sub-bullets of an explosion
+	size_t random_fire_streams[2];  // Large and small bullets per stream of RANDOM fire
+};
 
-enum cannon_type { SIDEWAYS_CANNON, FORWARD_CANNON, RANDOM_CANNON, CIRCULAR_CANNON };
-
-
-class Cannon
-{
-public:
-	enum cannon_type t;
-	size_t x;
-	size_t y;
+const QualityLevel QUALITY_LEVELS[] = {
+	{ "high", 20, { 3, 2, 1 }, { 3, 5 }, { 1, 2 } },
+	{ "medium", 12, { 2, 2, 1 }, { 3, 3 }, { 1, 1 } },
+	{ "low", 8, { 2, 1, 0 }, { 2, 2 }, { 1, 1 } },
+	{ "minimum", 4, { 1, 1, 0 }, { 1, 1 }, { 1, 0 } },
 };
 
+// Picks a quality level, either fixed by the player or stepped down and up
+// by the measured GPU frame cost the same way the resolution governor does
+class QualityGovernor {
+public:
+	static const int NUM_LEVELS = int(sizeof(QUALITY_LEVELS) / sizeof(QUALITY_LEVELS[0]));
 
+	static const int DOWN_FRAMES = 10;    // Sooner than the resolution, these are the cheaper thing to give up
+	static const int UP_FRAMES = 180;
+	static const int SETTLE_FRAMES = 30;
 
-class Stamp {
-public:
-	Stamp(void)
-	{
-		blackeningTexture = 0;
+	const QualityLevel& level() const {
+		return QUALITY_LEVELS[m_level];
 	}
 
-	~Stamp()
-	{
-		// Clean up textures
-		for (GLuint textureID : textureIDs) {
-			if (textureID != 0) {
-				glDeleteTextures(1, &textureID);
-			}
-		}
-
-		if (blackeningTexture != 0) {
-			glDeleteTextures(1, &blackeningTexture);
-			blackeningTexture = 0;
-		}
+	int index() const {
+		return m_level;
+	}
 
-		textureIDs.clear();
-		pixelData.clear();
+	bool automatic() const {
+		return m_automatic;
 	}
 
-	// Modified copy constructor to avoid automatic blackening texture initialization
-	Stamp(const Stamp& other)
-	{
-		// Copy basic properties
-		width = other.width;
-		height = other.height;
-		baseFilename = other.baseFilename;
-		textureNames = other.textureNames;
-		channels = other.channels;
-		to_be_culled = other.to_be_culled;
-		health = other.health;
-		birth_time = other.birth_time;
-		death_time = other.death_time;
-		stamp_opacity = other.stamp_opacity;
-		force_radius = other.force_radius;
-		colour_radius = other.colour_radius;
-		force_randomization = other.force_randomization;
-		colour_randomization = other.colour_randomization;
-		path_randomization = other.path_randomization;
-		sinusoidal_frequency = other.sinusoidal_frequency;
-		sinusoidal_amplitude = other.sinusoidal_amplitude;
-		sinusoidal_shift = other.sinusoidal_shift;
-		random_forking = other.random_forking;
-
-		is_dying_bullet = other.is_dying_bullet;
-
-		//		curve_path = other.curve_path;
-		posX = other.posX;
-		posY = other.posY;
-		local_velX = other.local_velX;
-		local_velY = other.local_velY;
-		currentVariationIndex = other.currentVariationIndex;
-		powerup = other.powerup;
-		under_fire = other.under_fire;
-		cannons = other.cannons;
-		is_foreground = other.is_foreground;
-		prevPosX = other.prevPosX;
-		prevPosY = other.prevPosY;
-
-		// Copy chunking data
-		data_offsetX = other.data_offsetX;
-		data_offsetY = other.data_offsetY;
-		data_original_width = other.data_original_width;
-		data_original_height = other.data_original_height;
-
-		// Deep copy pixel data
-		pixelData = other.pixelData;
-
-		// Create new textures
-		textureIDs.resize(other.textureIDs.size(), 0);
-		for (size_t i = 0; i < other.textureIDs.size(); i++) {
-			if (other.textureIDs[i] != 0 && i < other.pixelData.size() && !other.pixelData[i].empty()) {
-				glGenTextures(1, &textureIDs[i]);
-				glBindTexture(GL_TEXTURE_2D, textureIDs[i]);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	bool lowest() const {
+		return m_level == NUM_LEVELS - 1;
+	}
 
-				GLenum format = (channels == 1) ? GL_RED : (channels == 3) ? GL_RGB : GL_RGBA;
-				glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, other.pixelData[i].data());
-			}
-		}
+	// A preset from the keyboard, which turns the automatic mode off
+	void setLevel(int level) {
+		m_automatic = false;
+		change(level, "preset");
+	}
 
-		// Important: Don't automatically copy blackening texture, initialize to 0
-		blackeningTexture = 0;
+	void setAutomatic() {
+		m_automatic = true;
+		m_over = 0;
+		m_under = 0;
+		LOG_INFO("Quality automatic, from ", level().name);
 	}
 
-	// Modified assignment operator to avoid automatic blackening texture initialization
-	Stamp& operator=(const Stamp& other)
-	{
-		if (this != &other) {
-			// Clean up existing resources
-			for (GLuint textureID : textureIDs) {
-				if (textureID != 0) {
-					glDeleteTextures(1, &textureID);
-				}
-			}
+	// Once per displayed frame with the smoothed GPU cost, negative while there's no measurement
+	// Stepping up is left to the caller to allow, the resolution comes back first
+	void update(float cost_ms, float budget_ms, bool may_raise) {
+		if (!m_automatic || cost_ms < 0)
+			return;
 
-			if (blackeningTexture != 0) {
-				glDeleteTextures(1, &blackeningTexture);
-				blackeningTexture = 0;
-			}
+		if (m_settle > 0) {
+			m_settle--;
+			return;
+		}
 
-			textureIDs.clear();
-			pixelData.clear();
-
-			// Copy basic properties (same as copy constructor)
-			width = other.width;
-			height = other.height;
-			baseFilename = other.baseFilename;
-			textureNames = other.textureNames;
-			channels = other.channels;
-			to_be_culled = other.to_be_culled;
-			health = other.health;
-			birth_time = other.birth_time;
-			death_time = other.death_time;
-			stamp_opacity = other.stamp_opacity;
-			force_radius = other.force_radius;
-			colour_radius = other.colour_radius;
-			force_randomization = other.force_randomization;
-			colour_randomization = other.colour_randomization;
-			path_randomization = other.path_randomization;
-			sinusoidal_frequency = other.sinusoidal_frequency;
-			sinusoidal_amplitude = other.sinusoidal_amplitude;
-			sinusoidal_shift = other.sinusoidal_shift;
-			random_forking = other.random_forking;
-
-			is_dying_bullet = other.is_dying_bullet;
-
-			//			curve_path = other.curve_path;
-			posX = other.posX;
-			posY = other.posY;
-			local_velX = other.local_velX;
-			local_velY = other.local_velY;
-			currentVariationIndex = other.currentVariationIndex;
-			powerup = other.powerup;
-			under_fire = other.under_fire;
-			cannons = other.cannons;
-			is_foreground = other.is_foreground;
-			prevPosX = other.prevPosX;
-			prevPosY = other.prevPosY;
-
-			// Copy chunking data
-			data_offsetX = other.data_offsetX;
-			data_offsetY = other.data_offsetY;
-			data_original_width = other.data_original_width;
-			data_original_height = other.data_original_height;
-
-			// Deep copy pixel data
-			pixelData = other.pixelData;
-
-			// Create new textures
-			textureIDs.resize(other.textureIDs.size(), 0);
-			for (size_t i = 0; i < other.textureIDs.size(); i++) {
-				if (other.textureIDs[i] != 0 && i < other.pixelData.size() && !other.pixelData[i].empty()) {
-					glGenTextures(1, &textureIDs[i]);
-					glBindTexture(GL_TEXTURE_2D, textureIDs[i]);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-					GLenum format = (channels == 1) ? GL_RED : (channels == 3) ? GL_RGB : GL_RGBA;
-					glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, other.pixelData[i].data());
-				}
+		if (cost_ms > budget_ms && !lowest()) {
+			if (++m_over >= DOWN_FRAMES) {
+				m_cost_ms = cost_ms;
+				m_budget_ms = budget_ms;
+				change(m_level + 1, "over budget");
 			}
-
-			// Important: Don't automatically copy blackening texture, initialize to 0
-			blackeningTexture = 0;
 		}
-		return *this;
-	}
-
-	// Method to initialize blackening texture
-	void initBlackeningTexture() {
-		if (blackeningTexture == 0) {
-			glGenTextures(1, &blackeningTexture);
-			glBindTexture(GL_TEXTURE_2D, blackeningTexture);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		else {
+			m_over = 0;
+		}
 
-			// Initialize with transparent black
-			std::vector<unsigned char> emptyData(width * height * 4, 0);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, emptyData.data());
+		// Nothing predicts what a level costs, so stepping up wants a wide margin
+		if (may_raise && m_level > 0 && cost_ms < budget_ms * 0.6f) {
+			if (++m_under >= UP_FRAMES) {
+				m_cost_ms = cost_ms;
+				m_budget_ms = budget_ms;
+				change(m_level - 1, "under budget");
+			}
+		}
+		else {
+			m_under = 0;
 		}
 	}
 
-	// Check if any blackening is present
-	bool hasBlackening() const {
-		return (blackeningTexture != 0);
+	void report() {
+		std::cout << "Quality: " << level().name << (m_automatic ? " (automatic)" : " (fixed)")
+			<< ", " << m_changes << " changes" << std::endl;
 	}
 
-	// StampTexture properties
-	std::vector<GLuint> textureIDs;         // Multiple texture IDs
-	int width = 0; // pixels
-	int height = 0; // pixels
-	std::string baseFilename;               // Base filename without suffix
-	std::vector<std::string> textureNames;  // Names of the specific textures
-	std::vector<std::vector<unsigned char>> pixelData; // for storing backup data before blackening per frame
-
-	// New GPU blackening texture
-	GLuint blackeningTexture;
+private:
+	void change(int level, const char* reason) {
+		level = std::min(std::max(level, 0), NUM_LEVELS - 1);
 
-	// Rest of the Stamp class members remain the same
-	int channels = 0;
-	bool to_be_culled = false;
-	float health = 10.0;
-	float birth_time = 0;
-	float death_time = -1;
-	float stamp_opacity = 1;
-	float force_radius = 0.02f;
-	float colour_radius = force_radius;
-	float force_randomization = 0;
-	float colour_randomization = 0;
-	float path_randomization = 0.0f;
-	float sinusoidal_frequency = 5.0f;
-	float sinusoidal_amplitude = 0.001f;
-	bool sinusoidal_shift = false;
-	float random_forking = 0.0f;
-	//	vector<vec2> curve_path;
-	float posX = 0, posY = 0;
-	float local_velX = 0, local_velY = 0;
-	size_t currentVariationIndex = 0;
-	enum powerup_type powerup;
-	bool under_fire = false;
-	vector<Cannon> cannons;
-	bool is_foreground = false;
-	float prevPosX = 0, prevPosY = 0;
-	bool is_dying_bullet = false;
+		if (level == m_level)
+			return;
 
-	float data_offsetX = 0.0f;
-	float data_offsetY = 0.0f;
-	int data_original_width = 0;
-	int data_original_height = 0;
+		// Every change goes to the log, with the frame cost that caused it
+		if (m_automatic)
+			LOG_INFO("Quality ", level > m_level ? "down" : "up", " to ", QUALITY_LEVELS[level].name, " from ",
+				QUALITY_LEVELS[m_level].name, ", ", reason, " at ", m_cost_ms, " ms of ", m_budget_ms, " ms");
+		else
+			LOG_INFO("Quality ", QUALITY_LEVELS[level].name, " from ", QUALITY_LEVELS[m_level].name, ", ", reason);
+
+		m_level = level;
+		m_changes++;
+		m_settle = SETTLE_FRAMES;
+		m_over = 0;
+		m_under = 0;
+	}
+
+	int m_level = 0;
+	bool m_automatic = true;
+	int m_over = 0;
+	int m_under = 0;
+	int m_settle = 0;
+	size_t m_changes = 0;
+	float m_cost_ms = 0;
+	float m_budget_ms = 0;
 };
 
+QualityGovernor qualityGovernor;
 
 
-std::vector<Stamp> allyShips;
-std::vector<Stamp> enemyShips;
-std::vector<Stamp> allyBullets;
-std::vector<Stamp> enemyBullets;
-std::vector<Stamp> allyPowerUps;
 
+enum cannon_type { SIDEWAYS_CANNON, FORWARD_CANNON, RANDOM_CANNON, CIRCULAR_CANNON };
 
-std::vector<Stamp> allyTemplates;
-std::vector<Stamp> enemyTemplates;
-std::vector<Stamp> bulletTemplates;
-std::vector<Stamp> powerUpTemplates;
-std::vector<Stamp> foregroundTemplates;
 
+class Cannon
+{
+public:
+	enum cannon_type t;
+	size_t x;
+	size_t y;
+};
 
 
 
-int currentAllyTemplateIndex = 0;    // Index for selecting ally template stamps
-int currentEnemyTemplateIndex = 0;   // Index for selecting enemy template stamps
-int currentPowerUpTemplateIndex = 0;
+// Where a stamp's damage mask lives inside the damage mask atlas
+struct AtlasRect {
+	int page = -1;
+	int x = 0, y = 0;      // pixels, inside the page
+	int width = 0, height = 0;
+	size_t full_res_bytes = 0; // What a full-size RGBA8 mask would have cost, for the memory report
 
-enum TemplateType { ALLY, ENEMY, BULLET, POWERUP };
+	bool valid() const {
+		return page >= 0;
+	}
+};
 
-TemplateType currentTemplateType = ALLY;
+// Packs rectangles into horizontal shelves of one atlas page
+// Freed rects go back to their shelf as free spans, and get handed out again first
+class ShelfAllocator {
+public:
+	ShelfAllocator(int size = 0) : m_size(size) {}
 
+	bool allocate(int width, int height, int& x, int& y) {
+		if (width > m_size || height > m_size)
+			return false;
 
+		// Best fit: the shortest shelf that is tall enough and still has room
+		Shelf* best = nullptr;
+		size_t best_span = 0;
+		bool best_uses_span = false;
 
+		for (auto& shelf : m_shelves) {
+			if (shelf.height < height || (best && shelf.height >= best->height))
+				continue;
 
+			for (size_t i = 0; i < shelf.free_spans.size(); i++) {
+				if (shelf.free_spans[i].second >= width) {
+					best = &shelf;
+					best_span = i;
+					best_uses_span = true;
+					break;
+				}
+			}
 
+			if (best != &shelf && m_size - shelf.cursor >= width) {
+				best = &shelf;
+				best_uses_span = false;
+			}
+		}
 
-bool isChunkFullyTransparent(const std::vector<unsigned char>& pixelData, int width, int height,
-	int channels, int startX, int startY, int chunkSize) {
-	// If no alpha channel, assume it's not transparent
-	if (channels < 4) return false;
+		// Don't park a small rect on a much taller shelf while there is still room for a new one
+		if (best && best->height > height * 2 && m_next_y + height <= m_size)
+			best = nullptr;
 
-	for (int y = 0; y < chunkSize; y++) {
-		for (int x = 0; x < chunkSize; x++) {
-			// Check boundaries
-			if (startX + x >= width || startY + y >= height) continue;
+		if (!best) {
+			if (m_next_y + height > m_size)
+				return false;
 
-			// Calculate pixel index
-			int idx = ((startY + y) * width + (startX + x)) * channels + 3; // +3 for alpha channel
+			m_shelves.push_back(Shelf{ m_next_y, height, 0, {} });
+			m_next_y += height;
+			best = &m_shelves.back();
+			best_uses_span = false;
+		}
 
-			// If any pixel has non-zero alpha, the chunk is not fully transparent
-			if (pixelData[idx] > 0) {
-				return false;
-			}
+		y = best->y;
+
+		if (best_uses_span) {
+			auto& span = best->free_spans[best_span];
+			x = span.first;
+			span.first += width;
+			span.second -= width;
+
+			if (span.second == 0)
+				best->free_spans.erase(best->free_spans.begin() + best_span);
+		}
+		else {
+			x = best->cursor;
+			best->cursor += width;
 		}
+
+		return true;
 	}
 
-	// All pixels are transparent
-	return true;
-}
+	void free(int x, int y, int width) {
+		for (auto& shelf : m_shelves) {
+			if (shelf.y != y)
+				continue;
 
+			shelf.free_spans.push_back(std::make_pair(x, width));
+			std::sort(shelf.free_spans.begin(), shelf.free_spans.end());
 
+			// Merge neighbouring spans
+			std::vector<std::pair<int, int>> merged;
+			for (const auto& span : shelf.free_spans) {
+				if (!merged.empty() && merged.back().first + merged.back().second == span.first)
+					merged.back().second += span.second;
+				else
+					merged.push_back(span);
+			}
 
-std::vector<Stamp> chunkForegroundStamp(const Stamp& originalStamp, int chunkSize, float scaleFactor, const vector<ivec2>& input_pixel_locations, vector<vec2>& output_screen_locations)
-{
-	output_screen_locations.clear();
-	output_screen_locations.resize(input_pixel_locations.size());
+			// A span that ends at the cursor just gives the space back to the cursor
+			if (!merged.empty() && merged.back().first + merged.back().second == shelf.cursor) {
+				shelf.cursor = merged.back().first;
+				merged.pop_back();
+			}
 
-	std::vector<Stamp> chunks;
+			shelf.free_spans = merged;
+			return;
+		}
+	}
 
-	if (originalStamp.width <= 0 || originalStamp.height <= 0 ||
-		originalStamp.pixelData.empty() || originalStamp.textureIDs.empty()) {
-		return chunks;
+	// Once a page is empty its shelves are just leftovers of old rect sizes, start over
+	void reset() {
+		m_next_y = 0;
+		m_shelves.clear();
 	}
 
-	int numChunksX = (originalStamp.width + chunkSize - 1) / chunkSize;
-	int numChunksY = (originalStamp.height + chunkSize - 1) / chunkSize;
+private:
+	struct Shelf {
+		int y;
+		int height;
+		int cursor;
+		std::vector<std::pair<int, int>> free_spans; // x, width
+	};
 
-	for (int chunkY = 0; chunkY < numChunksY; chunkY++) {
-		for (int chunkX = 0; chunkX < numChunksX; chunkX++) {
-			int startX = chunkX * chunkSize;
-			int startY = chunkY * chunkSize;
+	int m_size;
+	int m_next_y = 0;
+	std::vector<Shelf> m_shelves;
+};
 
-			int actualChunkWidth = std::min(chunkSize, originalStamp.width - startX);
-			int actualChunkHeight = std::min(chunkSize, originalStamp.height - startY);
+// All damage masks live in a few big atlas pages instead of one texture per stamp,
+// so the whole frame's blackening can be drawn with one call per page
+class DamageMaskAtlas {
+public:
+	static const int PAGE_SIZE = 2048;
 
-			if (isChunkFullyTransparent(originalStamp.pixelData[originalStamp.currentVariationIndex],
-				originalStamp.width, originalStamp.height,
-				originalStamp.channels, startX, startY,
-				std::min(actualChunkWidth, actualChunkHeight))) {
-				continue;
-			}
+	// Each rect gets a 1 pixel border so filtering never picks up a neighbour
+	static const int PADDING = 1;
 
-			Stamp chunkStamp;
-			chunkStamp.width = static_cast<int>(actualChunkWidth * scaleFactor);  // Scale width
-			chunkStamp.height = static_cast<int>(actualChunkHeight * scaleFactor); // Scale height
-			chunkStamp.channels = originalStamp.channels;
-			chunkStamp.baseFilename = originalStamp.baseFilename + "_chunk_" +
-				std::to_string(chunkX) + "_" + std::to_string(chunkY);
-			chunkStamp.textureNames = { chunkStamp.baseFilename };
-			chunkStamp.is_foreground = true;
-
-			//chunkStamp.curve_path = originalStamp.curve_path;
-			chunkStamp.birth_time = originalStamp.birth_time;
-			chunkStamp.death_time = originalStamp.death_time;
-			chunkStamp.health = originalStamp.health;
-			chunkStamp.currentVariationIndex = 0;
-
-			// Scale the offsets proportionally
-			float offsetX = (float)startX / originalStamp.width / scaleFactor;
-			float offsetY = (float)startY / originalStamp.height / (WIDTH / float(HEIGHT)) / scaleFactor;
-
-			std::vector<unsigned char> chunkPixelData(chunkStamp.width * chunkStamp.height * originalStamp.channels);
-
-			// Resample pixel data to the new scaled size
-			for (int y = 0; y < chunkStamp.height; y++) {
-				for (int x = 0; x < chunkStamp.width; x++) {
-					int srcX = static_cast<int>(x / scaleFactor);
-					int srcY = static_cast<int>(y / scaleFactor);
-					int srcIdx = ((startY + srcY) * originalStamp.width + (startX + srcX)) * originalStamp.channels;
-					int dstIdx = (y * chunkStamp.width + x) * originalStamp.channels;
-
-					for (int c = 0; c < originalStamp.channels; c++) {
-						if (srcIdx + c < originalStamp.pixelData[originalStamp.currentVariationIndex].size()) {
-							chunkPixelData[dstIdx + c] = originalStamp.pixelData[originalStamp.currentVariationIndex][srcIdx + c];
-						}
-					}
-				}
-			}
+	AtlasRect allocate(int width, int height, size_t full_res_bytes) {
+		AtlasRect rect;
+		int x = 0, y = 0;
 
-			GLuint textureID;
-			glGenTextures(1, &textureID);
-			glBindTexture(GL_TEXTURE_2D, textureID);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		// Checked first, a new page wouldn't help
+		if (width + 2 * PADDING > PAGE_SIZE || height + 2 * PADDING > PAGE_SIZE) {
+			std::cout << "Damage mask of " << width << "x" << height << " doesn't fit in the atlas" << std::endl;
+			return rect;
+		}
 
-			GLenum format = (originalStamp.channels == 1) ? GL_RED :
-				(originalStamp.channels == 3) ? GL_RGB : GL_RGBA;
+		for (size_t i = 0; i <= m_pages.size(); i++) {
+			if (i == m_pages.size())
+				addPage();
 
-			glTexImage2D(GL_TEXTURE_2D, 0, format, chunkStamp.width, chunkStamp.height,
-				0, format, GL_UNSIGNED_BYTE, chunkPixelData.data());
+			if (m_pages[i].allocator.allocate(width + 2 * PADDING, height + 2 * PADDING, x, y)) {
+				rect.page = int(i);
+				break;
+			}
+		}
 
-			chunkStamp.textureIDs.push_back(textureID);
-			chunkStamp.pixelData.push_back(chunkPixelData);
+		rect.x = x + PADDING;
+		rect.y = y + PADDING;
+		rect.width = width;
+		rect.height = height;
+		rect.full_res_bytes = full_res_bytes;
+		m_pages[rect.page].allocated++;
 
-			chunkStamp.data_offsetX = offsetX;
-			chunkStamp.data_offsetY = offsetY;
-			chunkStamp.data_original_width = originalStamp.width;
-			chunkStamp.data_original_height = originalStamp.height;
+		live_masks++;
+		mask_bytes += size_t(width) * height;
+		full_res_mask_bytes += full_res_bytes;
 
-			chunks.push_back(chunkStamp);
-		}
+		// Rects get reused, so clear this one (and its border) on the GPU
+		glBindFramebuffer(GL_FRAMEBUFFER, processingFBO);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_pages[rect.page].texture, 0);
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(x, y, width + 2 * PADDING, height + 2 * PADDING);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glDisable(GL_SCISSOR_TEST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		return rect;
 	}
 
+	void free(const AtlasRect& rect) {
+		if (!rect.valid() || rect.page >= int(m_pages.size()))
+			return;
 
+		Page& page = m_pages[rect.page];
+		page.allocator.free(rect.x - PADDING, rect.y - PADDING, rect.width + 2 * PADDING);
 
-	for (size_t i = 0; i < input_pixel_locations.size(); i++) {
-		// Get pixel coordinates in original stamp space
-		float pixelX = static_cast<float>(input_pixel_locations[i].x);
+		if (--page.allocated == 0)
+			page.allocator.reset();
+
+		live_masks--;
+		mask_bytes -= size_t(rect.width) * rect.height;
+		full_res_mask_bytes -= rect.full_res_bytes;
+	}
+
+	GLuint pageTexture(int page) const {
+		return m_pages[page].texture;
+	}
+
+	size_t pageCount() const {
+		return m_pages.size();
+	}
+
+	// Masks still alive after this find no page and free nothing
+	void cleanup() {
+		for (Page& page : m_pages)
+			glDeleteTextures(1, &page.texture);
+
+		m_pages.clear();
+	}
+
+	// Live mask totals, R8 at reduced size versus full-size RGBA8 per stamp
+	size_t live_masks = 0;
+	size_t mask_bytes = 0;
+	size_t full_res_mask_bytes = 0;
+
+	// Splat fill since the last report, in texels, and what it would have been at full size
+	double splat_texels = 0;
+	double full_res_splat_texels = 0;
+	size_t splats = 0;
+
+	void report() {
+		std::cout << "Damage masks: " << live_masks << " live, "
+			<< mask_bytes / 1024 << " KB as R8 (" << full_res_mask_bytes / 1024 << " KB as full-size RGBA8), "
+			<< m_pages.size() << " atlas page(s) of " << size_t(PAGE_SIZE) * PAGE_SIZE / 1024 << " KB" << std::endl;
+
+		if (splats > 0) {
+			std::cout << "Damage mask updates: " << splats << " splats, " << size_t(splat_texels / splats)
+				<< " texels per splat (" << size_t(full_res_splat_texels / splats) << " at full size)" << std::endl;
+		}
+
+		splat_texels = 0;
+		full_res_splat_texels = 0;
+		splats = 0;
+	}
+
+private:
+	struct Page {
+		GLuint texture = 0;
+		ShelfAllocator allocator;
+		int allocated = 0;
+	};
+
+	void addPage() {
+		Page page;
+		page.allocator = ShelfAllocator(PAGE_SIZE);
+
+		glGenTextures(1, &page.texture);
+		glBindTexture(GL_TEXTURE_2D, page.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		// Single channel, the mask is grey anyway
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, PAGE_SIZE, PAGE_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+
+		m_pages.push_back(page);
+	}
+
+	std::vector<Page> m_pages;
+};
+
+DamageMaskAtlas damageMaskAtlas;
+
+// Ship, foreground chunk and power up textures are also copied into the layers of one texture array,
+// so the sprite batch can draw all of them without switching textures
+// The per-asset textures stay, the obstacle pass and the collision code still use them
+class SpriteAtlas {
+public:
+	static const int PAGE_SIZE = 2048;
+
+	// Each rect gets a 1 pixel border so filtering never picks up a neighbour
+	static const int PADDING = 1;
+
+	// An invalid rect means the texture didn't fit, that sprite is then drawn from its own texture
+	AtlasRect add(const std::vector<unsigned char>& pixels, int width, int height, int channels) {
+		if (pixels.empty())
+			return AtlasRect();
+
+		AtlasRect rect = allocate(width, height);
+
+		if (!rect.valid())
+			return rect;
+
+		GLenum format = (channels == 1) ? GL_RED : (channels == 3) ? GL_RGB : GL_RGBA;
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, rect.x, rect.y, rect.page, width, height, 1, format, GL_UNSIGNED_BYTE, pixels.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		return rect;
+	}
+
+	// Same as add, from an RGBA8 texture that's already on the GPU
+	AtlasRect copy(GLuint texture, int width, int height) {
+		AtlasRect rect = allocate(width, height);
+
+		if (rect.valid())
+			glCopyImageSubData(texture, GL_TEXTURE_2D, 0, 0, 0, 0,
+				m_texture, GL_TEXTURE_2D_ARRAY, 0, rect.x, rect.y, rect.page, width, height, 1);
+
+		return rect;
+	}
+
+	AtlasRect allocate(int width, int height) {
+		AtlasRect rect;
+		int x = 0, y = 0;
+
+		if (width + 2 * PADDING > PAGE_SIZE || height + 2 * PADDING > PAGE_SIZE) {
+			std::cout << "Sprite of " << width << "x" << height << " doesn't fit in the sprite atlas" << std::endl;
+			return rect;
+		}
+
+		for (size_t i = 0; i <= m_allocators.size(); i++) {
+			if (i == m_allocators.size())
+				addLayer();
+
+			if (m_allocators[i].allocate(width + 2 * PADDING, height + 2 * PADDING, x, y)) {
+				rect.page = int(i);
+				break;
+			}
+		}
+
+		rect.x = x + PADDING;
+		rect.y = y + PADDING;
+		rect.width = width;
+		rect.height = height;
+		rect.full_res_bytes = size_t(width) * height * 4;
+		m_allocated[rect.page]++;
+		m_bytes += rect.full_res_bytes;
+
+		return rect;
+	}
+
+	void free(const AtlasRect& rect) {
+		if (!rect.valid() || rect.page >= int(m_allocators.size()))
+			return;
+
+		m_allocators[rect.page].free(rect.x - PADDING, rect.y - PADDING, rect.width + 2 * PADDING);
+
+		if (--m_allocated[rect.page] == 0)
+			m_allocators[rect.page].reset();
+		m_bytes -= rect.full_res_bytes;
+	}
+
+	GLuint texture() const {
+		return m_texture;
+	}
+
+	size_t layerCount() const {
+		return m_allocators.size();
+	}
+
+	// Offset and scale of a rect inside its layer, for the shaders
+	static void uvTransform(const AtlasRect& rect, float& u, float& v, float& du, float& dv) {
+		u = rect.x / float(PAGE_SIZE);
+		v = rect.y / float(PAGE_SIZE);
+		du = rect.width / float(PAGE_SIZE);
+		dv = rect.height / float(PAGE_SIZE);
+	}
+
+	void report() {
+		std::cout << "Sprite atlas: " << m_bytes / 1024 << " KB of sprites in " << m_allocators.size()
+			<< " layer(s) of " << size_t(PAGE_SIZE) * PAGE_SIZE * 4 / 1024 << " KB" << std::endl;
+	}
+
+private:
+	// Texture arrays can't grow in place, so a new layer means a new array with the old layers copied over
+	void addLayer() {
+		const int layers = int(m_allocators.size()) + 1;
+
+		GLuint texture = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, PAGE_SIZE, PAGE_SIZE, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		if (m_texture != 0) {
+			glCopyImageSubData(m_texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+				texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, PAGE_SIZE, PAGE_SIZE, layers - 1);
+			glDeleteTextures(1, &m_texture);
+		}
+
+		m_texture = texture;
+		m_allocators.push_back(ShelfAllocator(PAGE_SIZE));
+		m_allocated.push_back(0);
+	}
+
+	GLuint m_texture = 0;
+	std::vector<ShelfAllocator> m_allocators;
+	std::vector<int> m_allocated;
+	size_t m_bytes = 0;
+};
+
+SpriteAtlas spriteAtlas;
+
+// Erosion rule shared by the stamp shaders and DamageMaskHandle::isEroded
+// The shaders get these as #defines (withStampDamage), so the GPU and CPU sides can't drift apart
+const uint32_t EROSION_HASH_X = 1973u;
+const uint32_t EROSION_HASH_Y = 9277u;
+const uint32_t EROSION_MIX_1 = 0x7feb352du;
+const uint32_t EROSION_MIX_2 = 0x846ca68bu;
+const float EROSION_NOISE = 0.1f; // How far below full damage the noisy edge of a hole reaches
+
+// Fixed per-texel noise, it picks which damaged pixels erode first
+inline uint32_t erosionHash(uint32_t x, uint32_t y) {
+	uint32_t h = x * EROSION_HASH_X + y * EROSION_HASH_Y;
+	h = (h ^ (h >> 16)) * EROSION_MIX_1;
+	h = (h ^ (h >> 15)) * EROSION_MIX_2;
+	return h ^ (h >> 16);
+}
+
+// Damage mask functions for the stamp shaders, the GPU side of erosionHash and DamageMaskHandle
+const char* stampDamageShaderSource = R"(
+uniform sampler2D damageMask;  // Damage mask atlas page
+
+uint hashTexel(uvec2 p)
+{
+    uint h = p.x * EROSION_HASH_X + p.y * EROSION_HASH_Y;
+    h = (h ^ (h >> 16)) * EROSION_MIX_1;
+    h = (h ^ (h >> 15)) * EROSION_MIX_2;
+    return h ^ (h >> 16);
+}
+
+// Fully damaged pixels are knocked out, with a little noise on the edge of the hole
+bool isEroded(float damage, vec2 stampCoord, vec2 stampTexSize)
+{
+    uvec2 texel = uvec2(clamp(stampCoord * stampTexSize, vec2(0.0), stampTexSize - vec2(1.0)));
+    float noise = float(hashTexel(texel) & 0xffffu) / 65535.0;
+
+    return damage >= 1.0 - EROSION_NOISE * noise;
+}
+
+// The mask is smaller than the stamp, bilinear filtering scales it back up
+// Stay half a texel inside the rect so the border never gets blended in
+float sampleDamage(vec4 damageRect, vec2 stampCoord)
+{
+    vec2 halfTexel = 0.5 / vec2(textureSize(damageMask, 0));
+    vec2 uv = clamp(damageRect.xy + stampCoord * damageRect.zw, damageRect.xy + halfTexel, damageRect.xy + damageRect.zw - halfTexel);
+
+    return texture(damageMask, uv).r;
+}
+)";
+
+// Prepends the version, the erosion constants and stampDamageShaderSource to a stamp shader
+std::string withStampDamage(const char* source) {
+	return std::string("#version 330 core\n")
+		+ "#define EROSION_HASH_X " + std::to_string(EROSION_HASH_X) + "u\n"
+		+ "#define EROSION_HASH_Y " + std::to_string(EROSION_HASH_Y) + "u\n"
+		+ "#define EROSION_MIX_1 " + std::to_string(EROSION_MIX_1) + "u\n"
+		+ "#define EROSION_MIX_2 " + std::to_string(EROSION_MIX_2) + "u\n"
+		+ "#define EROSION_NOISE " + std::to_string(EROSION_NOISE) + "\n"
+		+ stampDamageShaderSource + source;
+}
+
+// Owns a rect in the damage mask atlas and gives it back when the stamp goes away
+// Copies start out undamaged, same as the old per-stamp blackening texture
+//
+// It also keeps a CPU copy of the mask, fed the same splats as the GPU one,
+// so the collision code can see eroded pixels without reading anything back
+class DamageMaskHandle {
+public:
+	DamageMaskHandle() {}
+
+	DamageMaskHandle(const DamageMaskHandle&) {}
+
+	DamageMaskHandle(DamageMaskHandle&& other) noexcept : m_rect(other.m_rect), m_cpu(std::move(other.m_cpu)), m_max(other.m_max),
+		m_damage_generation(other.m_damage_generation) {
+		other.m_rect = AtlasRect();
+		other.m_max = 0;
+		other.m_damage_generation = 0;
+		m_bounds_generation = ~size_t(0);
+	}
+
+	DamageMaskHandle& operator=(const DamageMaskHandle& other) {
+		if (this != &other)
+			reset();
+
+		return *this;
+	}
+
+	DamageMaskHandle& operator=(DamageMaskHandle&& other) noexcept {
+		if (this != &other) {
+			reset();
+			m_rect = other.m_rect;
+			m_cpu = std::move(other.m_cpu);
+			m_max = other.m_max;
+			m_damage_generation = other.m_damage_generation;
+			m_bounds_generation = ~size_t(0);
+			other.m_rect = AtlasRect();
+			other.m_max = 0;
+			other.m_damage_generation = 0;
+		}
+
+		return *this;
+	}
+
+	~DamageMaskHandle() {
+		reset();
+	}
+
+	// scale is the mask resolution as a fraction of the stamp size
+	void allocate(int width, int height, float scale) {
+		reset();
+
+		int mask_width = std::max(1, int(std::ceil(width * scale)));
+		int mask_height = std::max(1, int(std::ceil(height * scale)));
+
+		m_rect = damageMaskAtlas.allocate(mask_width, mask_height, size_t(width) * height * 4);
+
+		if (m_rect.valid())
+			m_cpu.assign(size_t(mask_width) * mask_height, 0);
+	}
+
+	void reset() {
+		damageMaskAtlas.free(m_rect);
+		m_rect = AtlasRect();
+		m_cpu.clear();
+		m_max = 0;
+		m_damage_generation++;
+	}
+
+	// CPU version of blackeningSplatVertexShader/FragmentShader: quadratic falloff,
+	// max blended, evaluated at texel centres and stored as 8 bits like the R8 page
+	void applySplat(const BlackeningPoint& bp) {
+		if (!m_rect.valid())
+			return;
+
+		const float page_size = float(DamageMaskAtlas::PAGE_SIZE);
+
+		int x0 = std::max(m_rect.x, int(std::floor((bp.x - bp.radius) * page_size)));
+		int y0 = std::max(m_rect.y, int(std::floor((bp.y - bp.radius) * page_size)));
+		int x1 = std::min(m_rect.x + m_rect.width - 1, int(std::ceil((bp.x + bp.radius) * page_size)));
+		int y1 = std::min(m_rect.y + m_rect.height - 1, int(std::ceil((bp.y + bp.radius) * page_size)));
+
+		for (int py = y0; py <= y1; py++) {
+			float sy = ((py + 0.5f) / page_size - bp.y) / bp.radius;
+
+			for (int px = x0; px <= x1; px++) {
+				float sx = ((px + 0.5f) / page_size - bp.x) / bp.radius;
+				float distance_squared = sx * sx + sy * sy;
+
+				if (distance_squared > 1.0f)
+					continue;
+
+				float blackening = std::min(1.0f, std::max(0.0f, (1.0f - distance_squared) * bp.intensity));
+				unsigned char value = (unsigned char)(blackening * 255.0f + 0.5f);
+				unsigned char& cell = m_cpu[size_t(py - m_rect.y) * m_rect.width + (px - m_rect.x)];
+
+				if (value > cell) {
+					cell = value;
+					m_max = std::max(m_max, value);
+					m_damage_generation++;
+				}
+			}
+		}
+	}
+
+	// Bilinear lookup at stamp texture coordinates, clamped like sampleDamage in the shaders
+	float sample(float u, float v) const {
+		float tx = std::min(std::max(u * m_rect.width, 0.5f), m_rect.width - 0.5f) - 0.5f;
+		float ty = std::min(std::max(v * m_rect.height, 0.5f), m_rect.height - 0.5f) - 0.5f;
+
+		int ix = int(tx);
+		int iy = int(ty);
+		float fx = tx - ix;
+		float fy = ty - iy;
+		int ix1 = std::min(ix + 1, m_rect.width - 1);
+		int iy1 = std::min(iy + 1, m_rect.height - 1);
+
+		float a = m_cpu[size_t(iy) * m_rect.width + ix];
+		float b = m_cpu[size_t(iy) * m_rect.width + ix1];
+		float c = m_cpu[size_t(iy1) * m_rect.width + ix];
+		float d = m_cpu[size_t(iy1) * m_rect.width + ix1];
+
+		return ((a * (1.0f - fx) + b * fx) * (1.0f - fy) + (c * (1.0f - fx) + d * fx) * fy) / 255.0f;
+	}
+
+	// Same rule as isEroded in the stamp shaders, for stamp pixel (x, y)
+	bool isEroded(int x, int y, int stampWidth, int stampHeight) const {
+		// Nothing anywhere is close to saturated yet, which is the common case
+		if (m_max < ERODABLE)
+			return false;
+
+		// Only masks that took damage since the last query get their bounds rebuilt
+		if (m_bounds_generation != m_damage_generation)
+			updateErodableBounds();
+
+		// The four cells the bilinear lookup reads, the pixel can't erode unless one is in the bounds
+		float tx = std::min(std::max((x + 0.5f) / stampWidth * m_rect.width, 0.5f), m_rect.width - 0.5f) - 0.5f;
+		float ty = std::min(std::max((y + 0.5f) / stampHeight * m_rect.height, 0.5f), m_rect.height - 0.5f) - 0.5f;
+		int ix = int(tx);
+		int iy = int(ty);
+
+		if (ix + 1 < m_bounds[0] || ix > m_bounds[2] || iy + 1 < m_bounds[1] || iy > m_bounds[3])
+			return false;
+
+		float damage = sample((x + 0.5f) / stampWidth, (y + 0.5f) / stampHeight);
+		float noise = (erosionHash(uint32_t(x), uint32_t(y)) & 0xffffu) / 65535.0f;
+
+		return damage >= 1.0f - EROSION_NOISE * noise;
+	}
+
+	bool valid() const {
+		return m_rect.valid();
+	}
+
+	const AtlasRect& rect() const {
+		return m_rect;
+	}
+
+	// Offset and scale of the rect inside its page, for the shaders
+	void uvTransform(float& u, float& v, float& du, float& dv) const {
+		u = m_rect.x / float(DamageMaskAtlas::PAGE_SIZE);
+		v = m_rect.y / float(DamageMaskAtlas::PAGE_SIZE);
+		du = m_rect.width / float(DamageMaskAtlas::PAGE_SIZE);
+		dv = m_rect.height / float(DamageMaskAtlas::PAGE_SIZE);
+	}
+
+private:
+	// isEroded needs damage >= 1 - EROSION_NOISE at the least, so a bilinear lookup needs a cell at least this high
+	static const unsigned char ERODABLE;
+
+	// Cells at ERODABLE or above, as min x, min y, max x, max y
+	void updateErodableBounds() const {
+		m_bounds[0] = m_rect.width;
+		m_bounds[1] = m_rect.height;
+		m_bounds[2] = -1;
+		m_bounds[3] = -1;
+
+		for (int y = 0; y < m_rect.height; y++) {
+			for (int x = 0; x < m_rect.width; x++) {
+				if (m_cpu[size_t(y) * m_rect.width + x] >= ERODABLE) {
+					m_bounds[0] = std::min(m_bounds[0], x);
+					m_bounds[1] = std::min(m_bounds[1], y);
+					m_bounds[2] = std::max(m_bounds[2], x);
+					m_bounds[3] = std::max(m_bounds[3], y);
+				}
+			}
+		}
+
+		m_bounds_generation = m_damage_generation;
+	}
+
+	AtlasRect m_rect;
+	std::vector<unsigned char> m_cpu;
+	unsigned char m_max = 0;
+
+	// Bumped whenever a splat raises a cell, the bounds are only rebuilt when they're behind it
+	size_t m_damage_generation = 0;
+	mutable size_t m_bounds_generation = ~size_t(0);
+	mutable int m_bounds[4] = { 0, 0, -1, -1 };
+};
+
+// Rounded down, so it never skips a mask the shaders would erode
+const unsigned char DamageMaskHandle::ERODABLE =
+	(unsigned char)std::min(255.0f, std::max(0.0f, std::floor((1.0f - EROSION_NOISE) * 255.0f)));
+
+
+
+// Pixels and GL textures of one template, loaded once and shared by every Stamp made from it
+// Never modified after loading, damage lives in each Stamp's own damage mask
+class StampAsset {
+public:
+	StampAsset() {}
+
+	StampAsset(const StampAsset&) = delete;
+	StampAsset& operator=(const StampAsset&) = delete;
+
+	~StampAsset()
+	{
+		for (GLuint textureID : textureIDs) {
+			if (textureID != 0) {
+				glDeleteTextures(1, &textureID);
+			}
+		}
+
+		for (const AtlasRect& rect : atlasRects)
+			spriteAtlas.free(rect);
+	}
+
+	std::vector<GLuint> textureIDs;         // Multiple texture IDs
+	std::vector<AtlasRect> atlasRects;      // Copies in spriteAtlas, empty for bullets which are never drawn as sprites
+	std::string baseFilename;               // Base filename without suffix
+	std::vector<std::string> textureNames;  // Names of the specific textures
+	std::vector<std::vector<unsigned char>> pixelData; // Template pixels, one per texture
+	std::vector<std::vector<unsigned char>> collisionMasks; // Alpha > 0 bits per texture, see buildCollisionMask
+};
+
+
+
+// Ships, foreground chunks and power ups are made of these components
+// Each kind of entity keeps every component in its own array (see Archetype), so a system only
+// pulls the components it works on into the cache
+
+struct Transform {
+	float posX = 0, posY = 0;
+	float prevPosX = 0, prevPosY = 0;
+};
+
+struct Velocity {
+	float local_velX = 0, local_velY = 0;
+};
+
+// Power ups weave along a sine wave around their velocity
+struct Wave {
+	float sinusoidal_frequency = 5.0f;
+	float sinusoidal_amplitude = 0.001f;
+	bool sinusoidal_shift = false;
+};
+
+struct Lifetime {
+	float birth_time = 0;
+	float death_time = -1;
+	float stamp_opacity = 1; // Fades out once to_be_culled is set
+	bool to_be_culled = false;
+};
+
+struct Health {
+	float health = 10.0;
+	bool under_fire = false;
+};
+
+// Where a foreground chunk's pixels came from in the foreground it was cut out of
+struct Foreground {
+	float data_offsetX = 0.0f;
+	float data_offsetY = 0.0f;
+	int data_original_width = 0;
+	int data_original_height = 0;
+};
+
+struct Powerup {
+	enum powerup_type powerup;
+};
+
+// What an entity looks like: its textures, the pixels that pixel-perfect collisions read, and its damage
+// Copying a Sprite is cheap: the template asset is shared, and the damage mask isn't copied
+// (the copy starts out undamaged), so spawning never touches the GPU
+class Sprite {
+public:
+	// Method to initialize the damage mask
+	void initDamageMask() {
+		if (!damageMask.valid()) {
+			frameAllocations.allowAllocations(); // The CPU copy of the mask
+			damageMask.allocate(width, height, damage_mask_scale);
+		}
+	}
+
+	// Check if any blackening is present
+	bool hasBlackening() const {
+		return damageMask.valid();
+	}
+
+	const std::vector<GLuint>& textureIDs() const {
+		static const std::vector<GLuint> none;
+		return asset ? asset->textureIDs : none;
+	}
+
+	const std::vector<std::vector<unsigned char>>& pixelData() const {
+		static const std::vector<std::vector<unsigned char>> none;
+		return asset ? asset->pixelData : none;
+	}
+
+	const std::vector<std::vector<unsigned char>>& collisionMasks() const {
+		static const std::vector<std::vector<unsigned char>> none;
+		return asset ? asset->collisionMasks : none;
+	}
+
+	const std::string& baseFilename() const {
+		static const std::string none;
+		return asset ? asset->baseFilename : none;
+	}
+
+	const std::vector<std::string>& textureNames() const {
+		static const std::vector<std::string> none;
+		return asset ? asset->textureNames : none;
+	}
+
+	const std::vector<AtlasRect>& atlasRects() const {
+		static const std::vector<AtlasRect> none;
+		return asset ? asset->atlasRects : none;
+	}
+
+	// StampTexture properties
+	std::shared_ptr<const StampAsset> asset; // Shared with the template and every other copy
+	int width = 0; // pixels
+	int height = 0; // pixels
+
+	// Blackening mask, a rect in damageMaskAtlas
+	// The asset always holds the pristine template pixels,
+	// the damage is only applied when drawing (stampTextureFragmentShader) and in the obstacle pass
+	DamageMaskHandle damageMask;
+
+	// Damage mask resolution as a fraction of width/height, set per template
+	float damage_mask_scale = 1.0f;
+
+	int channels = 0;
+	//	vector<vec2> curve_path;
+	size_t currentVariationIndex = 0;
+	vector<Cannon> cannons;
+};
+
+// A whole entity in one struct, used for templates and while building something to spawn
+// Pushing one into an Archetype splits it into the components that archetype has
+class Stamp : public Sprite, public Transform, public Velocity, public Wave, public Lifetime, public Health, public Foreground, public Powerup {
+};
+
+
+
+
+// Bullets aren't Stamps anymore, they're plain particles in a structure-of-arrays store
+// so that the per-frame update is a tight loop over contiguous floats
+enum BulletFaction : unsigned char { ALLY_FACTION, ENEMY_FACTION };
+
+// Everything needed to emit one bullet, the defaults match the old bullet Stamp's
+struct BulletSpawn {
+	float posX = 0, posY = 0;
+	float velX = 0, velY = 0;
+	float birth_time = 0;
+	float death_time = -1;
+	float sinusoidal_frequency = 5.0f;
+	float sinusoidal_amplitude = 0.001f;
+	bool sinusoidal_shift = false;
+	float path_randomization = 0.0f;
+	float random_forking = 0.0f;
+	float force_radius = 0.02f;
+	float colour_radius = force_radius;
+	float force_randomization = 0;
+	float colour_randomization = 0;
+	bool is_dying_bullet = false;
+	BulletFaction faction = ALLY_FACTION;
+};
+
+// sin() for the bullet kernel, the same polynomial is used by the scalar and AVX2 paths
+// so that they produce the same trajectories
+// Reduced to [-pi/2, pi/2], then a 9th order Taylor polynomial, max error is about 4e-6
+inline float bulletSin(float x) {
+	const float pi = 3.14159265f;
+	x -= std::nearbyint(x * (0.5f / pi)) * (2.0f * pi);
+
+	if (x > 0.5f * pi)
+		x = pi - x;
+	else if (x < -0.5f * pi)
+		x = -pi - x;
+
+	float x2 = x * x;
+	float p = 1.0f / 362880.0f;
+	p = p * x2 - 1.0f / 5040.0f;
+	p = p * x2 + 1.0f / 120.0f;
+	p = p * x2 - 1.0f / 6.0f;
+	p = p * x2 + 1.0f;
+	return p * x;
+}
+
+#ifdef __AVX2__
+inline __m256 bulletSin8(__m256 x) {
+	const float pi = 3.14159265f;
+	const __m256 vPi = _mm256_set1_ps(pi);
+	const __m256 vHalfPi = _mm256_set1_ps(0.5f * pi);
+
+	__m256 k = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(0.5f / pi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	x = _mm256_sub_ps(x, _mm256_mul_ps(k, _mm256_set1_ps(2.0f * pi)));
+
+	__m256 above = _mm256_cmp_ps(x, vHalfPi, _CMP_GT_OQ);
+	__m256 below = _mm256_cmp_ps(x, _mm256_sub_ps(_mm256_setzero_ps(), vHalfPi), _CMP_LT_OQ);
+	x = _mm256_blendv_ps(x, _mm256_sub_ps(vPi, x), above);
+	x = _mm256_blendv_ps(x, _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), vPi), x), below);
+
+	__m256 x2 = _mm256_mul_ps(x, x);
+	__m256 p = _mm256_set1_ps(1.0f / 362880.0f);
+	p = _mm256_sub_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(1.0f / 5040.0f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(1.0f / 120.0f));
+	p = _mm256_sub_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(1.0f / 6.0f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(1.0f));
+	return _mm256_mul_ps(p, x);
+}
+#endif
+
+// Random numbers, xoshiro128** seeded through splitmix64
+// Each system owns its own stream, so nothing is shared between threads and a run
+// is reproducible from the level seed alone, unlike rand()
+inline uint64_t splitMix64(uint64_t& x) {
+	uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+inline uint32_t rotl32(uint32_t x, int k) {
+	return (x << k) | (x >> (32 - k));
+}
+
+class Rng {
+public:
+	explicit Rng(uint64_t seed = 1) {
+		uint64_t sm = seed;
+		uint64_t a = splitMix64(sm);
+		uint64_t b = splitMix64(sm);
+		s[0] = uint32_t(a);
+		s[1] = uint32_t(a >> 32);
+		s[2] = uint32_t(b);
+		s[3] = uint32_t(b >> 32);
+	}
+
+	uint32_t next() {
+		const uint32_t result = rotl32(s[1] * 5, 7) * 9;
+		const uint32_t t = s[1] << 9;
+
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl32(s[3], 11);
+
+		return result;
+	}
+
+	// [0, 1), the top 24 bits fill the mantissa exactly
+	float uniform() {
+		return (next() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	float range(float lo, float hi) {
+		return lo + (hi - lo) * uniform();
+	}
+
+	// [0, n), Lemire's multiply instead of %, no division
+	uint32_t below(uint32_t n) {
+		return uint32_t((uint64_t(next()) * n) >> 32);
+	}
+
+	void unitVector(float& x_out, float& y_out) {
+		const float pi = 3.14159265f;
+		const float a = uniform() * 2.0f * pi;
+
+		x_out = cos(a);
+		y_out = sin(a);
+	}
+
+private:
+	uint32_t s[4];
+};
+
+// Eight xoshiro128** generators side by side, one per AVX2 lane
+// The scalar fallback steps the same lanes with the same polynomial, so both builds draw the same numbers
+class RngLanes {
+public:
+	static const int LANES = 8;
+
+	explicit RngLanes(uint64_t seed = 1) {
+		uint64_t sm = seed;
+		for (int l = 0; l < LANES; l++) {
+			uint64_t a = splitMix64(sm);
+			uint64_t b = splitMix64(sm);
+			s0[l] = uint32_t(a);
+			s1[l] = uint32_t(a >> 32);
+			s2[l] = uint32_t(b);
+			s3[l] = uint32_t(b >> 32);
+		}
+	}
+
+	// Eight random unit vectors
+	void unitVectors(float* x_out, float* y_out) {
+		const float pi = 3.14159265f;
+#ifdef __AVX2__
+		__m256i a = _mm256_loadu_si256((const __m256i*)s0);
+		__m256i b = _mm256_loadu_si256((const __m256i*)s1);
+		__m256i c = _mm256_loadu_si256((const __m256i*)s2);
+		__m256i d = _mm256_loadu_si256((const __m256i*)s3);
+
+		// rotl(b * 5, 7) * 9, the multiplies as shift and add
+		__m256i r = _mm256_add_epi32(_mm256_slli_epi32(b, 2), b);
+		r = _mm256_or_si256(_mm256_slli_epi32(r, 7), _mm256_srli_epi32(r, 25));
+		r = _mm256_add_epi32(_mm256_slli_epi32(r, 3), r);
+
+		const __m256i t = _mm256_slli_epi32(b, 9);
+		c = _mm256_xor_si256(c, a);
+		d = _mm256_xor_si256(d, b);
+		b = _mm256_xor_si256(b, c);
+		a = _mm256_xor_si256(a, d);
+		c = _mm256_xor_si256(c, t);
+		d = _mm256_or_si256(_mm256_slli_epi32(d, 11), _mm256_srli_epi32(d, 21));
+
+		_mm256_storeu_si256((__m256i*)s0, a);
+		_mm256_storeu_si256((__m256i*)s1, b);
+		_mm256_storeu_si256((__m256i*)s2, c);
+		_mm256_storeu_si256((__m256i*)s3, d);
+
+		__m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(r, 8)), _mm256_set1_ps(1.0f / 16777216.0f));
+		__m256 angle = _mm256_mul_ps(u, _mm256_set1_ps(2.0f * pi));
+
+		_mm256_storeu_ps(x_out, bulletSin8(_mm256_add_ps(angle, _mm256_set1_ps(0.5f * pi))));
+		_mm256_storeu_ps(y_out, bulletSin8(angle));
+#else
+		for (int l = 0; l < LANES; l++) {
+			const uint32_t r = rotl32(s1[l] * 5, 7) * 9;
+			const uint32_t t = s1[l] << 9;
+
+			s2[l] ^= s0[l];
+			s3[l] ^= s1[l];
+			s1[l] ^= s2[l];
+			s0[l] ^= s3[l];
+			s2[l] ^= t;
+			s3[l] = rotl32(s3[l], 11);
+
+			float angle = (r >> 8) * (1.0f / 16777216.0f) * (2.0f * pi);
+			x_out[l] = bulletSin(angle + 0.5f * pi);
+			y_out[l] = bulletSin(angle);
+		}
+#endif
+	}
+
+private:
+	uint32_t s0[LANES], s1[LANES], s2[LANES], s3[LANES];
+};
+
+// One stream per system, all derived from the level seed by seedRngStreams()
+// Code that runs on several threads asks makeRng() for a stream per thread instead of sharing one
+enum RngStream : uint32_t {
+	BULLET_RNG,
+	FIRE_RNG,
+	EXPLOSION_RNG,
+	SPAWN_RNG,
+	BENCHMARK_RNG,
+};
+
+uint64_t level_seed = 1;
+uint64_t seed_override = 0; // From --seed, 0 means use level.cfg
+
+Rng makeRng(RngStream stream, uint32_t thread = 0) {
+	return Rng(level_seed ^ (uint64_t(stream) << 48) ^ (uint64_t(thread) << 32));
+}
+
+RngLanes makeRngLanes(RngStream stream, uint32_t thread = 0) {
+	return RngLanes(level_seed ^ (uint64_t(stream) << 48) ^ (uint64_t(thread) << 32) ^ 0x5bd1e995ull);
+}
+
+Rng bulletRng, fireRng, explosionRng, spawnRng;
+RngLanes bulletLanes;
+
+void seedRngStreams(uint64_t seed) {
+	level_seed = seed;
+	bulletRng = makeRng(BULLET_RNG);
+	bulletLanes = makeRngLanes(BULLET_RNG);
+	fireRng = makeRng(FIRE_RNG);
+	explosionRng = makeRng(EXPLOSION_RNG);
+	spawnRng = makeRng(SPAWN_RNG);
+
+	std::cout << "Random seed " << seed << std::endl;
+}
+
+class BulletParticles {
+public:
+	std::vector<float> posX, posY;
+	std::vector<float> prevPosX, prevPosY;
+	std::vector<float> velX, velY;
+	std::vector<float> birth_time, death_time;
+	std::vector<float> sinusoidal_frequency;
+	std::vector<float> sinusoidal_amplitude; // Negative for sinusoidal_shift, the wave starts on the other side
+	std::vector<float> path_randomization;
+	std::vector<float> random_forking;
+	std::vector<float> colour_radius;
+	std::vector<float> scroll; // 1 for dying bullets, which move along with the foreground
+	std::vector<unsigned char> faction;
+
+	size_t size() const { return posX.size(); }
+	bool empty() const { return posX.empty(); }
+
+	void clear() {
+		for (std::vector<float>* a : floatArrays())
+			a->clear();
+		faction.clear();
+	}
+
+	void reserve(size_t n) {
+		for (std::vector<float>* a : floatArrays())
+			a->reserve(n);
+		faction.reserve(n);
+		m_keep.reserve(n);
+	}
+
+	// Fixed size pool, bullets emitted while it's full are dropped instead of growing the arrays
+	// 0 means unbounded, which the benchmark uses
+	void setCapacity(size_t n) {
+		reserve(n);
+		m_capacity = n;
+	}
+
+	size_t capacity() const { return m_capacity; }
+	size_t dropped() const { return m_dropped; }
+
+	void emit(const BulletSpawn& s) {
+		if (m_capacity != 0 && size() >= m_capacity) {
+			m_dropped++;
+			return;
+		}
+
+		posX.push_back(s.posX);
+		posY.push_back(s.posY);
+		prevPosX.push_back(s.posX);
+		prevPosY.push_back(s.posY);
+		velX.push_back(s.velX);
+		velY.push_back(s.velY);
+		birth_time.push_back(s.birth_time);
+		death_time.push_back(s.death_time);
+		sinusoidal_frequency.push_back(s.sinusoidal_frequency);
+		sinusoidal_amplitude.push_back(s.sinusoidal_shift ? -s.sinusoidal_amplitude : s.sinusoidal_amplitude);
+		path_randomization.push_back(s.path_randomization);
+		random_forking.push_back(s.random_forking);
+		colour_radius.push_back(s.colour_radius);
+		scroll.push_back(s.is_dying_bullet ? 1.0f : 0.0f);
+		faction.push_back(s.faction);
+	}
+
+	// Read a bullet back out, used for forking
+	BulletSpawn spawnFrom(size_t i) const {
+		BulletSpawn s;
+		s.posX = posX[i];
+		s.posY = posY[i];
+		s.velX = velX[i];
+		s.velY = velY[i];
+		s.birth_time = birth_time[i];
+		s.death_time = death_time[i];
+		s.sinusoidal_frequency = sinusoidal_frequency[i];
+		s.sinusoidal_amplitude = std::fabs(sinusoidal_amplitude[i]);
+		s.sinusoidal_shift = sinusoidal_amplitude[i] < 0;
+		s.path_randomization = path_randomization[i];
+		s.random_forking = random_forking[i];
+		s.colour_radius = colour_radius[i];
+		s.is_dying_bullet = scroll[i] != 0.0f;
+		s.faction = BulletFaction(faction[i]);
+		return s;
+	}
+
+	// Move every bullet along its path plus the sinusoidal offset perpendicular to it
+	// The random walk and forking are done by the caller, they draw from the bullet RNG
+	void update() {
+#ifdef __AVX2__
+		updateAVX2(0, size());
+#else
+		updateScalar(0, size());
+#endif
+	}
+
+	void updateScalar(size_t begin, size_t end) {
+		const float aspectDT = HEIGHT / float(WIDTH) * DT;
+		const float scrollDT = foreground_vel * DT;
+
+		for (size_t i = begin; i < end; i++) {
+			prevPosX[i] = posX[i];
+			prevPosY[i] = posY[i];
+
+			float dirX = velX[i] * aspectDT;
+			float dirY = velY[i] * DT;
+
+			float len2 = dirX * dirX + dirY * dirY;
+			float invLength = len2 > 0 ? 1.0f / std::sqrt(len2) : 0.0f;
+
+			float wave = bulletSin((GLOBAL_TIME - birth_time[i]) * sinusoidal_frequency[i]) * sinusoidal_amplitude[i];
+
+			// Forward along the path, then sideways along the perpendicular
+			posX[i] += dirX - dirY * invLength * wave + scroll[i] * scrollDT;
+			posY[i] += dirY + dirX * invLength * wave;
+		}
+	}
+
+#ifdef __AVX2__
+	void updateAVX2(size_t begin, size_t end) {
+		const __m256 vAspectDT = _mm256_set1_ps(HEIGHT / float(WIDTH) * DT);
+		const __m256 vDT = _mm256_set1_ps(DT);
+		const __m256 vScrollDT = _mm256_set1_ps(foreground_vel * DT);
+		const __m256 vTime = _mm256_set1_ps(GLOBAL_TIME);
+		const __m256 vOne = _mm256_set1_ps(1.0f);
+		const __m256 vZero = _mm256_setzero_ps();
+
+		size_t i = begin;
+
+		for (; i + 8 <= end; i += 8) {
+			__m256 px = _mm256_loadu_ps(&posX[i]);
+			__m256 py = _mm256_loadu_ps(&posY[i]);
+			_mm256_storeu_ps(&prevPosX[i], px);
+			_mm256_storeu_ps(&prevPosY[i], py);
+
+			__m256 dirX = _mm256_mul_ps(_mm256_loadu_ps(&velX[i]), vAspectDT);
+			__m256 dirY = _mm256_mul_ps(_mm256_loadu_ps(&velY[i]), vDT);
+
+			// Stationary bullets get a zero perpendicular instead of inf
+			__m256 len2 = _mm256_add_ps(_mm256_mul_ps(dirX, dirX), _mm256_mul_ps(dirY, dirY));
+			__m256 invLength = _mm256_div_ps(vOne, _mm256_sqrt_ps(len2));
+			invLength = _mm256_and_ps(invLength, _mm256_cmp_ps(len2, vZero, _CMP_GT_OQ));
+
+			__m256 t = _mm256_sub_ps(vTime, _mm256_loadu_ps(&birth_time[i]));
+			__m256 wave = bulletSin8(_mm256_mul_ps(t, _mm256_loadu_ps(&sinusoidal_frequency[i])));
+			wave = _mm256_mul_ps(_mm256_mul_ps(wave, _mm256_loadu_ps(&sinusoidal_amplitude[i])), invLength);
+
+			px = _mm256_add_ps(px, _mm256_sub_ps(dirX, _mm256_mul_ps(dirY, wave)));
+			px = _mm256_add_ps(px, _mm256_mul_ps(_mm256_loadu_ps(&scroll[i]), vScrollDT));
+			py = _mm256_add_ps(py, _mm256_add_ps(dirY, _mm256_mul_ps(dirX, wave)));
+
+			_mm256_storeu_ps(&posX[i], px);
+			_mm256_storeu_ps(&posY[i], py);
+		}
+
+		updateScalar(i, end);
+	}
+#endif
+
+	// Stream compaction, survivors are moved down over the dead bullets keeping their order
+	// A bullet dies once its death time has passed (hits set it to now) or it leaves the screen
+	void cull() {
+		const float aspect = WIDTH / float(HEIGHT);
+		const size_t n = size();
+
+		m_keep.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			float adjustedPosY = (posY[i] - 0.5f) * aspect + 0.5f;
+
+			// Bitwise rather than logical ops, so there are no branches to mispredict
+			bool dead = ((death_time[i] >= 0.0f) & (death_time[i] <= GLOBAL_TIME)) |
+				(posX[i] < 0) | (posX[i] > 1) | (adjustedPosY < 0) | (adjustedPosY > 1);
+
+			m_keep[i] = dead ? 0 : 1;
+		}
+
+		// One array at a time, branch free: every element is written, only survivors advance the cursor
+		size_t alive = 0;
+		for (std::vector<float>* a : floatArrays()) {
+			float* data = a->data();
+			alive = 0;
+			for (size_t i = 0; i < n; i++) {
+				data[alive] = data[i];
+				alive += m_keep[i];
+			}
+			a->resize(alive);
+		}
+
+		alive = 0;
+		for (size_t i = 0; i < n; i++) {
+			faction[alive] = faction[i];
+			alive += m_keep[i];
+		}
+		faction.resize(alive);
+	}
+
+private:
+	std::array<std::vector<float>*, 14> floatArrays() {
+		return { &posX, &posY, &prevPosX, &prevPosY, &velX, &velY, &birth_time, &death_time,
+			&sinusoidal_frequency, &sinusoidal_amplitude, &path_randomization, &random_forking,
+			&colour_radius, &scroll };
+	}
+
+	std::vector<unsigned char> m_keep;
+	size_t m_capacity = 0;
+	size_t m_dropped = 0;
+};
+
+
+
+// Stable reference to an entity in an Archetype, it survives culling and reordering
+// Once the element is culled the handle just stops resolving, even if the slot gets reused
+struct EntityHandle {
+	uint32_t slot = UINT32_MAX;
+	uint32_t generation = 0;
+
+	bool operator==(const EntityHandle& other) const { return slot == other.slot && generation == other.generation; }
+	bool operator!=(const EntityHandle& other) const { return !(*this == other); }
+};
+
+// All the entities of one kind, each component in its own tightly packed array (structure of arrays)
+// Every entity in an archetype has the same components, so systems never check whether one has
+// something: foreground chunks, for instance, are their own archetype rather than flagged enemy ships
+// Removal is one order-preserving compaction pass over every array, so allyShips stays in spawn order,
+// and handles (playerShip) survive it
+template <typename... Components>
+class Archetype {
+public:
+	template <typename C>
+	static constexpr bool has() { return (std::is_same<C, Components>::value || ...); }
+
+	size_t size() const { return m_slotOf.size(); }
+	bool empty() const { return m_slotOf.empty(); }
+
+	template <typename C>
+	std::vector<C>& column() { return std::get<std::vector<C>>(m_columns); }
+
+	template <typename C>
+	const std::vector<C>& column() const { return std::get<std::vector<C>>(m_columns); }
+
+	template <typename C>
+	C& get(size_t i) { return column<C>()[i]; }
+
+	template <typename C>
+	const C& get(size_t i) const { return column<C>()[i]; }
+
+	// Splits a Stamp (or anything else made of these components) into the arrays
+	template <typename Entity>
+	EntityHandle push_back(const Entity& entity) {
+		if (size() == capacity() && capacity() != 0)
+			m_growths++;
+
+		(column<Components>().push_back(static_cast<const Components&>(entity)), ...);
+		return claimSlot();
+	}
+
+	EntityHandle handleAt(size_t i) const {
+		EntityHandle h;
+		h.slot = m_slotOf[i];
+		h.generation = m_slots[h.slot].generation;
+		return h;
+	}
+
+	// SIZE_MAX once the entity has been removed
+	size_t indexOf(EntityHandle h) const {
+		if (h.slot >= m_slots.size() || m_slots[h.slot].generation != h.generation)
+			return SIZE_MAX;
+
+		return m_slots[h.slot].index;
+	}
+
+	// dead(i) is asked about every entity, then survivors are moved down over the dead ones, keeping their order
+	// Returns how many were removed
+	template <typename Predicate>
+	size_t removeIf(Predicate dead) {
+		const size_t n = size();
+		size_t alive = 0;
+
+		m_keep.resize(n);
+
+		for (size_t i = 0; i < n; i++) {
+			m_keep[i] = !dead(i);
+
+			if (!m_keep[i]) {
+				releaseSlot(m_slotOf[i]);
+				continue;
+			}
+
+			m_slotOf[alive] = m_slotOf[i];
+			m_slots[m_slotOf[alive]].index = uint32_t(alive);
+			alive++;
+		}
+
+		if (alive == n)
+			return 0;
+
+		std::apply([&](auto&... columns) { (compact(columns, alive), ...); }, m_columns);
+		m_slotOf.resize(alive);
+		return n - alive;
+	}
+
+	void clear() {
+		for (uint32_t slot : m_slotOf)
+			releaseSlot(slot);
+
+		std::apply([](auto&... columns) { (columns.clear(), ...); }, m_columns);
+		m_slotOf.clear();
+	}
+
+	// Pool size, spawning up to this many never reallocates (which would move every element)
+	void reserve(size_t n) {
+		std::apply([n](auto&... columns) { (columns.reserve(n), ...); }, m_columns);
+		m_slotOf.reserve(n);
+		m_slots.reserve(n);
+		m_freeSlots.reserve(n);
+		m_keep.reserve(n);
+	}
+
+	size_t capacity() const { return m_slotOf.capacity(); }
+
+	// How many times spawning went past the pool size, if this isn't 0 the level config is too small
+	// The limit is soft: a ship or foreground chunk is never dropped, the arrays grow and the frame guard reports it
+	size_t growths() const { return m_growths; }
+
+private:
+	struct Slot {
+		uint32_t index;      // Where the entity currently is in the arrays
+		uint32_t generation; // Bumped every time the slot is released
+	};
+
+	template <typename C>
+	void compact(std::vector<C>& column, size_t alive) {
+		size_t out = 0;
+
+		for (size_t i = 0; i < column.size(); i++) {
+			if (!m_keep[i])
+				continue;
+
+			if (out != i)
+				column[out] = std::move(column[i]);
+
+			out++;
+		}
+
+		column.erase(column.begin() + alive, column.end());
+	}
+
+	EntityHandle claimSlot() {
+		uint32_t slot;
+
+		if (!m_freeSlots.empty()) {
+			slot = m_freeSlots.back();
+			m_freeSlots.pop_back();
+		}
+		else {
+			slot = uint32_t(m_slots.size());
+			m_slots.push_back(Slot{ 0, 0 });
+		}
+
+		m_slots[slot].index = uint32_t(m_slotOf.size());
+		m_slotOf.push_back(slot);
+
+		EntityHandle h;
+		h.slot = slot;
+		h.generation = m_slots[slot].generation;
+		return h;
+	}
+
+	void releaseSlot(uint32_t slot) {
+		m_slots[slot].generation++;
+		m_freeSlots.push_back(slot);
+	}
+
+	std::tuple<std::vector<Components>...> m_columns;
+	std::vector<uint32_t> m_slotOf; // Parallel to the columns
+	std::vector<Slot> m_slots;
+	std::vector<uint32_t> m_freeSlots;
+	std::vector<unsigned char> m_keep;
+	size_t m_growths = 0;
+};
+
+typedef Archetype<Transform, Velocity, Lifetime, Health, Sprite> ShipArchetype;
+typedef Archetype<Transform, Velocity, Lifetime, Health, Foreground, Sprite> ForegroundArchetype;
+typedef Archetype<Transform, Velocity, Wave, Lifetime, Powerup, Sprite> PowerUpArchetype;
+
+
+
+ShipArchetype allyShips;
+ShipArchetype enemyShips;
+ForegroundArchetype foregroundChunks;
+
+// The player's ship, the first ally placed while there isn't one
+// Once it's culled this stops resolving, the other allies don't take over its controls
+EntityHandle playerShip;
+
+// Where the player's ship is in allyShips, SIZE_MAX without one
+size_t playerIndex() {
+	return allyShips.indexOf(playerShip);
+}
+BulletParticles bullets; // Both factions
+
+// Bullets live on the GPU instead (GPUBulletSystem); toggled with 'g'
+bool gpu_bullets = false;
+void emitBullet(const BulletSpawn& s);
+PowerUpArchetype allyPowerUps;
+
+
+std::vector<Stamp> allyTemplates;
+std::vector<Stamp> enemyTemplates;
+std::vector<Stamp> bulletTemplates;
+std::vector<Stamp> powerUpTemplates;
+std::vector<Stamp> foregroundTemplates;
+
+
+
+
+int currentAllyTemplateIndex = 0;    // Index for selecting ally template stamps
+int currentEnemyTemplateIndex = 0;   // Index for selecting enemy template stamps
+int currentPowerUpTemplateIndex = 0;
+
+enum TemplateType { ALLY, ENEMY, BULLET, POWERUP };
+
+TemplateType currentTemplateType = ALLY;
+
+
+
+
+
+
+// A fixed set of worker threads taking tasks from one queue
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned threads) {
+		for (unsigned i = 0; i < threads; i++)
+			m_workers.emplace_back([this]() { work(); });
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+
+		for (std::thread& worker : m_workers)
+			worker.join();
+	}
+
+	void submit(std::function<void()> task) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_tasks.push_back(std::move(task));
+			m_pending++;
+		}
+		m_wake.notify_one();
+	}
+
+	// Blocks until every submitted task has finished
+	void wait() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_idle.wait(lock, [this]() { return m_pending == 0; });
+	}
+
+	size_t size() const { return m_workers.size(); }
+
+private:
+	void work() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+
+				if (m_tasks.empty())
+					return;
+
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+			}
+
+			task();
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_pending == 0)
+				m_idle.notify_all();
+		}
+	}
+
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()>> m_tasks;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_idle;
+	size_t m_pending = 0;
+	bool m_stopping = false;
+};
+
+// Resamples foreground chunks, made the first time a foreground is chunked and kept for the rest of the run
+ThreadPool& chunkWorkers() {
+	static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	return pool;
+}
+
+// Foregrounds are cut into chunks this size, the asset pack stores which of them have any pixels
+const int FOREGROUND_CHUNK_SIZE = 360;
+
+// One bit per pixel, set where alpha is non-zero, rows of width bits packed end to end
+// Images without alpha get no mask, they never collide pixel perfectly
+std::vector<unsigned char> buildCollisionMask(const unsigned char* pixels, int width, int height, int channels) {
+	std::vector<unsigned char> mask;
+
+	if (channels != 4)
+		return mask;
+
+	const size_t count = size_t(width) * height;
+	mask.assign((count + 7) / 8, 0);
+
+	for (size_t i = 0; i < count; i++)
+		if (pixels[i * 4 + 3] > 0)
+			mask[i >> 3] |= static_cast<unsigned char>(1u << (i & 7));
+
+	return mask;
+}
+
+// A single file of pre-decoded level assets, written by --pack, memory mapped at startup
+// Images are stored exactly as the loaders would decode them, so uploading one is a copy out of the mapping,
+// alongside each image's collision mask, the foreground chunk tables and the font's glyph widths
+// Without a pack, or with --loose-assets, everything comes from the PNGs as before
+class AssetPack {
+public:
+	static const uint32_t VERSION = 3; // 2: chunk tables cover whole edge chunks, 3: source PNG size and time
+
+	struct Header {
+		char magic[4];           // "FGPK"
+		uint32_t version;
+		uint32_t image_count;    // Image records follow the header
+		uint32_t chunk_size;     // Of the chunk tables
+		uint64_t glyph_offset;   // 256 int32 glyph widths, 0 without a font
+	};
+
+	struct Image {
+		char path[96];           // As the loaders ask for it, "level1/enemy0_centre.png"
+		uint32_t width, height, channels;
+		uint32_t flip;           // Bottom row first
+		uint64_t texel_offset;
+		uint64_t mask_offset;    // 0 without alpha
+		uint64_t chunk_offset;   // One byte per chunk, 1 where it has pixels, 0 unless it's a foreground
+		uint32_t chunks_x, chunks_y;
+		uint64_t source_size;    // Of the PNG it was decoded from, when it was packed
+		int64_t source_mtime;
+	};
+
+	// Size and modification time of a loose file, false if it isn't there
+	static bool sourceStamp(const char* path, uint64_t& size, int64_t& mtime) {
+		struct stat info;
+		if (stat(path, &info) != 0)
+			return false;
+
+		size = uint64_t(info.st_size);
+		mtime = int64_t(info.st_mtime);
+		return true;
+	}
+
+	~AssetPack() {
+		close();
+	}
+
+	bool open(const char* path) {
+		close();
+
+		if (!map(path))
+			return false;
+
+		const Header* header = reinterpret_cast<const Header*>(m_data);
+
+		if (m_size < sizeof(Header) || std::memcmp(header->magic, "FGPK", 4) != 0 || header->version != VERSION ||
+			m_size < sizeof(Header) + size_t(header->image_count) * sizeof(Image)) {
+			std::cerr << path << " is not a version " << VERSION << " asset pack, using the loose PNGs" << std::endl;
+			close();
+			return false;
+		}
+
+		m_header = header;
+		m_images = reinterpret_cast<const Image*>(m_data + sizeof(Header));
+
+		// A truncated pack would have the uploads read past the mapping
+		bool truncated = header->glyph_offset && header->glyph_offset + 256 * sizeof(int32_t) > m_size;
+
+		for (uint32_t i = 0; i < header->image_count && !truncated; i++) {
+			const Image& image = m_images[i];
+			truncated = image.texel_offset + texelSize(image) > m_size || image.mask_offset + maskSize(image) > m_size ||
+				image.chunk_offset + size_t(image.chunks_x) * image.chunks_y > m_size;
+		}
+
+		if (truncated) {
+			std::cerr << path << " is truncated, using the loose PNGs" << std::endl;
+			close();
+			return false;
+		}
+
+		// find() compares the paths as C strings
+		for (uint32_t i = 0; i < header->image_count; i++) {
+			if (!std::memchr(m_images[i].path, 0, sizeof(m_images[i].path))) {
+				std::cerr << path << " has a bad image path, using the loose PNGs" << std::endl;
+				close();
+				return false;
+			}
+		}
+
+		// A PNG edited since the pack was written wins, find() leaves its image to the loose loaders
+		// Without the PNG the packed copy is all there is, so that's used
+		m_stale.assign(header->image_count, false);
+		size_t stale = 0;
+
+		for (uint32_t i = 0; i < header->image_count; i++) {
+			uint64_t size = 0;
+			int64_t mtime = 0;
+
+			if (sourceStamp(m_images[i].path, size, mtime) && (size != m_images[i].source_size || mtime != m_images[i].source_mtime)) {
+				m_stale[i] = true;
+				stale++;
+			}
+		}
+
+		std::cout << "Mapped asset pack " << path << ": " << header->image_count << " images, "
+			<< m_size / (1024 * 1024) << " MB" << std::endl;
+
+		if (stale > 0)
+			std::cout << stale << " packed image(s) older than their PNGs, loading those from the PNGs (rerun with --pack)" << std::endl;
+
+		return true;
+	}
+
+	void close() {
+		if (!m_data)
+			return;
+
+#ifdef _WIN32
+		UnmapViewOfFile(m_data);
+#else
+		munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+		m_data = nullptr;
+		m_size = 0;
+		m_header = nullptr;
+		m_images = nullptr;
+		m_stale.clear();
+	}
+
+	bool isOpen() const {
+		return m_header != nullptr;
+	}
+
+	const Image* find(const std::string& path, bool flip) const {
+		if (!m_header)
+			return nullptr;
+
+		for (uint32_t i = 0; i < m_header->image_count; i++)
+			if ((m_images[i].flip != 0) == flip && path == m_images[i].path)
+				return m_stale[i] ? nullptr : &m_images[i];
+
+		return nullptr;
+	}
+
+	const unsigned char* texels(const Image& image) const {
+		return m_data + image.texel_offset;
+	}
+
+	const unsigned char* mask(const Image& image) const {
+		return image.mask_offset ? m_data + image.mask_offset : nullptr;
+	}
+
+	// The image's chunk table if it was cut at this chunk size
+	const unsigned char* chunks(const Image& image, int chunkSize) const {
+		return (image.chunk_offset && int(m_header->chunk_size) == chunkSize) ? m_data + image.chunk_offset : nullptr;
+	}
+
+	// Measured from the packed font.png, so they go stale with it
+	const int32_t* glyphWidths() const {
+		if (!m_header || !m_header->glyph_offset || !find("font.png", false))
+			return nullptr;
+
+		return reinterpret_cast<const int32_t*>(m_data + m_header->glyph_offset);
+	}
+
+	static size_t texelSize(const Image& image) {
+		return size_t(image.width) * image.height * image.channels;
+	}
+
+	static size_t maskSize(const Image& image) {
+		return image.mask_offset ? (size_t(image.width) * image.height + 7) / 8 : 0;
+	}
+
+	// Uploads a packed image into the bound GL_TEXTURE_2D through a pixel unpack buffer,
+	// so the only CPU work is one copy out of the mapping
+	void upload(const Image& image, GLenum format) {
+		const size_t size = texelSize(image);
+
+		if (!m_pbo)
+			glGenBuffers(1, &m_pbo);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+		if (staging) {
+			std::memcpy(staging, texels(image), size);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		else {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, texels(image));
+		}
+
+		m_uploads++;
+	}
+
+	size_t uploads() const {
+		return m_uploads;
+	}
+
+private:
+	bool map(const char* path) {
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		HANDLE mapping = GetFileSizeEx(file, &size) ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		CloseHandle(file);
+
+		if (!mapping)
+			return false;
+
+		m_data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping); // The view keeps the mapping alive
+		m_size = m_data ? size_t(size.QuadPart) : 0;
+		return m_data != nullptr;
+#else
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat info;
+		void* data = (fstat(fd, &info) == 0 && info.st_size > 0) ?
+			mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		::close(fd); // The mapping stays valid
+
+		if (data == MAP_FAILED)
+			return false;
+
+		m_data = static_cast<const unsigned char*>(data);
+		m_size = size_t(info.st_size);
+		return true;
+#endif
+	}
+
+	const unsigned char* m_data = nullptr;
+	size_t m_size = 0;
+	const Header* m_header = nullptr;
+	const Image* m_images = nullptr;
+	std::vector<bool> m_stale;
+	GLuint m_pbo = 0;
+	size_t m_uploads = 0;
+};
+
+const char* ASSET_PACK_PATH = "level1/assets.pack";
+AssetPack assetPack;
+bool loose_assets = false; // --loose-assets, ignore the pack while working on the PNGs
+
+
+// Whether every pixel of the rect has zero alpha, images without alpha never are
+// Rows are tested 8 RGBA pixels at a time, it stops at the first pixel with alpha
+bool isChunkFullyTransparent(const std::vector<unsigned char>& pixelData, int width, int height,
+	int channels, int startX, int startY, int chunkWidth, int chunkHeight) {
+	// If no alpha channel, assume it's not transparent
+	if (channels < 4) return false;
+
+	const int endX = std::min(startX + chunkWidth, width);
+	const int endY = std::min(startY + chunkHeight, height);
+
+	for (int y = startY; y < endY; y++) {
+		const uint32_t* row = reinterpret_cast<const uint32_t*>(pixelData.data()) + size_t(y) * width;
+		int x = startX;
+
+#ifdef __AVX2__
+		const __m256i alpha = _mm256_set1_epi32(int(0xFF000000u));
+
+		for (; x + 8 <= endX; x += 8) {
+			__m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+			if (!_mm256_testz_si256(pixels, alpha))
+				return false;
+		}
+#endif
+
+		for (; x < endX; x++)
+			if (row[x] & 0xFF000000u)
+				return false;
+	}
+
+	// All pixels are transparent
+	return true;
+}
+
+// Nearest neighbour resample of a rect of RGBA/RGB/R pixels, sampling at destination pixel centres
+// the way glBlitFramebuffer with GL_NEAREST does, so the CPU copy matches the blitted texture
+void resampleNearest(const unsigned char* source, int sourceWidth, int sourceHeight, int channels,
+	int startX, int startY, int rectWidth, int rectHeight,
+	unsigned char* destination, int destinationWidth, int destinationHeight) {
+	std::vector<int> columns(destinationWidth);
+	for (int x = 0; x < destinationWidth; x++)
+		columns[x] = std::min(startX + int((x + 0.5f) * rectWidth / destinationWidth), sourceWidth - 1) * channels;
+
+	for (int y = 0; y < destinationHeight; y++) {
+		int sourceY = std::min(startY + int((y + 0.5f) * rectHeight / destinationHeight), sourceHeight - 1);
+		const unsigned char* sourceRow = source + size_t(sourceY) * sourceWidth * channels;
+		unsigned char* destinationRow = destination + size_t(y) * destinationWidth * channels;
+
+		if (channels == 4) {
+			for (int x = 0; x < destinationWidth; x++)
+				std::memcpy(destinationRow + x * 4, sourceRow + columns[x], 4);
+		}
+		else {
+			for (int x = 0; x < destinationWidth; x++)
+				for (int c = 0; c < channels; c++)
+					destinationRow[x * channels + c] = sourceRow[columns[x] + c];
+		}
+	}
+}
+
+
+
+std::vector<Stamp> chunkForegroundStamp(const Stamp& originalStamp, int chunkSize, float scaleFactor, const vector<ivec2>& input_pixel_locations, vector<vec2>& output_screen_locations)
+{
+	output_screen_locations.clear();
+	output_screen_locations.resize(input_pixel_locations.size());
+
+	std::vector<Stamp> chunks;
+
+	if (originalStamp.width <= 0 || originalStamp.height <= 0 ||
+		originalStamp.pixelData().empty() || originalStamp.textureIDs().empty()) {
+		return chunks;
+	}
+
+	int numChunksX = (originalStamp.width + chunkSize - 1) / chunkSize;
+	int numChunksY = (originalStamp.height + chunkSize - 1) / chunkSize;
+
+	// The pack already knows which chunks are empty, otherwise every chunk is scanned
+	const unsigned char* chunkTable = nullptr;
+	if (originalStamp.currentVariationIndex < originalStamp.textureNames().size()) {
+		const std::string path = "level1/" + originalStamp.baseFilename() + "_" + originalStamp.textureNames()[originalStamp.currentVariationIndex] + ".png";
+		const AssetPack::Image* packed = assetPack.find(path, true);
+
+		if (packed && int(packed->chunks_x) == numChunksX && int(packed->chunks_y) == numChunksY)
+			chunkTable = assetPack.chunks(*packed, chunkSize);
+	}
+
+	typedef std::chrono::high_resolution_clock clock;
+	auto ms = [](clock::time_point a, clock::time_point b) { return std::chrono::duration<float, std::milli>(b - a).count(); };
+	const clock::time_point start = clock::now();
+
+	const size_t variation = originalStamp.currentVariationIndex;
+	const std::vector<unsigned char>& sourcePixels = originalStamp.pixelData()[variation];
+	const int channels = originalStamp.channels;
+
+	struct Chunk {
+		int chunkX, chunkY;
+		int startX, startY, sourceWidth, sourceHeight;
+		int width, height;
+		std::vector<unsigned char> pixels;
+		std::vector<unsigned char> mask;
+	};
+
+	std::vector<Chunk> found;
+
+	for (int chunkY = 0; chunkY < numChunksY; chunkY++) {
+		for (int chunkX = 0; chunkX < numChunksX; chunkX++) {
+			Chunk chunk;
+			chunk.chunkX = chunkX;
+			chunk.chunkY = chunkY;
+			chunk.startX = chunkX * chunkSize;
+			chunk.startY = chunkY * chunkSize;
+			chunk.sourceWidth = std::min(chunkSize, originalStamp.width - chunk.startX);
+			chunk.sourceHeight = std::min(chunkSize, originalStamp.height - chunk.startY);
+
+			if (chunkTable ? !chunkTable[chunkY * numChunksX + chunkX] :
+				isChunkFullyTransparent(sourcePixels, originalStamp.width, originalStamp.height, channels,
+					chunk.startX, chunk.startY, chunk.sourceWidth, chunk.sourceHeight)) {
+				continue;
+			}
+
+			chunk.width = static_cast<int>(chunk.sourceWidth * scaleFactor);  // Scale width
+			chunk.height = static_cast<int>(chunk.sourceHeight * scaleFactor); // Scale height
+
+			if (chunk.width > 0 && chunk.height > 0)
+				found.push_back(std::move(chunk));
+		}
+	}
+
+	const clock::time_point scanned = clock::now();
+
+	// The CPU copies are for pixel perfect collisions, they're resampled in parallel
+	ThreadPool& pool = chunkWorkers();
+	const size_t threads = std::min(pool.size(), std::max<size_t>(1, found.size()));
+
+	for (Chunk& chunk : found) {
+		pool.submit([&chunk, &sourcePixels, &originalStamp, channels]() {
+			chunk.pixels.resize(size_t(chunk.width) * chunk.height * channels);
+			resampleNearest(sourcePixels.data(), originalStamp.width, originalStamp.height, channels,
+				chunk.startX, chunk.startY, chunk.sourceWidth, chunk.sourceHeight,
+				chunk.pixels.data(), chunk.width, chunk.height);
+			chunk.mask = buildCollisionMask(chunk.pixels.data(), chunk.width, chunk.height, channels);
+		});
+	}
+
+	pool.wait();
+
+	const clock::time_point resampled = clock::now();
+
+	// The textures are cut straight out of the foreground's texture on the GPU instead of uploading the copies,
+	// and their atlas rects are GPU copies of those
+	const GLuint sourceTexture = originalStamp.textureIDs()[variation];
+	const bool blit = channels == 4 && sourceTexture != 0;
+
+	GLuint readFBO = 0, drawFBO = 0;
+	if (blit) {
+		glGenFramebuffers(1, &readFBO);
+		glGenFramebuffers(1, &drawFBO);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sourceTexture, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFBO);
+	}
+
+	chunks.reserve(found.size());
+
+	for (Chunk& chunk : found) {
+		Stamp chunkStamp;
+		chunkStamp.width = chunk.width;
+		chunkStamp.height = chunk.height;
+		chunkStamp.channels = channels;
+
+		std::shared_ptr<StampAsset> chunkAsset = std::make_shared<StampAsset>();
+		chunkAsset->baseFilename = originalStamp.baseFilename() + "_chunk_" +
+			std::to_string(chunk.chunkX) + "_" + std::to_string(chunk.chunkY);
+		chunkAsset->textureNames = { chunkAsset->baseFilename };
+		chunkStamp.damage_mask_scale = originalStamp.damage_mask_scale;
+
+		//chunkStamp.curve_path = originalStamp.curve_path;
+		chunkStamp.birth_time = originalStamp.birth_time;
+		chunkStamp.death_time = originalStamp.death_time;
+		chunkStamp.health = originalStamp.health;
+		chunkStamp.currentVariationIndex = 0;
+
+		// Scale the offsets proportionally
+		float offsetX = (float)chunk.startX / originalStamp.width / scaleFactor;
+		float offsetY = (float)chunk.startY / originalStamp.height / (WIDTH / float(HEIGHT)) / scaleFactor;
+
+		GLuint textureID;
+		glGenTextures(1, &textureID);
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		if (blit) {
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, chunk.width, chunk.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureID, 0);
+			glBlitFramebuffer(chunk.startX, chunk.startY, chunk.startX + chunk.sourceWidth, chunk.startY + chunk.sourceHeight,
+				0, 0, chunk.width, chunk.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+			chunkAsset->atlasRects.push_back(spriteAtlas.copy(textureID, chunk.width, chunk.height));
+		}
+		else {
+			GLenum format = (channels == 1) ? GL_RED : (channels == 3) ? GL_RGB : GL_RGBA;
+
+			glTexImage2D(GL_TEXTURE_2D, 0, format, chunk.width, chunk.height,
+				0, format, GL_UNSIGNED_BYTE, chunk.pixels.data());
+
+			chunkAsset->atlasRects.push_back(spriteAtlas.add(chunk.pixels, chunk.width, chunk.height, channels));
+		}
+
+		chunkAsset->textureIDs.push_back(textureID);
+		chunkAsset->pixelData.push_back(std::move(chunk.pixels));
+		chunkAsset->collisionMasks.push_back(std::move(chunk.mask));
+		chunkStamp.asset = chunkAsset;
+
+		chunkStamp.data_offsetX = offsetX;
+		chunkStamp.data_offsetY = offsetY;
+		chunkStamp.data_original_width = originalStamp.width;
+		chunkStamp.data_original_height = originalStamp.height;
+
+		chunks.push_back(std::move(chunkStamp));
+	}
+
+	if (blit) {
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &readFBO);
+		glDeleteFramebuffers(1, &drawFBO);
+	}
+
+	const clock::time_point uploaded = clock::now();
+
+	LOG_INFO("Chunked ", originalStamp.baseFilename(), " into ", chunks.size(), " of ", numChunksX * numChunksY, " chunks in ",
+		ms(start, uploaded), " ms, scan ", ms(start, scanned), " ms", chunkTable ? " (from the asset pack)" : "");
+	LOG_INFO("  resample ", ms(scanned, resampled), " ms on ", threads, " threads, textures ", ms(resampled, uploaded),
+		blit ? " ms blitted" : " ms uploaded");
+
+
+
+	for (size_t i = 0; i < input_pixel_locations.size(); i++) {
+		// Get pixel coordinates in original stamp space
+		float pixelX = static_cast<float>(input_pixel_locations[i].x);
 		//		float pixelY = static_cast<float>(input_pixel_locations[i].y);
 
-				// Calculate normalized position within the original stamp with the special scaling
-				// Note: Using the same scaling factors as used for chunk offsets (1.35f division)
-		float offsetX = pixelX / originalStamp.width / scaleFactor;
-		//		float offsetY = pixelY / originalStamp.height / scaleFactor / (WIDTH / float(HEIGHT));
+				// Calculate normalized position within the original stamp with the special scaling
+				// Note: Using the same scaling factors as used for chunk offsets (1.35f division)
+		float offsetX = pixelX / originalStamp.width / scaleFactor;
+		//		float offsetY = pixelY / originalStamp.height / scaleFactor / (WIDTH / float(HEIGHT));
+
+				// Calculate normalized dimensions of original stamp in screen space
+		float normalizedOrigWidth = originalStamp.width / float(WIDTH) * scaleFactor;
+		//		float normalizedOrigHeight = originalStamp.height / float(HEIGHT) * scaleFactor;
+
+				// Calculate screen coordinates using the same positioning logic as chunks
+		float screenX = originalStamp.posX - normalizedOrigWidth / 2.0f +
+			offsetX * normalizedOrigWidth;
+
+		//float screenY = originalStamp.posY - normalizedOrigHeight / 2.0f +
+		//	offsetY * normalizedOrigHeight;
+
+		// Store the result
+		output_screen_locations[i].x = screenX;
+		//output_screen_locations[i].y = screenY;// *scaleFactor;
+	}
+
+
+
+	return chunks;
+}
+
+
+
+//
+//void drawFullScreenQuad() {
+//	static GLuint quadVAO = 0;
+//	static GLuint quadVBO;
+//
+//	if (quadVAO == 0) {
+//		float quadVertices[] = {
+//			-1.0f, -1.0f, 0.0f,  0.0f, 0.0f,
+//			 1.0f, -1.0f, 0.0f,  1.0f, 0.0f,
+//			 1.0f,  1.0f, 0.0f,  1.0f, 1.0f,
+//			-1.0f,  1.0f, 0.0f,  0.0f, 1.0f
+//		};
+//
+//		glGenVertexArrays(1, &quadVAO);
+//		glGenBuffers(1, &quadVBO);
+//		glBindVertexArray(quadVAO);
+//		glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+//		glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
+//
+//		glEnableVertexAttribArray(0);
+//		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+//		glEnableVertexAttribArray(1);
+//		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+//	}
+//
+//	glBindVertexArray(quadVAO);
+//	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+//	glBindVertexArray(0);
+//}
+
+// Pixels of one image, decoded and ready for upload
+struct DecodedImage {
+	std::vector<unsigned char> pixels;
+	int width = 0, height = 0, channels = 0;
+	std::string error;     // stbi_failure_reason() if it didn't decode
+	float decode_ms = 0;
+};
+
+// Decodes images once, in parallel when they're known up front
+// The loaders take() the pixels and do the GL uploads on the main thread,
+// anything that wasn't decoded ahead is decoded on the spot
+class ImageDecoder {
+public:
+	struct Request {
+		std::string path;
+		bool flip;  // Bottom row first, for OpenGL
+	};
+
+	static DecodedImage decode(const std::string& path, bool flip) {
+		DecodedImage image;
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// The per thread flag, the global one would race between workers
+		stbi_set_flip_vertically_on_load_thread(flip);
+		unsigned char* data = stbi_load(path.c_str(), &image.width, &image.height, &image.channels, 0);
+
+		if (data) {
+			image.pixels.assign(data, data + size_t(image.width) * image.height * image.channels);
+			stbi_image_free(data);
+		}
+		else {
+			image.error = stbi_failure_reason();
+		}
+
+		image.decode_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return image;
+	}
+
+	// Decodes all of the requests on a pool of worker threads, returns once they're done
+	void decodeAll(const std::vector<Request>& requests) {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// Every slot exists before the workers start, so each only ever writes its own
+		for (const Request& request : requests)
+			m_images[key(request.path, request.flip)];
+
+		unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+		threads = std::min(threads, unsigned(std::max<size_t>(1, requests.size())));
+
+		{
+			ThreadPool pool(threads);
+
+			for (const Request& request : requests) {
+				DecodedImage* slot = &m_images[key(request.path, request.flip)];
+				pool.submit([slot, request]() { *slot = decode(request.path, request.flip); });
+			}
+
+			pool.wait();
+		}
+
+		m_threads = threads;
+		m_files = requests.size();
+		m_wall_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		m_decode_ms = 0;
+
+		for (const Request& request : requests)
+			m_decode_ms += m_images[key(request.path, request.flip)].decode_ms;
+	}
+
+	// The decoded image, moved out, each is only ever used once
+	DecodedImage take(const std::string& path, bool flip) {
+		auto it = m_images.find(key(path, flip));
+
+		if (it == m_images.end()) {
+			DecodedImage image = decode(path, flip);
+			if (!image.pixels.empty())
+				m_late++;
+			return image;
+		}
+
+		DecodedImage image = std::move(it->second);
+		m_images.erase(it);
+		return image;
+	}
+
+	// Drops anything decoded that no loader asked for
+	void clear() {
+		m_images.clear();
+	}
+
+	size_t files() const { return m_files; }
+	unsigned threads() const { return m_threads; }
+	float wallMs() const { return m_wall_ms; }
+	float decodeMs() const { return m_decode_ms; }
+	size_t late() const { return m_late; }
+
+private:
+	static std::string key(const std::string& path, bool flip) {
+		return (flip ? "f:" : "n:") + path;
+	}
+
+	std::unordered_map<std::string, DecodedImage> m_images;
+	size_t m_files = 0;
+	unsigned m_threads = 0;
+	float m_wall_ms = 0;
+	float m_decode_ms = 0;
+	size_t m_late = 0;
+};
+
+ImageDecoder imageDecoder;
+
+bool imageExists(const std::string& path, bool flip) {
+	return assetPack.find(path, flip) || std::ifstream(path).good();
+}
+
+// Loads images while the game runs: they're decoded on worker threads, then uploaded a few rows at a time
+// through a ring of pixel unpack buffers, so no frame uploads more than its budget or waits on the GPU
+// Each request's callback gets the finished texture on the main thread
+class AssetStreamer {
+public:
+	static const int RING_SIZE = 4;
+	static const size_t SLOT_SIZE = 4 * 1024 * 1024;
+
+	struct StreamedImage {
+		std::string path;
+		GLuint texture = 0;                 // 0 if it didn't load, otherwise the callback owns it
+		int width = 0, height = 0, channels = 0;
+		std::vector<unsigned char> pixels;  // Kept for pixel perfect collisions
+		std::vector<unsigned char> mask;    // See buildCollisionMask
+	};
+
+	typedef std::function<void(StreamedImage&)> Callback;
+
+	void init(bool enabled, size_t bytesPerFrame) {
+		m_enabled = enabled;
+		m_bytes_per_frame = bytesPerFrame;
+
+		if (!m_workers)
+			m_workers.reset(new ThreadPool(std::max(1u, std::thread::hardware_concurrency() / 2)));
+
+		if (!m_ring[0].buffer) {
+			for (Slot& slot : m_ring) {
+				glGenBuffers(1, &slot.buffer);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, SLOT_SIZE, nullptr, GL_STREAM_DRAW);
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+	}
+
+	// Drops everything in flight and stops the workers, init() starts them again
+	// Queued decodes from before this are skipped, the one a worker is on is thrown away when it's done
+	void cleanup() {
+		m_generation++;
+		m_workers.reset();
+
+		for (const std::shared_ptr<Job>& job : m_uploads)
+			if (job->image.texture)
+				glDeleteTextures(1, &job->image.texture);
+
+		m_uploads.clear();
+		m_requested.clear();
+
+		for (Slot& slot : m_ring) {
+			if (slot.fence)
+				glDeleteSync(slot.fence);
+			if (slot.buffer)
+				glDeleteBuffers(1, &slot.buffer);
+			slot = Slot();
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_decoded.clear();
+	}
+
+	bool enabled() const {
+		return m_enabled;
+	}
+
+	bool requested(const std::string& path) const {
+		return m_requested.count(path) != 0;
+	}
+
+	// tiled is for backgrounds: repeat wrapping and mipmaps, like loadTexture
+	// Returns false if the path is already on its way, or there are no workers to take it
+	bool request(const std::string& path, bool flip, bool tiled, Callback done) {
+		// Not started, or already cleaned up
+		if (!m_workers)
+			return false;
+
+		if (!m_requested.insert(path).second)
+			return false;
+
+		std::shared_ptr<Job> job = std::make_shared<Job>();
+		job->image.path = path;
+		job->flip = flip;
+		job->tiled = tiled;
+		job->done = std::move(done);
+		job->generation = m_generation;
+
+		m_workers->submit([this, job]() {
+			if (job->generation != m_generation)
+				return;
+
+			decode(*job);
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_decoded.push_back(job);
+		});
+
+		m_requests++;
+		return true;
+	}
+
+	// Once a frame, after the swap: uploads up to the frame's budget and hands over whatever finished
+	void update() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			for (std::shared_ptr<Job>& job : m_decoded)
+				if (job->generation == m_generation)
+					m_uploads.push_back(std::move(job));
+
+			m_decoded.clear();
+		}
+
+		size_t uploaded = 0;
+
+		while (!m_uploads.empty()) {
+			Job& job = *m_uploads.front();
+			StreamedImage& image = job.image;
+			const size_t rowBytes = size_t(image.width) * image.channels;
+
+			if (image.pixels.empty() || rowBytes > SLOT_SIZE) {
+				LOG_WARN("Couldn't stream ", image.path, ": ", image.pixels.empty() ? job.error : "too wide for the upload ring");
+				image.pixels.clear();
+				finish();
+				continue;
+			}
+
+			// Always a slice a frame, so a small budget still gets there
+			if (uploaded > 0 && uploaded + rowBytes > m_bytes_per_frame)
+				break;
+
+			// The GPU is still reading this slot, it'll be free next frame
+			Slot& slot = m_ring[m_next];
+			if (slot.fence) {
+				if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+					m_stalls++;
+					break;
+				}
+
+				glDeleteSync(slot.fence);
+				slot.fence = 0;
+			}
+
+			const GLenum format = (image.channels == 1) ? GL_RED : (image.channels == 3) ? GL_RGB : GL_RGBA;
+
+			if (!image.texture) {
+				const GLint wrap = job.tiled ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+
+				glGenTextures(1, &image.texture);
+				glBindTexture(GL_TEXTURE_2D, image.texture);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				glTexImage2D(GL_TEXTURE_2D, 0, (image.channels == 1) ? GL_R8 : (image.channels == 3) ? GL_RGB8 : GL_RGBA8,
+					image.width, image.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+			}
+
+			const size_t slice = std::min(SLOT_SIZE, std::max(m_bytes_per_frame - std::min(uploaded, m_bytes_per_frame), rowBytes));
+			const int rows = std::min(image.height - job.rows, int(slice / rowBytes));
+			const size_t bytes = size_t(rows) * rowBytes;
+
+			// Unsynchronized, the fence already said the GPU is done with the slot
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+			void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+			if (!staging) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				LOG_WARN("Couldn't map an upload buffer for ", image.path);
+				break;
+			}
+
+			std::memcpy(staging, image.pixels.data() + size_t(job.rows) * rowBytes, bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+			glBindTexture(GL_TEXTURE_2D, image.texture);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job.rows, image.width, rows, format, GL_UNSIGNED_BYTE, nullptr);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+			// Unbound before anything else uploads, the callbacks included
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			m_next = (m_next + 1) % RING_SIZE;
+
+			job.rows += rows;
+			uploaded += bytes;
+			m_bytes += bytes;
+			m_slices++;
+
+			if (job.rows == image.height) {
+				if (job.tiled)
+					glGenerateMipmap(GL_TEXTURE_2D);
+
+				finish();
+			}
+		}
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// Nothing requested is still decoding or uploading
+	bool idle() const {
+		return m_requested.empty();
+	}
 
-				// Calculate normalized dimensions of original stamp in screen space
-		float normalizedOrigWidth = originalStamp.width / float(WIDTH) * scaleFactor;
-		//		float normalizedOrigHeight = originalStamp.height / float(HEIGHT) * scaleFactor;
+	void report() const {
+		std::cout << "Asset streaming: " << (m_enabled ? "on" : "off") << ", " << m_requests << " requested, "
+			<< m_resident << " resident, " << m_requested.size() << " in flight, "
+			<< m_bytes / (1024 * 1024) << " MB in " << m_slices << " slices of up to " << m_bytes_per_frame / 1024 << " KB a frame, "
+			<< m_stalls << " frames waited on the ring" << std::endl;
+	}
 
-				// Calculate screen coordinates using the same positioning logic as chunks
-		float screenX = originalStamp.posX - normalizedOrigWidth / 2.0f +
-			offsetX * normalizedOrigWidth;
+private:
+	struct Job {
+		StreamedImage image;
+		bool flip = false;
+		bool tiled = false;
+		Callback done;
+		size_t generation = 0;
+		int rows = 0;        // Uploaded so far
+		std::string error;
+	};
 
-		//float screenY = originalStamp.posY - normalizedOrigHeight / 2.0f +
-		//	offsetY * normalizedOrigHeight;
+	struct Slot {
+		GLuint buffer = 0;
+		GLsync fence = 0;    // Set once the slot's upload is queued
+	};
 
-		// Store the result
-		output_screen_locations[i].x = screenX;
-		//output_screen_locations[i].y = screenY;// *scaleFactor;
+	// On a worker, packed images are copied out of the mapping so the page faults happen here too
+	static void decode(Job& job) {
+		StreamedImage& image = job.image;
+		const AssetPack::Image* packed = assetPack.find(image.path, job.flip);
+
+		if (packed) {
+			const unsigned char* texels = assetPack.texels(*packed);
+			const unsigned char* mask = assetPack.mask(*packed);
+
+			image.width = packed->width;
+			image.height = packed->height;
+			image.channels = packed->channels;
+			image.pixels.assign(texels, texels + AssetPack::texelSize(*packed));
+			if (mask)
+				image.mask.assign(mask, mask + AssetPack::maskSize(*packed));
+			return;
+		}
+
+		DecodedImage decoded = ImageDecoder::decode(image.path, job.flip);
+		image.width = decoded.width;
+		image.height = decoded.height;
+		image.channels = decoded.channels;
+		image.pixels = std::move(decoded.pixels);
+		image.mask = buildCollisionMask(image.pixels.data(), image.width, image.height, image.channels);
+		job.error = decoded.error;
+	}
+
+	// Hands the front upload to its callback, which may request more
+	void finish() {
+		std::shared_ptr<Job> job = std::move(m_uploads.front());
+		m_uploads.pop_front();
+		m_requested.erase(job->image.path);
+
+		if (job->image.texture)
+			m_resident++;
+
+		job->done(job->image);
+	}
+
+	bool m_enabled = false;
+	size_t m_bytes_per_frame = SLOT_SIZE;
+	std::unique_ptr<ThreadPool> m_workers;
+	std::mutex m_mutex;
+	std::vector<std::shared_ptr<Job>> m_decoded;  // Guarded by m_mutex, the workers add to it
+	std::deque<std::shared_ptr<Job>> m_uploads;
+	std::set<std::string> m_requested;
+	std::atomic<size_t> m_generation{ 0 }; // Workers check it before decoding
+	Slot m_ring[RING_SIZE];
+	int m_next = 0;
+	size_t m_requests = 0;
+	size_t m_resident = 0;
+	size_t m_bytes = 0;
+	size_t m_slices = 0;
+	size_t m_stalls = 0;
+};
+
+AssetStreamer assetStreamer;
+
+// Foregrounds and all but the first enemy are streamed in while the game runs
+bool isStreamedTemplate(const std::string& prefix, int index) {
+	return assetStreamer.enabled() && (prefix == "foreground" || (prefix == "enemy" && index > 0));
+}
+
+// Everything initGL is about to load, found the same way the loaders look for it
+std::vector<ImageDecoder::Request> startupImageRequests() {
+	std::vector<ImageDecoder::Request> requests;
+
+	for (const char* prefix : { "obstacle", "enemy", "powerup", "foreground", "bullet" }) {
+		for (int index = 0; ; index++) {
+			bool found = false;
+
+			for (const char* variation : { "_centre", "_up", "_down" }) {
+				std::string path = "level1/" + std::string(prefix) + std::to_string(index) + variation + ".png";
+
+				if (assetPack.find(path, true)) {
+					found = true;
+				}
+				else if (std::ifstream(path).good()) {
+					if (!isStreamedTemplate(prefix, index))
+						requests.push_back({ path, true });
+					found = true;
+				}
+			}
+
+			if (!found)
+				break;
+		}
 	}
 
+	const ImageDecoder::Request others[] = {
+		{ "level1/grid_wide.png", true },
+		{ "level1/grid_wide2.png", true },
+		{ "font.png", false },
+	};
 
+	for (const ImageDecoder::Request& request : others)
+		if (!assetPack.find(request.path, request.flip) && !(assetStreamer.enabled() && request.path == "level1/grid_wide2.png"))
+			requests.push_back(request);
 
-	return chunks;
+	return requests;
 }
 
+// An image ready for upload, either mapped from the asset pack or decoded
+struct LoadedImage {
+	const AssetPack::Image* packed = nullptr;
+	DecodedImage decoded;  // Empty when packed
+	const unsigned char* texels = nullptr;
+	int width = 0, height = 0, channels = 0;
+};
 
+LoadedImage loadImage(const std::string& path, bool flip) {
+	LoadedImage image;
+	image.packed = assetPack.find(path, flip);
 
-//
-//void drawFullScreenQuad() {
-//	static GLuint quadVAO = 0;
-//	static GLuint quadVBO;
-//
-//	if (quadVAO == 0) {
-//		float quadVertices[] = {
-//			-1.0f, -1.0f, 0.0f,  0.0f, 0.0f,
-//			 1.0f, -1.0f, 0.0f,  1.0f, 0.0f,
-//			 1.0f,  1.0f, 0.0f,  1.0f, 1.0f,
-//			-1.0f,  1.0f, 0.0f,  0.0f, 1.0f
-//		};
-//
-//		glGenVertexArrays(1, &quadVAO);
-//		glGenBuffers(1, &quadVBO);
-//		glBindVertexArray(quadVAO);
-//		glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
-//		glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
-//
-//		glEnableVertexAttribArray(0);
-//		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-//		glEnableVertexAttribArray(1);
-//		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-//	}
-//
-//	glBindVertexArray(quadVAO);
-//	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-//	glBindVertexArray(0);
-//}
+	if (image.packed) {
+		image.texels = assetPack.texels(*image.packed);
+		image.width = image.packed->width;
+		image.height = image.packed->height;
+		image.channels = image.packed->channels;
+	}
+	else {
+		image.decoded = imageDecoder.take(path, flip);
+		image.texels = image.decoded.pixels.empty() ? nullptr : image.decoded.pixels.data();
+		image.width = image.decoded.width;
+		image.height = image.decoded.height;
+		image.channels = image.decoded.channels;
+	}
+
+	return image;
+}
 
-bool loadStampTextureFile(string filename, std::vector<unsigned char>& pixelData, GLuint& textureID, int& width, int& height, int& channels) {
-	// Load image using stb_image - Don't flip vertically for our pixel data
+// glTexImage2D into the bound texture, packed images go through the pack's unpack buffer
+void uploadImage(const LoadedImage& image, GLenum format) {
+	if (image.packed)
+		assetPack.upload(*image.packed, format);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.texels);
+}
 
+bool loadStampTextureFile(string filename, std::vector<unsigned char>& pixelData, std::vector<unsigned char>& collisionMask, GLuint& textureID, int& width, int& height, int& channels) {
 	filename = "level1/" + filename;
 
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &channels, 0);
+	// Decoded once (or not at all with the pack), flipped for OpenGL, and the same pixels are kept for collisions
+	LoadedImage image = loadImage(filename, true);
 
-	if (!data) {
+	if (!image.texels) {
 		std::cerr << "Failed to load stamp texture: " << filename << std::endl;
-		std::cerr << "STB Image error: " << stbi_failure_reason() << std::endl;
+		std::cerr << "STB Image error: " << image.decoded.error << std::endl;
 		return false;
 	}
 
-	// Store the pixel data in the vector
-	int dataSize = width * height * channels;
-	pixelData.resize(dataSize);
-	std::memcpy(pixelData.data(), data, dataSize);
-
-	// Now set flip for OpenGL texture loading
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char* glData = stbi_load(filename.c_str(), &width, &height, &channels, 0);
-
-	if (!glData) {
-		std::cerr << "Failed to reload texture for OpenGL: " << filename << std::endl;
-		// If we fail to reload, use the original data for OpenGL too
-		glData = data;
-	}
+	width = image.width;
+	height = image.height;
+	channels = image.channels;
 
 	// Create texture
 	glGenTextures(1, &textureID);
@@ -822,13 +3386,18 @@ bool loadStampTextureFile(string filename, std::vector<unsigned char>& pixelData
 	}
 
 	// Load texture data to GPU
-	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, glData);
+	uploadImage(image, format);
 
-	// Free image data - we've already copied what we need
-	if (glData != data) {
-		stbi_image_free(glData);
+	if (image.packed) {
+		pixelData.assign(image.texels, image.texels + AssetPack::texelSize(*image.packed));
+
+		const unsigned char* mask = assetPack.mask(*image.packed);
+		collisionMask.assign(mask, mask + AssetPack::maskSize(*image.packed));
+	}
+	else {
+		collisionMask = buildCollisionMask(image.texels, width, height, channels);
+		pixelData = std::move(image.decoded.pixels);
 	}
-	stbi_image_free(data);
 
 	return true;
 }
@@ -935,40 +3504,52 @@ bool loadStampTextureFile(string filename, std::vector<unsigned char>& pixelData
 
 
 
-bool loadStampTextures() {
-	// Clear previous template textures
-	for (auto& stamp : allyTemplates) {
-		for (auto& texID : stamp.textureIDs) {
-			if (texID != 0) {
-				glDeleteTextures(1, &texID);
-			}
-		}
-	}
+int templateIndex(const std::string& baseFilename, const std::string& prefix) {
+	return std::atoi(baseFilename.c_str() + prefix.size());
+}
 
-	for (auto& stamp : enemyTemplates) {
-		for (auto& texID : stamp.textureIDs) {
-			if (texID != 0) {
-				glDeleteTextures(1, &texID);
-			}
-		}
-	}
+// A template is there if any of its variations is, in the pack or as a PNG
+bool stampTemplateExists(const std::string& baseFilename) {
+	return imageExists("level1/" + baseFilename + "_centre.png", true) ||
+		imageExists("level1/" + baseFilename + "_up.png", true) ||
+		imageExists("level1/" + baseFilename + "_down.png", true);
+}
 
-	for (auto& stamp : powerUpTemplates) {
-		for (auto& texID : stamp.textureIDs) {
-			if (texID != 0) {
-				glDeleteTextures(1, &texID);
-			}
-		}
-	}
+// Sorts a loaded template into its list by type
+// Each list stays in index order, streamed templates finish in whatever order their uploads do
+// An insert at or before the selected template moves the selection along with it
+void addStampTemplate(const std::string& prefix, Stamp&& stamp) {
+	auto insertInOrder = [&prefix](std::vector<Stamp>& templates, Stamp&& stamp, int* current) {
+		const int index = templateIndex(stamp.baseFilename(), prefix);
+		auto at = std::find_if(templates.begin(), templates.end(), [&](const Stamp& other) {
+			return templateIndex(other.baseFilename(), prefix) > index;
+		});
 
-	for (auto& stamp : foregroundTemplates) {
-		for (auto& texID : stamp.textureIDs) {
-			if (texID != 0) {
-				glDeleteTextures(1, &texID);
-			}
-		}
+		if (current && !templates.empty() && at - templates.begin() <= *current)
+			(*current)++;
+
+		templates.insert(at, std::move(stamp));
+	};
+
+	if (prefix == "obstacle") {
+		stamp.damage_mask_scale = SHIP_DAMAGE_MASK_SCALE;
+		insertInOrder(allyTemplates, std::move(stamp), &currentAllyTemplateIndex);
+	}
+	else if (prefix == "enemy") {
+		stamp.damage_mask_scale = SHIP_DAMAGE_MASK_SCALE;
+		insertInOrder(enemyTemplates, std::move(stamp), &currentEnemyTemplateIndex);
+	}
+	else if (prefix == "powerup") {
+		insertInOrder(powerUpTemplates, std::move(stamp), &currentPowerUpTemplateIndex);
 	}
+	else if (prefix == "foreground") {
+		stamp.damage_mask_scale = FOREGROUND_DAMAGE_MASK_SCALE;
+		insertInOrder(foregroundTemplates, std::move(stamp), nullptr);
+	}
+}
 
+bool loadStampTextures() {
+	// Clear previous templates, the assets free their textures once no stamp uses them
 	allyTemplates.clear();
 	enemyTemplates.clear();
 	powerUpTemplates.clear();
@@ -988,9 +3569,22 @@ bool loadStampTextures() {
 		while (true)
 		{
 			std::string baseFilename = prefix + std::to_string(index);
+
+			// Left to the streamer, see streamStampTemplate
+			if (isStreamedTemplate(prefix, index)) {
+				if (!stampTemplateExists(baseFilename))
+					break;
+
+				index++;
+				continue;
+			}
+
+			std::shared_ptr<StampAsset> newAsset = std::make_shared<StampAsset>();
+			newAsset->baseFilename = baseFilename;
+			newAsset->textureNames = { "centre", "up", "down" };
+
 			Stamp newStamp;
-			newStamp.baseFilename = baseFilename;
-			newStamp.textureNames = { "centre", "up", "down" };
+			newStamp.asset = newAsset;
 			newStamp.currentVariationIndex = 0; // Default to center
 
 			bool loadedAtLeastOne = false;
@@ -1000,40 +3594,35 @@ bool loadStampTextures() {
 				GLuint textureID = 0;
 				int width = 0, height = 0, channels = 0;
 				std::vector<unsigned char> pixelData;
+				std::vector<unsigned char> collisionMask;
 
-				if (loadStampTextureFile(filename.c_str(), pixelData, textureID, width, height, channels)) {
-					if (newStamp.pixelData.empty()) {
+				if (loadStampTextureFile(filename.c_str(), pixelData, collisionMask, textureID, width, height, channels)) {
+					if (newAsset->pixelData.empty()) {
 						newStamp.width = width;
 						newStamp.height = height;
 						newStamp.channels = channels;
 					}
-					newStamp.textureIDs.push_back(textureID);
-					newStamp.pixelData.push_back((pixelData));
+					newAsset->textureIDs.push_back(textureID);
+
+					// Foreground templates are only ever drawn as chunks, which get their own atlas rects
+					newAsset->atlasRects.push_back(prefix == "foreground" ? AtlasRect() : spriteAtlas.add(pixelData, width, height, channels));
+
+					newAsset->pixelData.push_back(std::move(pixelData));
+					newAsset->collisionMasks.push_back(std::move(collisionMask));
 
 					std::cout << "Loaded stamp texture: " << filename << " (" << width << "x" << height << ")" << std::endl;
 					loadedAtLeastOne = true;
 				}
 				else {
-					newStamp.textureIDs.push_back(0);
-					newStamp.pixelData.push_back(std::vector<unsigned char>());
+					newAsset->textureIDs.push_back(0);
+					newAsset->atlasRects.push_back(AtlasRect());
+					newAsset->pixelData.push_back(std::vector<unsigned char>());
+					newAsset->collisionMasks.push_back(std::vector<unsigned char>());
 				}
 			}
 
 			if (loadedAtLeastOne) {
-				// Sort templates by type
-				if (prefix == "obstacle") {
-					allyTemplates.push_back(std::move(newStamp));
-				}
-				else if (prefix == "enemy") {
-					enemyTemplates.push_back(std::move(newStamp));
-				}
-				else if (prefix == "powerup") {
-					powerUpTemplates.push_back(std::move(newStamp));
-				}
-				else if (prefix == "foreground") {
-					newStamp.is_foreground = true;
-					foregroundTemplates.push_back(std::move(newStamp));
-				}
+				addStampTemplate(prefix, std::move(newStamp));
 				loadedAny = true;
 				index++;
 			}
@@ -1057,40 +3646,177 @@ bool loadStampTextures() {
 
 
 
+const Stamp* findTemplate(const std::vector<Stamp>& templates, const std::string& baseFilename) {
+	for (const Stamp& stamp : templates)
+		if (stamp.baseFilename() == baseFilename)
+			return &stamp;
+
+	return nullptr;
+}
+
+// Requests every variation of a template from the streamer, it joins the others once they're all on the GPU
+void streamStampTemplate(const std::string& prefix, int index) {
+	const std::string baseFilename = prefix + std::to_string(index);
+	const char* variations[] = { "_centre", "_up", "_down" };
+
+	struct Pending {
+		Stamp stamp;
+		std::shared_ptr<StampAsset> asset;
+		int remaining = 0;
+	};
+
+	std::shared_ptr<Pending> pending = std::make_shared<Pending>();
+	std::vector<std::pair<size_t, std::string>> paths;
+
+	for (size_t i = 0; i < 3; i++) {
+		std::string path = "level1/" + baseFilename + variations[i] + ".png";
+
+		if (assetStreamer.requested(path))
+			return; // Already on its way
+
+		if (imageExists(path, true))
+			paths.push_back({ i, path });
+	}
+
+	if (paths.empty())
+		return;
+
+	pending->asset = std::make_shared<StampAsset>();
+	pending->asset->baseFilename = baseFilename;
+	pending->asset->textureNames = { "centre", "up", "down" };
+	pending->asset->textureIDs.assign(3, 0);
+	pending->asset->atlasRects.assign(3, AtlasRect());
+	pending->asset->pixelData.resize(3);
+	pending->asset->collisionMasks.resize(3);
+	pending->remaining = int(paths.size());
+
+	for (const auto& path : paths) {
+		const size_t i = path.first;
+
+		assetStreamer.request(path.second, true, false, [pending, prefix, i](AssetStreamer::StreamedImage& image) {
+			StampAsset& asset = *pending->asset;
+
+			if (image.texture) {
+				if (pending->stamp.width == 0) {
+					pending->stamp.width = image.width;
+					pending->stamp.height = image.height;
+					pending->stamp.channels = image.channels;
+				}
+
+				// Foreground templates are only ever drawn as chunks, the rest are copied into the atlas on the GPU
+				asset.textureIDs[i] = image.texture;
+				asset.atlasRects[i] = (prefix == "foreground") ? AtlasRect() :
+					(image.channels == 4) ? spriteAtlas.copy(image.texture, image.width, image.height) :
+					spriteAtlas.add(image.pixels, image.width, image.height, image.channels);
+				asset.pixelData[i] = std::move(image.pixels);
+				asset.collisionMasks[i] = std::move(image.mask);
+
+				LOG_INFO("Streamed stamp texture: ", image.path, " (", image.width, "x", image.height, ")");
+			}
+
+			if (--pending->remaining == 0 && pending->stamp.width > 0) {
+				pending->stamp.asset = pending->asset;
+				addStampTemplate(prefix, std::move(pending->stamp));
+			}
+		});
+	}
+}
+
+// The level is a run of segments, each placed when the last has scrolled in (key '9' for now)
+// Their assets are streamed in ahead of time, see streamLevelAhead
+struct LevelSegment {
+	const char* foreground;  // Template base filenames
+	const char* enemy;
+	const char* overlay;     // Second background layer, blended over the first
+	float posY;
+	float scale;
+	int enemies[2][2];       // In foreground pixels
+};
+
+const LevelSegment LEVEL_SEGMENTS[] = {
+	{ "foreground0", "enemy0", "level1/grid_wide2.png", 0.726f, 1.337f, { { 100, 1080 / 2 }, { 3000, 1080 / 2 } } },
+	{ "foreground0", "enemy1", "level1/grid_wide2.png", 0.726f, 1.337f, { { 100, 1080 / 2 }, { 3000, 1080 / 2 } } },
+};
+
+const size_t LEVEL_SEGMENT_COUNT = sizeof(LEVEL_SEGMENTS) / sizeof(LEVEL_SEGMENTS[0]);
+
+size_t nextLevelSegment = 0;
+std::string currentOverlay = LEVEL_SEGMENTS[0].overlay;
+std::map<std::string, GLuint> overlayTextures; // Resident overlays, backgroundTexture2 is one of them
+GLuint overlayPlaceholder = 0;                 // Transparent, until the first overlay has streamed in
+
+// Starts streaming whatever the next few segments use, plus the enemy templates that weren't loaded at startup
+void streamLevelAhead(size_t ahead) {
+	if (!assetStreamer.enabled())
+		return;
+
+	for (int index = 1; stampTemplateExists("enemy" + std::to_string(index)); index++)
+		if (!findTemplate(enemyTemplates, "enemy" + std::to_string(index)))
+			streamStampTemplate("enemy", index);
+
+	for (size_t i = 0; i <= ahead; i++) {
+		const LevelSegment& segment = LEVEL_SEGMENTS[(nextLevelSegment + i) % LEVEL_SEGMENT_COUNT];
+
+		if (!findTemplate(foregroundTemplates, segment.foreground))
+			streamStampTemplate("foreground", templateIndex(segment.foreground, "foreground"));
+
+		if (!findTemplate(enemyTemplates, segment.enemy))
+			streamStampTemplate("enemy", templateIndex(segment.enemy, "enemy"));
+
+		if (!overlayTextures.count(segment.overlay)) {
+			assetStreamer.request(segment.overlay, true, true, [](AssetStreamer::StreamedImage& image) {
+				if (!image.texture)
+					return;
+
+				overlayTextures[image.path] = image.texture;
+				if (image.path == currentOverlay)
+					backgroundTexture2 = image.texture;
+
+				LOG_INFO("Streamed background: ", image.path, " (", image.width, "x", image.height, ")");
+			});
+		}
+	}
+}
+
+// Frees the foreground templates that none of the next few segments use, the placed chunks have their own textures
+void evictLevelAssets(size_t ahead) {
+	for (size_t i = 0; i < foregroundTemplates.size(); ) {
+		bool needed = false;
+
+		for (size_t j = 0; j <= ahead; j++)
+			if (foregroundTemplates[i].baseFilename() == LEVEL_SEGMENTS[(nextLevelSegment + j) % LEVEL_SEGMENT_COUNT].foreground)
+				needed = true;
+
+		if (needed) {
+			i++;
+		}
+		else {
+			LOG_INFO("Evicted foreground template ", foregroundTemplates[i].baseFilename());
+			foregroundTemplates.erase(foregroundTemplates.begin() + i);
+		}
+	}
+}
+
 Stamp deepCopyStamp(const Stamp& source)
 {
-	// The copy constructor now handles texture creation properly
-	// and doesn't automatically initialize blackening textures
+	// Shares the template asset, no textures are created
 	Stamp newStamp(source);
 
-	// Explicitly ensure blackeningTexture is 0
-	newStamp.blackeningTexture = 0;
+	// Explicitly ensure the copy has no damage mask
+	newStamp.damageMask.reset();
 
 	return newStamp;
 }
 
 
-void RandomUnitVector(float& x_out, float& y_out)
+void RandomUnitVector(Rng& rng, float& x_out, float& y_out)
 {
-	const static float pi = 4.0f * atanf(1.0f);
-
-	const float a = (rand() / float(RAND_MAX)) * 2.0f * pi;
-
-	x_out = cos(a);
-	y_out = sin(a);
+	rng.unitVector(x_out, y_out);
 }
 
 
 bool loadBulletTemplates() {
-	// Clear previous bullet templates
-	for (auto& stamp : bulletTemplates) {
-		for (auto& texID : stamp.textureIDs) {
-			if (texID != 0) {
-				glDeleteTextures(1, &texID);
-			}
-		}
-	}
-
+	// Clear previous bullet templates, the assets free their textures once no stamp uses them
 	bulletTemplates.clear();
 
 	// Load all bullet textures (bullet0, bullet1, etc.)
@@ -1099,9 +3825,12 @@ bool loadBulletTemplates() {
 
 	while (true) {
 		std::string baseFilename = "bullet" + std::to_string(index);
+		std::shared_ptr<StampAsset> newAsset = std::make_shared<StampAsset>();
+		newAsset->baseFilename = baseFilename;
+		newAsset->textureNames = { "centre", "up", "down" };
+
 		Stamp newStamp;
-		newStamp.baseFilename = baseFilename;
-		newStamp.textureNames = { "centre", "up", "down" };
+		newStamp.asset = newAsset;
 		newStamp.currentVariationIndex = 0; // Default to center
 
 		bool loadedAtLeastOne = false;
@@ -1112,28 +3841,29 @@ bool loadBulletTemplates() {
 			GLuint textureID = 0;
 			int width = 0, height = 0, channels = 0;
 			std::vector<unsigned char> pixelData;
+			std::vector<unsigned char> collisionMask;
 
-			if (loadStampTextureFile(filename.c_str(), pixelData, textureID, width, height, channels)) {
-				if (newStamp.pixelData.empty()) {
+			if (loadStampTextureFile(filename.c_str(), pixelData, collisionMask, textureID, width, height, channels)) {
+				if (newAsset->pixelData.empty()) {
 					newStamp.width = width;
 					newStamp.height = height;
 					newStamp.channels = channels;
 				}
-				newStamp.textureIDs.push_back(textureID);
+				newAsset->textureIDs.push_back(textureID);
 
 
 
-				newStamp.pixelData.push_back((pixelData));
-
-
+				newAsset->pixelData.push_back(std::move(pixelData));
+				newAsset->collisionMasks.push_back(std::move(collisionMask));
 
 				std::cout << "Loaded bullet template: " << filename << " (" << width << "x" << height << ")" << std::endl;
 				loadedAtLeastOne = true;
 			}
 			else {
-				newStamp.textureIDs.push_back(0);
+				newAsset->textureIDs.push_back(0);
 
-				newStamp.pixelData.push_back(std::vector<unsigned char>());
+				newAsset->pixelData.push_back(std::vector<unsigned char>());
+				newAsset->collisionMasks.push_back(std::vector<unsigned char>());
 
 			}
 		}
@@ -1163,18 +3893,23 @@ std::chrono::high_resolution_clock::time_point lastBulletTime = std::chrono::hig
 
 
 void fireBullet() {
-	// Only fire if we have ally ships and bullet templates
-	if (allyShips.empty() || bulletTemplates.empty()) {
+	// Only fire if we have a player
+	const size_t p = playerIndex();
+
+	if (p == SIZE_MAX) {
 		return;
 	}
 
 
-	cout << "firing bullet" << endl;
+	LOG_DEBUG("firing bullet");
 
 	// No more firing while dying
-	if (allyShips[0].to_be_culled)
+	if (allyShips.get<Lifetime>(p).to_be_culled)
 		return;
 
+	const Transform& player = allyShips.get<Transform>(p);
+	const Sprite& playerSprite = allyShips.get<Sprite>(p);
+
 	std::chrono::high_resolution_clock::time_point currentTime = std::chrono::high_resolution_clock::now();
 	std::chrono::duration<float> timeSinceLastBullet = currentTime - lastBulletTime;
 
@@ -1186,8 +3921,8 @@ void fireBullet() {
 	//std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
 	//std::chrono::duration<float, std::milli> elapsed = global_time_end - app_start_time;
 
-	// Use the first bullet template
-	Stamp bulletTemplate = deepCopyStamp(bulletTemplates[0]);
+	BulletSpawn bulletTemplate;
+	bulletTemplate.faction = ALLY_FACTION;
 
 	float aspect = WIDTH / float(HEIGHT);
 
@@ -1195,13 +3930,13 @@ void fireBullet() {
 
 	if (ally_fire == RANDOM)
 	{
-		bulletTemplate.posX = allyShips[0].posX;
-		bulletTemplate.posY = allyShips[0].posY;
+		bulletTemplate.posX = player.posX;
+		bulletTemplate.posY = player.posY;
 	}
 	else
 	{
-		bulletTemplate.posX = allyShips[0].posX + allyShips[0].width / float(WIDTH) / 2.0f;
-		bulletTemplate.posY = allyShips[0].posY + allyShips[0].height / (float(HEIGHT) * aspect) / 8.0f;
+		bulletTemplate.posX = player.posX + playerSprite.width / float(WIDTH) / 2.0f;
+		bulletTemplate.posY = player.posY + playerSprite.height / (float(HEIGHT) * aspect) / 8.0f;
 	}
 
 	static const float pi = 4.0f * atanf(1.0f);
@@ -1233,95 +3968,92 @@ void fireBullet() {
 	switch (ally_fire) {
 	case STRAIGHT:
 		for (size_t i = 0; i < num_streams; i++, angle += angle_step) {
-			Stamp newBullet = bulletTemplate;
-			newBullet.local_velX = 1.0f * cos(angle);
-			newBullet.local_velY = 1.0f * sin(angle);
+			BulletSpawn newBullet = bulletTemplate;
+			newBullet.velX = 1.0f * cos(angle);
+			newBullet.velY = 1.0f * sin(angle);
 			newBullet.sinusoidal_amplitude = 0;
 			newBullet.birth_time = GLOBAL_TIME;// GLOBAL_TIME;
 			newBullet.death_time = -1;
 
-			cout << "Added new bullet" << endl;
-			allyBullets.push_back(newBullet);
+			LOG_DEBUG("Added new bullet");
+			emitBullet(newBullet);
 		}
 		break;
 
 	case SINUSOIDAL:
 		for (size_t i = 0; i < num_streams; i++, angle += angle_step) {
-			Stamp newBullet = bulletTemplate;
-			newBullet.local_velX = 1.0f * cos(angle);
-			newBullet.local_velY = 1.0f * sin(angle);
+			BulletSpawn newBullet = bulletTemplate;
+			newBullet.velX = 1.0f * cos(angle);
+			newBullet.velY = 1.0f * sin(angle);
 			newBullet.sinusoidal_shift = false;
 			newBullet.sinusoidal_amplitude = 0.005f;
 			newBullet.birth_time = GLOBAL_TIME;// GLOBAL_TIME;
 			newBullet.death_time = -1;
 
-			cout << "Added new bullet" << endl;
-			allyBullets.push_back(newBullet);
+			LOG_DEBUG("Added new bullet");
+			emitBullet(newBullet);
 
 
-			cout << "Added new bullet" << endl;
+			LOG_DEBUG("Added new bullet");
 			newBullet.sinusoidal_shift = true;
-			allyBullets.push_back(newBullet);
+			emitBullet(newBullet);
 		}
 		break;
 
 	case RANDOM:
 	{
-		size_t num_streams_local = num_streams;
+		const QualityLevel& quality = qualityGovernor.level();
 
-		Stamp newCentralStamp = bulletTemplate;
+		BulletSpawn newCentralStamp = bulletTemplate;
 
-		bulletTemplate.posX = allyShips[0].posX;// +allyShips[0].width / float(WIDTH) / 2.0;
-		bulletTemplate.posY = allyShips[0].posY;// +allyShips[0].height / (float(HEIGHT) * aspect) / 8.0;
+		bulletTemplate.posX = player.posX;// +playerSprite.width / float(WIDTH) / 2.0;
+		bulletTemplate.posY = player.posY;// +playerSprite.height / (float(HEIGHT) * aspect) / 8.0;
 
-		float x_rad = allyShips[0].width / float(WIDTH) / 2.0f;
-		float y_rad = allyShips[0].height / float(HEIGHT) / 2.0f;
+		float x_rad = playerSprite.width / float(WIDTH) / 2.0f;
+		float y_rad = playerSprite.height / float(HEIGHT) / 2.0f;
 		float avg_rad = max(x_rad, y_rad);
 
 		newCentralStamp.colour_radius = avg_rad / 2.0f;
-		newCentralStamp.force_radius = avg_rad / 2.0f;
 
-		for (size_t j = 0; j < num_streams_local; j++)
+		for (size_t j = 0; j < num_streams * quality.random_fire_streams[0]; j++)
 		{
-			Stamp newStamp = newCentralStamp;
+			BulletSpawn newStamp = newCentralStamp;
 			newStamp.colour_radius = avg_rad / 4.0f;
-			newStamp.force_radius = avg_rad / 4.0f;
 
 			// Make elliptical fire
-			RandomUnitVector(newStamp.local_velX, newStamp.local_velY);
-			newStamp.local_velX *= WIDTH / float(HEIGHT);
-			newStamp.local_velX *= 2.0f;
+			RandomUnitVector(fireRng, newStamp.velX, newStamp.velY);
+			newStamp.velX *= WIDTH / float(HEIGHT);
+			newStamp.velX *= 2.0f;
 
-			newStamp.local_velX /= 500.0f / (rand() / float(RAND_MAX));
-			newStamp.local_velY /= 500.0f / (rand() / float(RAND_MAX));
-			newStamp.path_randomization = (rand() / float(RAND_MAX)) * 0.01f;
+			newStamp.velX /= 500.0f / (fireRng.uniform());
+			newStamp.velY /= 500.0f / (fireRng.uniform());
+			newStamp.path_randomization = (fireRng.uniform()) * 0.01f;
 			newStamp.birth_time = GLOBAL_TIME;
-			newStamp.death_time = GLOBAL_TIME + 3.0f * rand() / float(RAND_MAX);
+			newStamp.death_time = GLOBAL_TIME + 3.0f * fireRng.uniform();
 			newStamp.random_forking = 0.001f;
 
-			cout << "Added new bullet" << endl;
-			allyBullets.push_back(newStamp);
+			LOG_DEBUG("Added new bullet");
+			emitBullet(newStamp);
 		}
 
-		for (size_t j = 0; j < num_streams_local * 2; j++)
+		for (size_t j = 0; j < num_streams * quality.random_fire_streams[1]; j++)
 		{
-			Stamp newStamp = newCentralStamp;
+			BulletSpawn newStamp = newCentralStamp;
 			newStamp.colour_radius = avg_rad / 8.0f;
-			newStamp.force_radius = avg_rad / 8.0f;
 
 			// Make elliptical fire
-			RandomUnitVector(newStamp.local_velX, newStamp.local_velY);
-			newStamp.local_velX *= WIDTH / float(HEIGHT);
-			newStamp.local_velX *= 2.0f;
+			RandomUnitVector(fireRng, newStamp.velX, newStamp.velY);
+			newStamp.velX *= WIDTH / float(HEIGHT);
+			newStamp.velX *= 2.0f;
 
-			newStamp.local_velX /= 500.0f / (rand() / float(RAND_MAX));
-			newStamp.local_velY /= 500.0f / (rand() / float(RAND_MAX));
-			newStamp.path_randomization = (rand() / float(RAND_MAX)) * 0.01f;
+			newStamp.velX /= 500.0f / (fireRng.uniform());
+			newStamp.velY /= 500.0f / (fireRng.uniform());
+			newStamp.path_randomization = (fireRng.uniform()) * 0.01f;
 			newStamp.birth_time = GLOBAL_TIME;
-			newStamp.death_time = GLOBAL_TIME + 5.0f * rand() / float(RAND_MAX);
+			newStamp.death_time = GLOBAL_TIME + 5.0f * fireRng.uniform();
 			newStamp.random_forking = 0.01f;
-			cout << "Added new bullet" << endl;
-			allyBullets.push_back(newStamp);
+			LOG_DEBUG("Added new bullet");
+			emitBullet(newStamp);
 		}
 	}
 	break;
@@ -1338,7 +4070,7 @@ bool spacePressed = false;
 
 
 
-void calculateBoundingBox(const Stamp& stamp, float& minX, float& minY, float& maxX, float& maxY) {
+void calculateBoundingBox(const Transform& transform, const Sprite& stamp, float& minX, float& minY, float& maxX, float& maxY) {
 	// Calculate aspect ratio
 	float aspect = WIDTH / static_cast<float>(HEIGHT);
 
@@ -1351,16 +4083,16 @@ void calculateBoundingBox(const Stamp& stamp, float& minX, float& minY, float& m
 	float halfHeightNorm = (stamp.height / 2.0f) / HEIGHT;
 
 	// Apply the same aspect ratio adjustments as in the shader
-	float stampY = (stamp.posY - 0.5f) * aspect + 0.5f;
+	float stampY = (transform.posY - 0.5f) * aspect + 0.5f;
 
 	// Apply the scaling factor to match the shader
 	halfWidthNorm /= scale;
 	halfHeightNorm /= scale;
 
 	// Set the bounding box coordinates
-	minX = stamp.posX - halfWidthNorm;
+	minX = transform.posX - halfWidthNorm;
 	minY = stampY - halfHeightNorm;
-	maxX = stamp.posX + halfWidthNorm * scale;
+	maxX = transform.posX + halfWidthNorm * scale;
 	maxY = stampY + halfHeightNorm * scale;
 }
 
@@ -1391,7 +4123,7 @@ void drawBoundingBox(const Stamp& stamp) {
 	//if (!stamp.active) return;
 
 	float minX, minY, maxX, maxY;
-	calculateBoundingBox(stamp, minX, minY, maxX, maxY);
+	calculateBoundingBox(stamp, stamp, minX, minY, maxX, maxY);
 
 	// Convert normalized coordinates to NDC coordinates (-1 to 1)
 	float ndcMinX = minX * 2.0f - 1.0f;
@@ -1417,8 +4149,8 @@ bool isBoundingBoxOverlap(const Stamp& a, const Stamp& b) {
 	float aMinX, aMinY, aMaxX, aMaxY;
 	float bMinX, bMinY, bMaxX, bMaxY;
 
-	calculateBoundingBox(a, aMinX, aMinY, aMaxX, aMaxY);
-	calculateBoundingBox(b, bMinX, bMinY, bMaxX, bMaxY);
+	calculateBoundingBox(a, a, aMinX, aMinY, aMaxX, aMaxY);
+	calculateBoundingBox(b, b, bMinX, bMinY, bMaxX, bMaxY);
 
 	return !(aMaxX < bMinX || aMinX > bMaxX ||
 		aMaxY < bMinY || aMinY > bMaxY);
@@ -1430,33 +4162,56 @@ bool isBoundingBoxOverlap(const Stamp& a, const Stamp& b) {
 
 
 
-unsigned char getPixelValueFromStamp(const Stamp& stamp, size_t variationIndex, int x, int y, int channel) {
+unsigned char getPixelValueFromStamp(const Sprite& stamp, size_t variationIndex, int x, int y, int channel) {
 	// Make sure coordinates and indices are within bounds
 	if (x < 0 || x >= stamp.width || y < 0 || y >= stamp.height ||
 		channel < 0 || channel >= stamp.channels ||
-		variationIndex < 0 || variationIndex >= stamp.pixelData.size() ||
-		stamp.pixelData[variationIndex].empty()) {
+		variationIndex < 0 || variationIndex >= stamp.pixelData().size() ||
+		stamp.pixelData()[variationIndex].empty()) {
 		return 0;
 	}
 
+	// Pixels blown out by damage are see-through, the same ones the GPU no longer draws
+	if (channel == 3 && stamp.damageMask.isEroded(x, y, stamp.width, stamp.height))
+		return 0;
+
 	// Calculate the index in the pixel data array
 	int index = (y * stamp.width + x) * stamp.channels + channel;
 
 	// Make sure the index is within bounds
-	if (index < 0 || index >= stamp.pixelData[variationIndex].size()) {
+	if (index < 0 || index >= stamp.pixelData()[variationIndex].size()) {
 		return 0;
 	}
 
-	return stamp.pixelData[variationIndex][index];
+	return stamp.pixelData()[variationIndex][index];
+}
+
+
+// Whether a pixel collides: alpha above zero and not eroded by damage
+// Reads the one bit collision mask when the asset has one, the pixel data otherwise
+bool isOpaquePixel(const Sprite& stamp, size_t variationIndex, int x, int y) {
+	if (x < 0 || x >= stamp.width || y < 0 || y >= stamp.height)
+		return false;
+
+	const std::vector<std::vector<unsigned char>>& masks = stamp.collisionMasks();
+
+	if (variationIndex >= masks.size() || masks[variationIndex].empty())
+		return getPixelValueFromStamp(stamp, variationIndex, x, y, 3) > 0;
+
+	if (stamp.damageMask.isEroded(x, y, stamp.width, stamp.height))
+		return false;
+
+	const size_t bit = size_t(y) * stamp.width + x;
+	return (masks[variationIndex][bit >> 3] >> (bit & 7)) & 1;
 }
 
 
-bool isPixelPerfectCollision(const Stamp& a, const Stamp& b) {
+bool isPixelPerfectCollision(const Transform& aTransform, const Sprite& a, const Transform& bTransform, const Sprite& b) {
 	float aMinX, aMinY, aMaxX, aMaxY;
 	float bMinX, bMinY, bMaxX, bMaxY;
 
-	calculateBoundingBox(a, aMinX, aMinY, aMaxX, aMaxY);
-	calculateBoundingBox(b, bMinX, bMinY, bMaxX, bMaxY);
+	calculateBoundingBox(aTransform, a, aMinX, aMinY, aMaxX, aMaxY);
+	calculateBoundingBox(bTransform, b, bMinX, bMinY, bMaxX, bMaxY);
 
 	// Quick check if bounding boxes overlap
 	if (!(aMaxX >= bMinX && aMinX <= bMaxX && aMaxY >= bMinY && aMinY <= bMaxY)) {
@@ -1478,14 +4233,7 @@ bool isPixelPerfectCollision(const Stamp& a, const Stamp& b) {
 			int texBx = int((x - bMinX) / (bMaxX - bMinX) * b.width);
 			int texBy = int((y - bMinY) / (bMaxY - bMinY) * b.height);
 
-			// Get alpha values
-			float alphaA = getPixelValueFromStamp(a, a.currentVariationIndex, texAx, texAy, 3) / 255.0f;
-			float alphaB = getPixelValueFromStamp(b, b.currentVariationIndex, texBx, texBy, 3) / 255.0f;
-
-
-
-
-			if (alphaA > 0.0f && alphaB > 0.0f) {
+			if (isOpaquePixel(a, a.currentVariationIndex, texAx, texAy) && isOpaquePixel(b, b.currentVariationIndex, texBx, texBy)) {
 				return true; // Pixels overlap with sufficient alpha
 			}
 		}
@@ -1690,7 +4438,11 @@ struct CollisionPoint {
 	float r;
 	float b;
 
-	CollisionPoint(int _x, int _y, float _r, float _b) : x(_x), y(_y), r(_r), b(_b) {}
+	// Number of obstacle pixels this point stands for (1 per pixel, more for a tile centroid)
+	// r and b are averages over those pixels
+	int count;
+
+	CollisionPoint(int _x, int _y, float _r, float _b, int _count = 1) : x(_x), y(_y), r(_r), b(_b), count(_count) {}
 };
 
 
@@ -1699,14 +4451,13 @@ GLuint loadTexture(const char* filename) {
 	glGenTextures(1, &textureID);
 
 
-	// Load image using stb_image
-	int width, height, channels;
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char* data = stbi_load(filename, &width, &height, &channels, 0);
+	// Mapped from the asset pack, or decoded ahead on the startup thread pool
+	LoadedImage image = loadImage(filename, true);
+	int channels = image.channels;
 
-	if (!data) {
+	if (!image.texels) {
 		std::cerr << "Failed to load texture: " << filename << std::endl;
-		std::cerr << "STB Image error: " << stbi_failure_reason() << std::endl;
+		std::cerr << "STB Image error: " << image.decoded.error << std::endl;
 
 		//// Create a default checkerboard pattern as fallback
 		//width = 256;
@@ -1744,19 +4495,11 @@ GLuint loadTexture(const char* filename) {
 	}
 
 	// Load texture data to GPU
-	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+	uploadImage(image, format);
 
 	// Generate mipmaps
 	glGenerateMipmap(GL_TEXTURE_2D);
 
-	// Free image data
-	if (stbi_failure_reason()) {
-		delete[] data; // Free our fallback data
-	}
-	else {
-		stbi_image_free(data); // Free stb_image data
-	}
-
 	return textureID;
 }
 
@@ -1766,41 +4509,105 @@ std::vector<CollisionPoint> collisionPoints;
 
 
 
+// Per level settings from level.cfg, one key = value per line, # starts a comment
+// Anything the file leaves out keeps these defaults
+struct LevelConfig {
+	size_t max_bullets = 65536;
+	size_t max_ally_ships = 64;
+	size_t max_enemy_ships = 256;
+	size_t max_foreground_chunks = 1024;
+	size_t max_powerups = 64;
+	size_t max_blackening_points = 16384;
+	size_t seed = 1;
+	size_t stream_assets = 1;        // 0 loads everything in initGL
+	size_t stream_ahead = 1;         // Level segments streamed in past the next one
+	size_t stream_upload_kb = 4096;  // Uploaded per frame at most
+};
 
+LevelConfig levelConfig;
 
+void loadLevelConfig(const std::string& filename) {
+	std::ifstream file(filename);
 
+	if (!file) {
+		std::cout << "No " << filename << ", using the default pool sizes" << std::endl;
+		return;
+	}
 
+	const std::pair<const char*, size_t*> keys[] = {
+		{ "max_bullets", &levelConfig.max_bullets },
+		{ "max_ally_ships", &levelConfig.max_ally_ships },
+		{ "max_enemy_ships", &levelConfig.max_enemy_ships },
+		{ "max_foreground_chunks", &levelConfig.max_foreground_chunks },
+		{ "max_powerups", &levelConfig.max_powerups },
+		{ "max_blackening_points", &levelConfig.max_blackening_points },
+		{ "seed", &levelConfig.seed },
+		{ "stream_assets", &levelConfig.stream_assets },
+		{ "stream_ahead", &levelConfig.stream_ahead },
+		{ "stream_upload_kb", &levelConfig.stream_upload_kb },
+	};
 
+	std::string line;
+	int lineNumber = 0;
 
+	while (std::getline(file, line)) {
+		lineNumber++;
 
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
 
+		size_t equals = line.find('=');
+		if (equals == std::string::npos)
+			continue;
 
-const char* multiTargetBlackeningFragmentShader = R"(
-#version 330 core
-uniform sampler2D originalTexture;
-uniform sampler2D maskTexture;
-uniform float random_number;
+		std::string key;
+		size_t value = 0;
+		std::istringstream(line.substr(0, equals)) >> key;
 
-// Multiple outputs
-layout(location = 0) out vec4 FragColor;     // Main output (blackened texture)
-//layout(location = 1) out vec4 MaskColor;     // Updated mask output
+		if (!(std::istringstream(line.substr(equals + 1)) >> value)) {
+			std::cerr << filename << ":" << lineNumber << ": bad value for " << key << std::endl;
+			continue;
+		}
 
-in vec2 TexCoord;
+		bool known = false;
+		for (const auto& k : keys) {
+			if (key == k.first) {
+				*k.second = value;
+				known = true;
+			}
+		}
 
-void main() {
-    vec4 original = texture(originalTexture, TexCoord);
-    vec4 mask = texture(maskTexture, TexCoord);
-    
-    // Calculate mask intensity from current mask
-    float maskIntensity = (mask.r + mask.g + mask.b) / 3.0;
+		if (!known)
+			std::cerr << filename << ":" << lineNumber << ": unknown key " << key << std::endl;
+	}
+}
 
-    FragColor = original * (1.0 - pow(maskIntensity, 4.0));
-    FragColor.a = original.a; // Preserve alpha channel
+// Size every per-frame container up front, so the frame loop never has to grow one
+void reserveEntityPools() {
+	bullets.setCapacity(levelConfig.max_bullets);
+	allyShips.reserve(levelConfig.max_ally_ships);
+	enemyShips.reserve(levelConfig.max_enemy_ships);
+	foregroundChunks.reserve(levelConfig.max_foreground_chunks);
+	allyPowerUps.reserve(levelConfig.max_powerups);
+	blackeningPoints.reserve(levelConfig.max_blackening_points);
+	blackeningPointUpload.reserve(8 * levelConfig.max_blackening_points);
+
+	std::cout << "Pools: " << levelConfig.max_bullets << " bullets, " << levelConfig.max_ally_ships << " ally ships, "
+		<< levelConfig.max_enemy_ships << " enemy ships, " << levelConfig.max_foreground_chunks << " foreground chunks, "
+		<< levelConfig.max_powerups << " power ups" << std::endl;
+}
 
-    if(maskIntensity == 1.0 && random_number > 0.9)
-        FragColor.a = 0.0;
+void reportEntityPools() {
+	std::cout << "Pools:" << std::endl;
+	std::cout << "  bullets: " << bullets.size() << " of " << bullets.capacity() << ", " << bullets.dropped() << " dropped" << std::endl;
+	std::cout << "  ally ships: " << allyShips.size() << " of " << allyShips.capacity() << ", grew " << allyShips.growths() << " times" << std::endl;
+	std::cout << "  enemy ships: " << enemyShips.size() << " of " << enemyShips.capacity() << ", grew " << enemyShips.growths() << " times" << std::endl;
+	std::cout << "  foreground chunks: " << foregroundChunks.size() << " of " << foregroundChunks.capacity() << ", grew " << foregroundChunks.growths() << " times" << std::endl;
+	std::cout << "  power ups: " << allyPowerUps.size() << " of " << allyPowerUps.capacity() << ", grew " << allyPowerUps.growths() << " times" << std::endl;
+	std::cout << "  blackening points: " << blackeningPoints.capacity() << " a frame, " << blackeningPointsDropped << " dropped" << std::endl;
+	std::cout << "  frames that allocated: " << frameAllocations.hitches() << std::endl;
 }
-)";
 
 
 
@@ -1811,52 +4618,72 @@ void main() {
 
 
 
-// Add this shader definition
-const char* batchBlackeningFragmentShader = R"(
-#version 330 core
-uniform sampler2D currentBlackening;        // Current blackening texture
-uniform vec2 collisionPositions[256];        // Array of collision positions
-uniform float collisionIntensities[256];     // Array of collision intensities
-uniform int numCollisionPoints;             // Actual number of collision points
-uniform float radius;                       // Radius of the blackening mark
-uniform vec2 texSize;                       // Texture dimensions
 
-out vec4 FragColor;
-in vec2 TexCoord;
+
+
+
+
+
+
+
+
+
+
+
+// Blackening splats: one small quad per collision point, read from an SSBO
+// Drawn with GL_MAX blending into the damage mask atlas, so each point only touches the texels it covers
+const char* blackeningSplatVertexShader = R"(
+#version 430 core
+
+// Everything in atlas page texture coordinates
+struct BlackeningPoint {
+    vec4 point;  // x, y, radius, intensity
+    vec4 clip;   // min x, min y, max x, max y of the stamp's rect
+};
+
+layout(std430, binding = 0) buffer BlackeningPoints {
+    BlackeningPoint points[];
+};
+
+uniform int pointOffset;
+
+out vec2 SplatCoord;
+flat out float Intensity;
 
 void main() {
-    // Get current blackening value
-    vec4 current = texture(currentBlackening, TexCoord);
-    
-    // Maximum blackening from all collision points
-    float maxBlackening = current.r;  // Start with existing blackening level
-    
-    // Process all collision points
-    for (int i = 0; i < numCollisionPoints; i++) 
-	{
-        vec2 collisionPos = collisionPositions[i];
-        float intensity = collisionIntensities[i];
-        
-        // Calculate distance from this fragment to collision point
-        vec2 pixelPos = TexCoord * texSize;
-        vec2 collisionPixel = collisionPos * texSize;
-        float distance = length(pixelPos - collisionPixel);
-        
-        // Add blackening based on distance
-        if (distance <= radius * texSize.x) {
-            // Intensity decreases with distance (quadratic falloff)
-            float pointBlackening = 1.0 - pow(distance / (radius * texSize.x), 2.0);
-            
-            // Scale by collision intensity
-            pointBlackening *= intensity;
-            
-            // Keep the maximum blackening value (new or existing)
-            maxBlackening = max(maxBlackening, pointBlackening);
-        }
-    }
-    
-    // Output the maximum blackening value
-    FragColor = vec4(maxBlackening, maxBlackening, maxBlackening, 1.0);
+    BlackeningPoint p = points[pointOffset + gl_InstanceID];
+
+    // Triangle strip corners from the vertex index, no vertex buffer needed
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0 - 1.0;
+
+    // Clamp the quad to the stamp's rect so splats can't bleed into a neighbour,
+    // then work out where the clamped corner sits in the splat
+    vec2 position = clamp(p.point.xy + corner * p.point.z, p.clip.xy, p.clip.zw);
+
+    SplatCoord = (position - p.point.xy) / p.point.z;
+    Intensity = p.point.w;
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+const char* blackeningSplatFragmentShader = R"(
+#version 430 core
+
+in vec2 SplatCoord;
+flat in float Intensity;
+
+out vec4 FragColor;
+
+void main() {
+    float distanceSquared = dot(SplatCoord, SplatCoord);
+
+    if (distanceSquared > 1.0)
+        discard;
+
+    // Quadratic falloff scaled by the collision intensity, max blending keeps the darkest value
+    float blackening = (1.0 - distanceSquared) * Intensity;
+
+    FragColor = vec4(blackening, blackening, blackening, 1.0);
 }
 )";
 
@@ -2143,82 +4970,122 @@ void main() {
 
 
 
-const char* stampTextureFragmentShader = R"(
+// Sprites are drawn as instanced quads sized to their footprint, one instance per sprite (see SpriteBatch)
+const char* stampTextureVertexShader = R"(
 #version 330 core
-uniform sampler2D stampTexture;
-uniform vec2 position;
-uniform vec2 stampSize;
-uniform float threshold;
+layout(location = 0) in vec2 aCorner;        // 0 to 1 across the quad
+layout(location = 1) in vec4 aPositionSize;  // Position in screen texture coordinates, size in pixels
+layout(location = 2) in vec4 aAtlasRect;     // Offset and size of the sprite's rect in its atlas layer
+layout(location = 3) in vec4 aDamageRect;    // Offset and size of the sprite's rect in its damage mask page
+layout(location = 4) in vec4 aParams;        // Atlas layer (-1 for its own texture), opacity, under_fire, has_damage
+
+uniform mat4 projection;
 uniform vec2 screenSize;
-uniform float stamp_opacity;
-uniform int under_fire;
+
+out vec2 StampCoord;
+flat out vec4 AtlasRect;
+flat out vec4 DamageRect;
+flat out vec2 StampTexSize;
+flat out float Layer;
+flat out float Opacity;
+flat out int UnderFire;
+flat out int HasDamage;
+
+void main()
+{
+    // The same footprint the old full-screen pass ended up with, including its mysterious /1.5:
+    // stamp coordinate c lands at position + (1.5c - 0.5) * half the sprite size
+    vec2 halfSize = aPositionSize.zw / (2.0 * screenSize);
+    vec2 screenPos = aPositionSize.xy + (1.5 * aCorner - 0.5) * halfSize;
+
+    gl_Position = projection * vec4(screenPos * 2.0 - 1.0, 0.0, 1.0);
+
+    StampCoord = aCorner;
+    AtlasRect = aAtlasRect;
+    DamageRect = aDamageRect;
+    StampTexSize = aPositionSize.zw;
+    Layer = aParams.x;
+    Opacity = aParams.y;
+    UnderFire = int(aParams.z);
+    HasDamage = int(aParams.w);
+}
+)";
+
+// Built with withStampDamage
+const char* stampTextureFragmentShader = R"(
+uniform sampler2DArray spriteAtlas;
+uniform sampler2D spriteTexture;  // For the odd sprite that didn't fit in the atlas
 uniform float time;
-in vec2 TexCoord;
+
+in vec2 StampCoord;
+flat in vec4 AtlasRect;
+flat in vec4 DamageRect;
+flat in vec2 StampTexSize;
+flat in float Layer;
+flat in float Opacity;
+flat in int UnderFire;
+flat in int HasDamage;
+
 out vec4 FragColor;
 
+// Clamped half a texel inside the rect, which is what CLAMP_TO_EDGE gave the sprite's own texture
+vec4 sampleSprite(vec2 stampCoord)
+{
+    if(Layer < 0.0)
+        return texture(spriteTexture, stampCoord);
+
+    vec2 halfTexel = 0.5 / vec2(textureSize(spriteAtlas, 0).xy);
+    vec2 uv = clamp(AtlasRect.xy + stampCoord * AtlasRect.zw, AtlasRect.xy + halfTexel, AtlasRect.xy + AtlasRect.zw - halfTexel);
+
+    return texture(spriteAtlas, vec3(uv, Layer));
+}
+
 void main() 
 {
-    // Get dimensions
-    vec2 stampTexSize = vec2(textureSize(stampTexture, 0));
-    float windowAspect = screenSize.x / screenSize.y;
-    
-    // Calculate coordinates in stamp texture - use the same approach as the obstacle shader
-    vec2 stampCoord = (TexCoord - position) * screenSize / (stampTexSize/2.0) + vec2(0.5);
-    
-    //// Apply aspect ratio correction
-    //if (windowAspect > 1.0) {
-    //    // Wide window - adjust x coordinate
-    //    stampCoord.x = (stampCoord.x - 0.5) / windowAspect + 0.5;
-    //} else if (windowAspect < 1.0) {
-    //    // Tall window - adjust y coordinate
-    //    stampCoord.y = (stampCoord.y - 0.5) * windowAspect + 0.5;
-    //}
-    
-	// why is this necessary?
-	stampCoord /= 1.5;//sqrt(2.0);
+    vec4 stampColor = sampleSprite(StampCoord);
 
-    // Check if we're within stamp bounds
-    if (stampCoord.x >= 0.0 && stampCoord.x <= 1.0 && 
-        stampCoord.y >= 0.0 && stampCoord.y <= 1.0) 
+	// Blacken by the damage mask, the template itself is never modified
+	if(HasDamage == 1)
 	{
-        // Sample stamp texture (use all channels for RGBA output)
-        vec4 stampColor = texture(stampTexture, stampCoord);
+		float damage = sampleDamage(DamageRect, StampCoord);
 
-		// Do alternating colour / white blinking when under fire
-		if(under_fire == 1)
-		{
-			const float timeslice = 0.25;
-			float m = mod(time, timeslice);
-		
-			if(m < timeslice/2.0)
-			stampColor.rgb = vec3(1.0, 1.0, 1.0);
-		}
+		stampColor.rgb *= 1.0 - pow(damage, 4.0);
 
+		if(isEroded(damage, StampCoord, StampTexSize))
+			stampColor.a = 0.0;
+	}
 
-		stampColor.a *= stamp_opacity;      
-        FragColor = stampColor;
-    } 
-	else
+	// Do alternating colour / white blinking when under fire
+	if(UnderFire == 1)
 	{
-        // Outside stamp bounds - transparent
-        FragColor = vec4(0.0, 0.0, 0.0, 0.0);
-    }
+		const float timeslice = 0.25;
+		float m = mod(time, timeslice);
+	
+		if(m < timeslice/2.0)
+		stampColor.rgb = vec3(1.0, 1.0, 1.0);
+	}
+
+	stampColor.a *= Opacity;
+    FragColor = stampColor;
 }
 )";
 
 
 
 
+// Built with withStampDamage, so holes you can see are holes the fluid goes through
 const char* stampObstacleFragmentShader = R"(
-#version 330 core
 uniform sampler2D obstacleTexture;
 uniform sampler2D stampTexture;
 uniform sampler2D colorTexture;
 uniform sampler2D friendlyColorTexture;
+uniform vec4 damageRect;        // Offset and size of this stamp's rect in the page
+uniform int has_damage;
 
 uniform vec2 position;
 uniform vec2 stampSize;
 uniform float threshold;
+uniform float obstacleKind; // OBSTACLE_ALLY, OBSTACLE_ENEMY, ...
 uniform vec2 screenSize; // Add this uniform to match texture shader
 uniform float colorThreshold; // Threshold for color detection
 
@@ -2236,8 +5103,9 @@ void main()
     
     // Get dimensions
     vec2 stampTexSize = vec2(textureSize(stampTexture, 0));
-    vec2 obstacleTexSize = vec2(textureSize(obstacleTexture, 0));
-    float windowAspect = obstacleTexSize.x / obstacleTexSize.y; // Or use screenSize if passed
+    // Window size rather than the obstacle texture's, the fluid may be running at a lower resolution
+    vec2 obstacleTexSize = screenSize;
+    float windowAspect = obstacleTexSize.x / obstacleTexSize.y;
     
     // Calculate coordinates in stamp texture - use the same approach as the texture shader
     vec2 stampCoord = (TexCoord - position) * obstacleTexSize / (stampTexSize/2.0) + vec2(0.5);
@@ -2258,8 +5126,11 @@ void main()
         // Sample stamp texture (use alpha channel for transparency)
         float stampValue = texture(stampTexture, stampCoord).a;
         
-        // Apply threshold to make it binary
-        stampValue = stampValue > threshold ? 1.0 : 0.0;
+        // Apply threshold to make it binary, tagged with the kind of stamp
+        stampValue = stampValue > threshold ? obstacleKind : 0.0;
+
+        if(has_damage == 1 && isEroded(sampleDamage(damageRect, stampCoord), stampCoord, stampTexSize))
+            stampValue = 0.0;
         
         // Combine with existing obstacle (using max for union)
         newObstacle = max(obstacle, stampValue);
@@ -2412,6 +5283,7 @@ uniform float eddyIntensity;  // Controls overall intensity of eddies
 uniform float eddyDensity;    // Controls how many eddies appear
 uniform float fbm_amplitude = 100.0;
 uniform float fbm_frequency = 10.0;
+uniform ivec3 eddyOctaves = ivec3(3, 2, 1); // Large, medium and small eddies, lowered by the quality level
 
 float WIDTH = texelSize.x;
 float HEIGHT = texelSize.y;
@@ -2463,24 +5335,24 @@ float fbm(vec2 p, int octaves) {
 // Create a vector field for eddies
 vec2 eddyField(vec2 p, float t) {
     // Multi-scale noise for different sized eddies
-    float noise1 = fbm(p * 3.0 + vec2(t * 0.1, t * 0.2), 3);
-    float noise2 = fbm(p * 8.0 + vec2(t * 0.2, -t * 0.1), 2);
-    float noise3 = fbm(p * 15.0 + vec2(-t * 0.3, t * 0.3), 1);
+    float noise1 = fbm(p * 3.0 + vec2(t * 0.1, t * 0.2), eddyOctaves.x);
+    float noise2 = fbm(p * 8.0 + vec2(t * 0.2, -t * 0.1), eddyOctaves.y);
+    float noise3 = fbm(p * 15.0 + vec2(-t * 0.3, t * 0.3), eddyOctaves.z);
     
     // Calculate rotational vector field based on noise
     vec2 grad1 = vec2(
-        fbm(p * 3.0 + vec2(0.01, 0.0) + vec2(t * 0.1, t * 0.2), 3) - noise1,
-        fbm(p * 3.0 + vec2(0.0, 0.01) + vec2(t * 0.1, t * 0.2), 3) - noise1
+        fbm(p * 3.0 + vec2(0.01, 0.0) + vec2(t * 0.1, t * 0.2), eddyOctaves.x) - noise1,
+        fbm(p * 3.0 + vec2(0.0, 0.01) + vec2(t * 0.1, t * 0.2), eddyOctaves.x) - noise1
     ) * 2.0;
     
     vec2 grad2 = vec2(
-        fbm(p * 8.0 + vec2(0.01, 0.0) + vec2(t * 0.2, -t * 0.1), 2) - noise2,
-        fbm(p * 8.0 + vec2(0.0, 0.01) + vec2(t * 0.2, -t * 0.1), 2) - noise2
+        fbm(p * 8.0 + vec2(0.01, 0.0) + vec2(t * 0.2, -t * 0.1), eddyOctaves.y) - noise2,
+        fbm(p * 8.0 + vec2(0.0, 0.01) + vec2(t * 0.2, -t * 0.1), eddyOctaves.y) - noise2
     ) * 1.0;
     
     vec2 grad3 = vec2(
-        fbm(p * 15.0 + vec2(0.01, 0.0) + vec2(-t * 0.3, t * 0.3), 1) - noise3,
-        fbm(p * 15.0 + vec2(0.0, 0.01) + vec2(-t * 0.3, t * 0.3), 1) - noise3
+        fbm(p * 15.0 + vec2(0.01, 0.0) + vec2(-t * 0.3, t * 0.3), eddyOctaves.z) - noise3,
+        fbm(p * 15.0 + vec2(0.0, 0.01) + vec2(-t * 0.3, t * 0.3), eddyOctaves.z) - noise3
     ) * 0.5;
     
     // Create swirling motion by rotating the gradients
@@ -2986,16 +5858,13 @@ GLuint loadFontTexture(const char* filename) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	// Load image using stb_image (you're already using this)
-	int width, height, channels;
-	stbi_set_flip_vertically_on_load(false);
-
+	// Not flipped, the glyph layout is top down
+	LoadedImage image = loadImage(filename, false);
+	int channels = image.channels;
 
-	unsigned char* data = stbi_load(filename, &width, &height, &channels, 0);
-
-	if (!data) {
+	if (!image.texels) {
 		std::cerr << "Failed to load font texture: " << filename << std::endl;
-		std::cerr << "STB Image error: " << stbi_failure_reason() << std::endl;
+		std::cerr << "STB Image error: " << image.decoded.error << std::endl;
 		return 0;
 	}
 
@@ -3011,17 +5880,15 @@ GLuint loadFontTexture(const char* filename) {
 	}
 
 	// Load texture data to GPU
-	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-
-	// Free image data
-	stbi_image_free(data);
+	uploadImage(image, format);
 
 	return textureID;
 }
 
-FontAtlas initFontAtlas(const char* filename) {
+// The font's layout without its texture, the asset packer measures glyphs against it too
+FontAtlas fontAtlasLayout() {
 	FontAtlas atlas;
-	atlas.textureID = loadFontTexture(filename);
+	atlas.textureID = 0;
 	atlas.charWidth = 64;
 	atlas.charHeight = 64;
 	atlas.atlasWidth = 1024;
@@ -3031,6 +5898,213 @@ FontAtlas initFontAtlas(const char* filename) {
 	return atlas;
 }
 
+FontAtlas initFontAtlas(const char* filename) {
+	FontAtlas atlas = fontAtlasLayout();
+	atlas.textureID = loadFontTexture(filename);
+
+	return atlas;
+}
+
+// Width of every character from the font's pixels, rows top down
+// Only the red channel is looked at, the font is grayscale
+void measureGlyphWidths(const FontAtlas& atlas, const unsigned char* pixels, int channels, int widths[256]) {
+	const int dataSize = atlas.atlasWidth * atlas.atlasHeight * channels;
+
+	// Analyze each character
+	for (unsigned short c_ = 0; c_ < 256; c_++)
+	{
+		unsigned char c = static_cast<unsigned char>(c_);
+
+		// ASCII range
+		int atlasX = (c % atlas.charsPerRow) * atlas.charWidth;
+		int atlasY = (c / atlas.charsPerRow) * atlas.charHeight;
+
+		// Find leftmost non-empty column
+		int leftEdge = atlas.charWidth - 1; // Start from rightmost position
+
+		// Find rightmost non-empty column
+		int rightEdge = 0; // Start from leftmost position
+
+		// Scan all columns for this character
+		for (int x = 0; x < atlas.charWidth; x++) {
+			bool columnHasPixels = false;
+
+			// Check if any pixel in this column is non-transparent
+			for (int y = 0; y < atlas.charHeight; y++) {
+				int pixelIndex = ((atlasY + y) * atlas.atlasWidth + (atlasX + x)) * channels;
+				if (pixelIndex >= 0 && pixelIndex < dataSize) {
+					// Check alpha value (using red channel for grayscale font)
+					if (pixels[pixelIndex] > 20) { // Non-transparent threshold
+						columnHasPixels = true;
+						break;
+					}
+				}
+			}
+
+			if (columnHasPixels) {
+				// Update left edge (minimum value)
+				leftEdge = std::min(leftEdge, x);
+				// Update right edge (maximum value)
+				rightEdge = std::max(rightEdge, x);
+			}
+		}
+
+		// If no pixels were found (space or empty character)
+		if (rightEdge < leftEdge) {
+			// Default width for space character
+			if (c == ' ') {
+				widths[c] = atlas.charWidth / 3; // Make space 1/3 of cell width
+			}
+			else {
+				widths[c] = atlas.charWidth / 4; // Default minimum width
+			}
+		}
+		else {
+			// Calculate width based on the actual character bounds
+			int actualWidth = (rightEdge - leftEdge) + 1;
+
+			// Add some padding
+			int paddedWidth = actualWidth + 4; // 2 pixels on each side
+
+			// Store this character's width (minimum width of 1/4 of the cell)
+			widths[c] = std::max(paddedWidth, atlas.charWidth / 4);
+		}
+	}
+}
+
+// --pack: decodes the level's PNGs once and writes them, with everything derived from them, to one file
+// Written next to the pack and renamed over it, so a running game's mapping is never torn
+bool writeAssetPack(const char* path) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// The streamer isn't running yet, so this is every image, the streamed ones included
+	const std::vector<ImageDecoder::Request> requests = startupImageRequests();
+	imageDecoder.decodeAll(requests);
+
+	struct Entry {
+		AssetPack::Image record;
+		DecodedImage image;
+		std::vector<unsigned char> mask;
+		std::vector<unsigned char> chunks;
+	};
+
+	std::vector<Entry> entries;
+	int32_t glyphWidths[256] = {};
+	bool packedFont = false;
+
+	for (const ImageDecoder::Request& request : requests) {
+		Entry entry;
+		entry.image = imageDecoder.take(request.path, request.flip);
+
+		if (entry.image.pixels.empty() || request.path.size() >= sizeof(entry.record.path)) {
+			std::cerr << "Not packing " << request.path << ": " << entry.image.error << std::endl;
+			continue;
+		}
+
+		const DecodedImage& image = entry.image;
+		AssetPack::Image& record = entry.record;
+		std::memset(&record, 0, sizeof(record));
+		std::memcpy(record.path, request.path.c_str(), request.path.size() + 1);
+		record.width = image.width;
+		record.height = image.height;
+		record.channels = image.channels;
+		record.flip = request.flip ? 1 : 0;
+		AssetPack::sourceStamp(request.path.c_str(), record.source_size, record.source_mtime);
+
+		entry.mask = buildCollisionMask(image.pixels.data(), image.width, image.height, image.channels);
+
+		// Foregrounds get the same answers chunkForegroundStamp would work out
+		if (request.path.find("/foreground") != std::string::npos) {
+			record.chunks_x = (image.width + FOREGROUND_CHUNK_SIZE - 1) / FOREGROUND_CHUNK_SIZE;
+			record.chunks_y = (image.height + FOREGROUND_CHUNK_SIZE - 1) / FOREGROUND_CHUNK_SIZE;
+
+			for (uint32_t chunkY = 0; chunkY < record.chunks_y; chunkY++) {
+				for (uint32_t chunkX = 0; chunkX < record.chunks_x; chunkX++) {
+					int startX = chunkX * FOREGROUND_CHUNK_SIZE;
+					int startY = chunkY * FOREGROUND_CHUNK_SIZE;
+					bool empty = isChunkFullyTransparent(image.pixels, image.width, image.height, image.channels,
+						startX, startY, FOREGROUND_CHUNK_SIZE, FOREGROUND_CHUNK_SIZE);
+					entry.chunks.push_back(empty ? 0 : 1);
+				}
+			}
+		}
+
+		if (request.path == "font.png" && !request.flip) {
+			int widths[256];
+			measureGlyphWidths(fontAtlasLayout(), image.pixels.data(), image.channels, widths);
+			std::copy(widths, widths + 256, glyphWidths);
+			packedFont = true;
+		}
+
+		entries.push_back(std::move(entry));
+	}
+
+	// Header, image records, then every block 16 byte aligned
+	uint64_t end = sizeof(AssetPack::Header) + entries.size() * sizeof(AssetPack::Image);
+	auto place = [&end](size_t size) {
+		uint64_t at = (end + 15) & ~uint64_t(15);
+		end = at + size;
+		return at;
+	};
+
+	for (Entry& entry : entries) {
+		entry.record.texel_offset = place(entry.image.pixels.size());
+		entry.record.mask_offset = entry.mask.empty() ? 0 : place(entry.mask.size());
+		entry.record.chunk_offset = entry.chunks.empty() ? 0 : place(entry.chunks.size());
+	}
+
+	AssetPack::Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, "FGPK", 4);
+	header.version = AssetPack::VERSION;
+	header.image_count = uint32_t(entries.size());
+	header.chunk_size = FOREGROUND_CHUNK_SIZE;
+	header.glyph_offset = packedFont ? place(sizeof(glyphWidths)) : 0;
+
+	const std::string temp = std::string(path) + ".tmp";
+	std::ofstream out(temp, std::ios::binary);
+
+	auto writeAt = [&out](uint64_t at, const void* data, size_t size) {
+		static const char zeros[16] = {};
+		while (uint64_t(out.tellp()) < at)
+			out.write(zeros, std::streamsize(std::min<uint64_t>(sizeof(zeros), at - uint64_t(out.tellp()))));
+		out.write(static_cast<const char*>(data), std::streamsize(size));
+	};
+
+	writeAt(0, &header, sizeof(header));
+	for (const Entry& entry : entries)
+		writeAt(out.tellp(), &entry.record, sizeof(entry.record));
+
+	for (const Entry& entry : entries) {
+		writeAt(entry.record.texel_offset, entry.image.pixels.data(), entry.image.pixels.size());
+		if (entry.record.mask_offset)
+			writeAt(entry.record.mask_offset, entry.mask.data(), entry.mask.size());
+		if (entry.record.chunk_offset)
+			writeAt(entry.record.chunk_offset, entry.chunks.data(), entry.chunks.size());
+	}
+
+	if (packedFont)
+		writeAt(header.glyph_offset, glyphWidths, sizeof(glyphWidths));
+
+	out.close();
+
+	if (!out) {
+		std::cerr << "Could not write " << temp << std::endl;
+		std::remove(temp.c_str());
+		return false;
+	}
+
+	std::remove(path);
+	if (std::rename(temp.c_str(), path) != 0) {
+		std::cerr << "Could not replace " << path << std::endl;
+		return false;
+	}
+
+	std::cout << "Packed " << entries.size() << " images into " << path << " (" << end / (1024 * 1024) << " MB) in "
+		<< std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+	return true;
+}
+
 
 const char* textVertexShaderSource = R"(
 #version 330 core
@@ -3372,29 +6446,36 @@ void clearObstacleTexture() {
 
 
 void reapplyAllStamps() {
-	auto processStamps = [&](const std::vector<Stamp>& stamps) {
-		for (const auto& stamp : stamps) {
+	auto processStamps = [&](const auto& stamps, float kind) {
+		const auto& transforms = stamps.template column<Transform>();
+		const auto& lifetimes = stamps.template column<Lifetime>();
+		const auto& sprites = stamps.template column<Sprite>();
+
+		for (size_t j = 0; j < stamps.size(); j++) {
 			// If the stamp is dead then don't use it for an obstacle
 			// This is so that the stamp doesn't interfere with the colour / force of its explosion when it dies and fades away
-			if (stamp.to_be_culled) continue;
+			if (lifetimes[j].to_be_culled) continue;
+
+			const Sprite& stamp = sprites[j];
 
 			size_t variationIndex = stamp.currentVariationIndex;
-			if (variationIndex < 0 || variationIndex >= stamp.textureIDs.size() ||
-				stamp.textureIDs[variationIndex] == 0) {
-				for (size_t i = 0; i < stamp.textureIDs.size(); i++) {
-					if (stamp.textureIDs[i] != 0) {
+			if (variationIndex < 0 || variationIndex >= stamp.textureIDs().size() ||
+				stamp.textureIDs()[variationIndex] == 0) {
+				for (size_t i = 0; i < stamp.textureIDs().size(); i++) {
+					if (stamp.textureIDs()[i] != 0) {
 						variationIndex = i;
 						break;
 					}
 				}
-				if (variationIndex < 0 || variationIndex >= stamp.textureIDs.size() ||
-					stamp.textureIDs[variationIndex] == 0) {
+				if (variationIndex < 0 || variationIndex >= stamp.textureIDs().size() ||
+					stamp.textureIDs()[variationIndex] == 0) {
 					continue;
 				}
 			}
 
-			glUniform2f(glGetUniformLocation(stampObstacleProgram, "position"), stamp.posX, stamp.posY);
+			glUniform2f(glGetUniformLocation(stampObstacleProgram, "position"), transforms[j].posX, transforms[j].posY);
 			glUniform2f(glGetUniformLocation(stampObstacleProgram, "stampSize"), (float)stamp.width, (float)stamp.height);
+			glUniform1f(glGetUniformLocation(stampObstacleProgram, "obstacleKind"), kind);
 
 
 			GLuint projectionLocation = glGetUniformLocation(stampObstacleProgram, "projection");
@@ -3403,18 +6484,27 @@ void reapplyAllStamps() {
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, obstacleTexture);
 			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, stamp.textureIDs[variationIndex]);
+			glBindTexture(GL_TEXTURE_2D, stamp.textureIDs()[variationIndex]);
 			glActiveTexture(GL_TEXTURE2);
 			glBindTexture(GL_TEXTURE_2D, colorTexture[colorIndex]);
 			glActiveTexture(GL_TEXTURE3);
 			glBindTexture(GL_TEXTURE_2D, friendlyColorTexture[friendlyColorIndex]);
+			glUniform1i(glGetUniformLocation(stampObstacleProgram, "has_damage"), stamp.damageMask.valid());
+
+			if (stamp.damageMask.valid()) {
+				float u, v, du, dv;
+				stamp.damageMask.uvTransform(u, v, du, dv);
+				glUniform4f(glGetUniformLocation(stampObstacleProgram, "damageRect"), u, v, du, dv);
+				glActiveTexture(GL_TEXTURE4);
+				glBindTexture(GL_TEXTURE_2D, damageMaskAtlas.pageTexture(stamp.damageMask.rect().page));
+			}
 
 			glBindVertexArray(vao);
 			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 		}
 		};
 
-	if (allyShips.empty() && enemyShips.empty() && allyBullets.empty() && enemyBullets.empty() && allyPowerUps.empty()) return;
+	if (allyShips.empty() && enemyShips.empty() && foregroundChunks.empty() && allyPowerUps.empty()) return;
 
 	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, obstacleTexture, 0);
@@ -3425,6 +6515,7 @@ void reapplyAllStamps() {
 	glUniform1i(glGetUniformLocation(stampObstacleProgram, "stampTexture"), 1);
 	glUniform1i(glGetUniformLocation(stampObstacleProgram, "colorTexture"), 2);
 	glUniform1i(glGetUniformLocation(stampObstacleProgram, "friendlyColorTexture"), 3);
+	glUniform1i(glGetUniformLocation(stampObstacleProgram, "damageMask"), 4);
 	glUniform1f(glGetUniformLocation(stampObstacleProgram, "threshold"), 0.5f);
 	glUniform2f(glGetUniformLocation(stampObstacleProgram, "screenSize"), (float)WIDTH, (float)HEIGHT);
 	glUniform1f(glGetUniformLocation(stampObstacleProgram, "colorThreshold"), COLOR_DETECTION_THRESHOLD);
@@ -3432,29 +6523,27 @@ void reapplyAllStamps() {
 	GLuint projectionLocation = glGetUniformLocation(stampObstacleProgram, "projection");
 	glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(orthoMatrix));
 
-	processStamps(allyShips);
-	processStamps(enemyShips);
-	processStamps(allyPowerUps);  // Add this line to process power-ups
+	processStamps(allyShips, OBSTACLE_ALLY);
+	processStamps(enemyShips, OBSTACLE_ENEMY);
+	processStamps(foregroundChunks, OBSTACLE_FOREGROUND);
+	processStamps(allyPowerUps, OBSTACLE_POWERUP);  // Add this line to process power-ups
 
 	// Don't treat bullets as obstacles
-	//processStamps(allyBullets);
-	//processStamps(enemyBullets);
 }
 
 
 
 
-bool isCollisionInStamp(const CollisionPoint& point, Stamp& stamp, const size_t stamp_index, const string& stamp_type) {
-	// Skip if stamp is culled
-	if (stamp.to_be_culled)
-		return false;
+// Which kind of stamp the fluid hit, it decides which dye does the damage
+enum StampKind { ALLY_STAMP, ENEMY_STAMP, FOREGROUND_STAMP };
 
+bool isCollisionInStamp(const CollisionPoint& point, const Transform& transform, Sprite& stamp, const size_t stamp_index, StampKind stamp_kind) {
 	// Validate variation index
 	size_t variationIndex = stamp.currentVariationIndex;
 
 	// Get the normalized stamp position (0-1 in screen space)
-	float stampX = stamp.posX;  // Normalized X position
-	float stampY = stamp.posY;  // Normalized Y position
+	float stampX = transform.posX;  // Normalized X position
+	float stampY = transform.posY;  // Normalized Y position
 
 	// Calculate the screen-space dimensions of the stamp
 	float aspect = HEIGHT / float(WIDTH);
@@ -3470,7 +6559,7 @@ bool isCollisionInStamp(const CollisionPoint& point, Stamp& stamp, const size_t
 
 	// Calculate bounding box
 	float minX, minY, maxX, maxY;
-	calculateBoundingBox(stamp, minX, minY, maxX, maxY);
+	calculateBoundingBox(transform, stamp, minX, minY, maxX, maxY);
 
 	// Check if the collision point is within the stamp's bounding box
 	if (pointX < minX || pointX > maxX || pointY < minY || pointY > maxY)
@@ -3509,37 +6598,58 @@ bool isCollisionInStamp(const CollisionPoint& point, Stamp& stamp, const size_t
 
 	if (is_opaque_enough/* && stamp.is_foreground == false*/)
 	{
-		// Only initialize the blackening texture if we actually need it
-		if (stamp.blackeningTexture == 0) {
-			stamp.initBlackeningTexture();
-		}
+		// Only allocate the damage mask if we actually need it
+		stamp.initDamageMask();
 
 		// Calculate the intensity for the blackening based on collision values
 		float intensity = 0.0f;
-		if (stamp_type == "Ally Ship")
+		if (stamp_kind == ALLY_STAMP)
 		{			
 			intensity = point.b; // Use blue value for ally ships
 		}
 		else
 		{
 			// to do: test this... it makes blue fire do damage to the foreground too 
-			if(stamp.is_foreground)
+			if(stamp_kind == FOREGROUND_STAMP)
 				intensity = max(point.r, point.b);
 			else
 				intensity = point.r; // Use red value for enemy ships
 		}
 
-		// Ensure the texture exists in the map
-		if (stampCollisionMap.find(stamp.blackeningTexture) == stampCollisionMap.end()) {
-			stampCollisionMap[stamp.blackeningTexture] = { {}, stamp.width, stamp.height };
+		// The atlas was full, so this stamp just doesn't show damage
+		if (!stamp.damageMask.valid())
+			return is_opaque_enough;
+
+		// The frame's pool is full, the CPU copy skips the point too so it stays in step with the GPU
+		if (blackeningPoints.size() >= levelConfig.max_blackening_points) {
+			blackeningPointsDropped++;
+			return is_opaque_enough;
 		}
 
-		// Store the collision point for batch processing
+		// Store the collision point for batch processing, mapped into the stamp's atlas rect
+		const AtlasRect& rect = stamp.damageMask.rect();
+		const float page_size = float(DamageMaskAtlas::PAGE_SIZE);
+
 		BlackeningPoint bp;
-		bp.x = texCoordX;
-		bp.y = texCoordY;
+		bp.x = (rect.x + texCoordX * rect.width) / page_size;
+		bp.y = (rect.y + texCoordY * rect.height) / page_size;
+		bp.radius = 0.05f * rect.width / page_size;  // 5% of the mask width
 		bp.intensity = intensity;
-		stampCollisionMap[stamp.blackeningTexture].points.push_back(bp);
+		bp.clipMinX = rect.x / page_size;
+		bp.clipMinY = rect.y / page_size;
+		bp.clipMaxX = (rect.x + rect.width) / page_size;
+		bp.clipMaxY = (rect.y + rect.height) / page_size;
+		bp.page = rect.page;
+		blackeningPoints.push_back(bp);
+
+		// Same splat on the CPU copy, which the pixel-perfect collisions read
+		stamp.damageMask.applySplat(bp);
+
+		// The splat quad is 2 radii on a side, in mask texels
+		const float splat_size = 2.0f * 0.05f * rect.width;
+		damageMaskAtlas.splat_texels += splat_size * splat_size;
+		damageMaskAtlas.full_res_splat_texels += splat_size * splat_size / (stamp.damage_mask_scale * stamp.damage_mask_scale);
+		damageMaskAtlas.splats++;
 	}
 
 	return is_opaque_enough;
@@ -3549,109 +6659,90 @@ bool isCollisionInStamp(const CollisionPoint& point, Stamp& stamp, const size_t
 
 
 
-void batchUpdateBlackeningTexture(GLuint textureID, int width, int height, const std::vector<BlackeningPoint>& points) {
-	if (points.empty() || textureID == 0) {
+size_t blackeningPointsCapacity = 0;
+
+// Applies all of the frame's blackening points, one instanced draw per atlas page
+void processCollectedBlackeningPoints() {
+	if (blackeningPoints.empty())
 		return;
-	}
 
-	// Limit number of points to shader array size
-	const int MAX_POINTS = 256;  // Maximum points we can process in one batch
+	// Group by page, so each page's points are contiguous in the upload
+	// Not stable_sort, that allocates a buffer; the blend is max so order within a page doesn't matter
+	std::sort(blackeningPoints.begin(), blackeningPoints.end(),
+		[](const BlackeningPoint& a, const BlackeningPoint& b) { return a.page < b.page; });
 
-	// Create a temporary texture to use as the input for each batch
-	GLuint tempTexture = 0;
-	glGenTextures(1, &tempTexture);
-	glBindTexture(GL_TEXTURE_2D, tempTexture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	// 8 floats each, see BlackeningPoint; reserved for the whole pool by reserveEntityPools
+	blackeningPointUpload.clear();
 
-	// Copy the initial blackening texture content to our temp texture
-	glBindFramebuffer(GL_FRAMEBUFFER, processingFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tempTexture, 0);
+	for (const auto& bp : blackeningPoints) {
+		const float packed[8] = { bp.x, bp.y, bp.radius, bp.intensity, bp.clipMinX, bp.clipMinY, bp.clipMaxX, bp.clipMaxY };
+		blackeningPointUpload.insert(blackeningPointUpload.end(), packed, packed + 8);
+	}
 
-	// Use a simple copy shader or glCopyTexSubImage2D to copy from textureID to tempTexture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+	if (blackeningPointsSSBO == 0)
+		glGenBuffers(1, &blackeningPointsSSBO);
 
-	// Process points in batches
-	for (size_t offset = 0; offset < points.size(); offset += MAX_POINTS) {
-		int numPoints = std::min(MAX_POINTS, (int)(points.size() - offset));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, blackeningPointsSSBO);
 
-		// Prepare position and intensity arrays
-		std::vector<float> positions(MAX_POINTS * 2, 0.0f);  // x,y pairs
-		std::vector<float> intensities(MAX_POINTS, 0.0f);
+	// Only grows, so steady state is a plain sub-data upload
+	if (blackeningPointUpload.size() > blackeningPointsCapacity) {
+		blackeningPointsCapacity = blackeningPointUpload.size() * 2;
+		glBufferData(GL_SHADER_STORAGE_BUFFER, blackeningPointsCapacity * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+	}
 
-		for (int i = 0; i < numPoints; i++) {
-			const auto& bp = points[offset + i];
-			positions[i * 2] = bp.x;
-			positions[i * 2 + 1] = bp.y;
-			intensities[i] = bp.intensity;
-		}
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, blackeningPointUpload.size() * sizeof(float), blackeningPointUpload.data());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, blackeningPointsSSBO);
 
-		// Bind to the processing framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, processingFBO);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureID, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, processingFBO);
+	glViewport(0, 0, DamageMaskAtlas::PAGE_SIZE, DamageMaskAtlas::PAGE_SIZE);
+	glUseProgram(blackeningSplatProgram);
+	glBindVertexArray(vao);
 
-		// Set viewport to texture dimensions
-		glViewport(0, 0, width, height);
+	// Max blending, so each splat only darkens
+	glEnable(GL_BLEND);
+	glBlendEquation(GL_MAX);
 
-		// Use the batch blackening shader
-		glUseProgram(batchBlackeningProgram);
+	size_t first = 0;
 
-		// Set uniforms
-		glUniform1i(glGetUniformLocation(batchBlackeningProgram, "currentBlackening"), 0);
-		glUniform2fv(glGetUniformLocation(batchBlackeningProgram, "collisionPositions"), MAX_POINTS, positions.data());
-		glUniform1fv(glGetUniformLocation(batchBlackeningProgram, "collisionIntensities"), MAX_POINTS, intensities.data());
-		glUniform1i(glGetUniformLocation(batchBlackeningProgram, "numCollisionPoints"), numPoints);
-		glUniform1f(glGetUniformLocation(batchBlackeningProgram, "radius"), 0.05f);  // 5% of texture size
-		glUniform2f(glGetUniformLocation(batchBlackeningProgram, "texSize"), width, height);
-
-		GLuint projectionLocation = glGetUniformLocation(batchBlackeningProgram, "projection");
-		glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(orthoMatrix));
+	while (first < blackeningPoints.size()) {
+		const int page = blackeningPoints[first].page;
+		size_t last = first;
 
-		// Bind the current state of the blackening texture (from the previous batch or initial texture)
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, tempTexture);
+		while (last < blackeningPoints.size() && blackeningPoints[last].page == page)
+			last++;
 
-		// Draw a full-screen quad to update the texture
-		glBindVertexArray(vao);
-		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, damageMaskAtlas.pageTexture(page), 0);
+		glUniform1i(glGetUniformLocation(blackeningSplatProgram, "pointOffset"), int(first));
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GLsizei(last - first));
 
-		// Copy the result back to our temp texture for the next batch
-		glBindTexture(GL_TEXTURE_2D, tempTexture);
-		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+		first = last;
 	}
 
-	// Clean up
-	glDeleteTextures(1, &tempTexture);
+	glBlendEquation(GL_FUNC_ADD);
+	glDisable(GL_BLEND);
 
 	// Reset viewport
-	glViewport(0, 0, WIDTH, HEIGHT);
+	glViewport(0, 0, SIM_WIDTH, SIM_HEIGHT);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-
-
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-
-void processCollectedBlackeningPoints() {
-	for (auto& [textureID, data] : stampCollisionMap) {
-		if (!data.points.empty()) {
-			batchUpdateBlackeningTexture(textureID, data.width, data.height, data.points);
-		}
-	}
-
-	// Clear the map for the next frame
-	stampCollisionMap.clear();
+	// Clear the points for the next frame
+	blackeningPoints.clear();
 }
 
 
 // New class to handle GPU-based collision detection
 class GPUCollisionDetector {
 public:
+	// PER_PIXEL appends one record per colliding pixel, exact; when a pass overflows the
+	// buffer it's grown to fit and the pass is run again, so no hit is ever dropped
+	// PER_TILE reduces each 16x16 workgroup to a single record in shared memory, its centroid
+	// can miss a concave stamp or land in the wrong one of two, so it's only for profiling
+	enum Precision {
+		PER_PIXEL,
+		PER_TILE
+	};
+
 	struct GPUCollisionPoint {
 		int x;
 		int y;
@@ -3659,39 +6750,68 @@ public:
 		float b;
 	};
 
-	GPUCollisionDetector(int width, int height)
-		: m_width(width), m_height(height), m_maxCollisionPoints(65535) {
+	// One record per 16x16 tile that has at least one colliding pixel
+	struct GPUCollisionTile {
+		int count;      // Number of colliding pixels in the tile
+		float sumR;     // Sum of red collision values
+		float sumB;     // Sum of blue collision values
+		float centroidX;
+		float centroidY;
+	};
+
+	GPUCollisionDetector(int width, int height, Precision precision = PER_PIXEL)
+		: m_width(width), m_height(height), m_maxCollisionPoints(65535), m_precision(precision) {
 		initCompute();
 	}
 
 	~GPUCollisionDetector() {
 		glDeleteProgram(m_computeProgram);
-		glDeleteBuffers(1, &m_ssbo);
+		glDeleteProgram(m_tileComputeProgram);
+
+		for (auto& slot : m_slots) {
+			if (slot.fence)
+				glDeleteSync(slot.fence);
+
+			glDeleteBuffers(1, &slot.ssbo);
+		}
+	}
+
+	void setPrecision(Precision precision) {
+		m_precision = precision;
+	}
+
+	Precision getPrecision() const {
+		return m_precision;
 	}
 
-	// Initialize compute shader and SSBO
+	// The most CollisionPoints one readback can produce, in either precision
+	size_t maxResults() const {
+		return size_t(std::max(m_maxCollisionPoints, m_maxCollisionTiles));
+	}
+
+	// Initialize compute shader and SSBOs
 	void initCompute() {
-		// Create compute shader
+		// Create compute shaders
 		m_computeProgram = createComputeShaderProgram(computeShaderSource);
+		m_tileComputeProgram = createComputeShaderProgram(tileComputeShaderSource);
 
-		// Create SSBO
-		glGenBuffers(1, &m_ssbo);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssbo);
+		// The tile buffer holds at most one record per workgroup, so it can never overflow
+		m_maxCollisionTiles = ((m_width + 15) / 16) * ((m_height + 15) / 16);
 
-		// Allocate buffer for counter (first int) + array of collision points
-		// Size = sizeof(int) + maxCollisionPoints * sizeof(GPUCollisionPoint)
-		glBufferData(GL_SHADER_STORAGE_BUFFER,
-			sizeof(int) + m_maxCollisionPoints * sizeof(GPUCollisionPoint),
-			nullptr, GL_DYNAMIC_COPY);
+		// Readback scratch at its largest up front, so readbacks never allocate
+		m_gpuPoints.reserve(m_maxCollisionPoints);
+		m_gpuTiles.reserve(m_maxCollisionTiles);
+
+		for (auto& slot : m_slots) {
+			glGenBuffers(1, &slot.ssbo);
+			allocateSlot(slot);
+		}
 
-		// Initialize counter to 0
-		int zero = 0;
-		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(int), &zero);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 	}
 
 	// Compile compute shader
-	GLuint createComputeShaderProgram(const char* src) {
+	static GLuint createComputeShaderProgram(const char* src) {
 		GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
 		glShaderSource(computeShader, 1, &src, nullptr);
 		glCompileShader(computeShader);
@@ -3721,62 +6841,201 @@ public:
 		return program;
 	}
 
-	// Process collisions using compute shader
-	std::vector<CollisionPoint> detectCollisions(GLuint obstacleTexture) {
+	// Queue a detection pass on the GPU and return right away
+	// covered_time is the simulation time the pass stands for, it comes back with the results
+	// Returns false if every slot is still waiting on the GPU
+	bool dispatchCollisions(GLuint obstacleTexture, float covered_time) {
+		ResultSlot& slot = m_slots[m_nextSlot];
+
+		if (slot.fence)
+			return false;
+
+		// A slot that was in flight when the buffer grew catches up here
+		if (slot.capacity < m_maxCollisionPoints)
+			allocateSlot(slot);
+
+		slot.precision = m_precision;
+		slot.covered_time = covered_time;
+		slot.obstacleTexture = obstacleTexture;
+		runPass(slot);
+
+		// Fence so we know when it is safe to read
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		m_nextSlot = (m_nextSlot + 1) % NUM_SLOTS;
+		return true;
+	}
+
+	// Pick up the oldest finished pass, without ever waiting on the GPU
+	// Returns false if nothing has finished yet
+	bool collectCollisions(std::vector<CollisionPoint>& result, float& covered_time) {
+		ResultSlot& slot = m_slots[m_readSlot];
+
+		if (!slot.fence)
+			return false;
+
+		GLenum status = glClientWaitSync(slot.fence, 0, 0);
+
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return false;
+
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+		m_readSlot = (m_readSlot + 1) % NUM_SLOTS;
+
+		result.clear();
+		covered_time = slot.covered_time;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.ssbo);
+
+		// Read back the number of collision points
+		int collisionCount;
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(int), &collisionCount);
+
+		// Too many hits for the buffer: grow it and run the pass again right away, waiting on it this once
+		// The obstacles have moved on a step or two by now, the rerun sees them where they are
+		while (slot.precision == PER_PIXEL && collisionCount > slot.capacity) {
+			growPoints(collisionCount);
+			allocateSlot(slot);
+			runPass(slot);
+
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.ssbo);
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(int), &collisionCount);
+		}
+
+		if (slot.precision == PER_TILE)
+			readTiles(collisionCount, result);
+		else
+			readPoints(collisionCount, result);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		return true;
+	}
+
+private:
+	static const int NUM_SLOTS = 3;
+
+	// One in-flight detection pass
+	struct ResultSlot {
+		GLuint ssbo = 0;
+		GLsync fence = 0;
+		Precision precision = PER_PIXEL;
+		float covered_time = 0;
+		GLuint obstacleTexture = 0;
+		int capacity = 0; // Points the buffer holds, behind m_maxCollisionPoints until it's reallocated
+	};
+
+	// Sizes a slot for either precision at the current point capacity:
+	// counter (first int) + array of collision points or tiles
+	void allocateSlot(ResultSlot& slot) {
+		GLsizeiptr slotSize = sizeof(int) + std::max(
+			GLsizeiptr(m_maxCollisionPoints) * GLsizeiptr(sizeof(GPUCollisionPoint)),
+			GLsizeiptr(m_maxCollisionTiles) * GLsizeiptr(sizeof(GPUCollisionTile)));
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, slotSize, nullptr, GL_DYNAMIC_COPY);
+		slot.capacity = m_maxCollisionPoints;
+	}
+
+	// Every texel appends at most one point, so at the texel count a pass can't overflow
+	void growPoints(int collisionCount) {
+		const int texels = m_width * m_height;
+		m_maxCollisionPoints = std::min(texels, std::max(m_maxCollisionPoints * 2, collisionCount + collisionCount / 2));
+
+		frameAllocations.allowAllocations(); // Readback scratch at the new size
+		m_gpuPoints.reserve(m_maxCollisionPoints);
+
+		LOG_WARN("Collision buffer overflow: ", collisionCount, " points, grown to ", m_maxCollisionPoints, " and the pass run again");
+	}
+
+	// Records the slot's detection pass, in its precision, into its buffer
+	void runPass(ResultSlot& slot) {
+		GLuint program = (slot.precision == PER_TILE) ? m_tileComputeProgram : m_computeProgram;
+
 		// Reset collision counter
 		int zero = 0;
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssbo);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.ssbo);
 		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(int), &zero);
 
 		// Bind SSBO to the compute shader
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_ssbo);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, slot.ssbo);
 
-		// Use compute shader
-		glUseProgram(m_computeProgram);
+		glUseProgram(program);
 
 		// Bind obstacle texture
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, obstacleTexture);
-		glUniform1i(glGetUniformLocation(m_computeProgram, "obstacleTexture"), 0);
-		glUniform1i(glGetUniformLocation(m_computeProgram, "maxCollisionPoints"), m_maxCollisionPoints);
+		glBindTexture(GL_TEXTURE_2D, slot.obstacleTexture);
+		glUniform1i(glGetUniformLocation(program, "obstacleTexture"), 0);
+
+		if (slot.precision == PER_PIXEL)
+			glUniform1i(glGetUniformLocation(program, "maxCollisionPoints"), slot.capacity);
 
 		// Dispatch compute shader
 		int groupSizeX = (m_width + 15) / 16;
 		int groupSizeY = (m_height + 15) / 16;
 		glDispatchCompute(groupSizeX, groupSizeY, 1);
 
-		// Wait for compute shader to finish
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
-		// Read back the number of collision points
-		int collisionCount;
-		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(int), &collisionCount);
+		// Make the writes visible to the readback
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	}
 
-		// Clamp to maximum
+	void readPoints(int collisionCount, std::vector<CollisionPoint>& result) {
+		// Can't go over after the rerun in collectCollisions, clamped all the same
 		collisionCount = std::min(collisionCount, m_maxCollisionPoints);
 
-		if (collisionCount > 0) {
-			// Read back the collision points
-			std::vector<GPUCollisionPoint> gpuPoints(collisionCount);
-			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER,
-				sizeof(int), // Skip the counter
-				collisionCount * sizeof(GPUCollisionPoint),
-				gpuPoints.data());
-
-			// Convert to the game's CollisionPoint format
-			std::vector<CollisionPoint> result;
-			result.reserve(collisionCount);
-			for (const auto& gpuPoint : gpuPoints) {
-				result.push_back(CollisionPoint(gpuPoint.x, gpuPoint.y, gpuPoint.r, gpuPoint.b));
-			}
+		if (collisionCount <= 0)
+			return;
 
-			return result;
+		m_gpuPoints.resize(collisionCount);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER,
+			sizeof(int), // Skip the counter
+			collisionCount * sizeof(GPUCollisionPoint),
+			m_gpuPoints.data());
+
+		// Convert to the game's CollisionPoint format, in window pixels
+		// Below full resolution each texel stands for several pixels, and is weighed like them
+		const float toWindowX = WIDTH / float(m_width);
+		const float toWindowY = HEIGHT / float(m_height);
+		const int texelWeight = std::max(1, int(toWindowX * toWindowY + 0.5f));
+
+		result.reserve(collisionCount);
+		for (const auto& gpuPoint : m_gpuPoints) {
+			result.push_back(CollisionPoint(int(gpuPoint.x * toWindowX), int(gpuPoint.y * toWindowY), gpuPoint.r, gpuPoint.b, texelWeight));
 		}
+	}
+
+	void readTiles(int tileCount, std::vector<CollisionPoint>& result) {
+		tileCount = std::min(tileCount, m_maxCollisionTiles);
 
-		return std::vector<CollisionPoint>();
+		if (tileCount <= 0)
+			return;
+
+		m_gpuTiles.resize(tileCount);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER,
+			sizeof(int),
+			tileCount * sizeof(GPUCollisionTile),
+			m_gpuTiles.data());
+
+		// Each tile becomes one point at its centroid carrying the average values,
+		// and count lets the damage code weigh it like the pixels it replaces
+		const float toWindowX = WIDTH / float(m_width);
+		const float toWindowY = HEIGHT / float(m_height);
+
+		result.reserve(tileCount);
+		for (const auto& tile : m_gpuTiles) {
+			if (tile.count <= 0)
+				continue;
+
+			result.push_back(CollisionPoint(
+				int(tile.centroidX * toWindowX + 0.5f), int(tile.centroidY * toWindowY + 0.5f),
+				tile.sumR / tile.count, tile.sumB / tile.count,
+				std::max(1, int(tile.count * toWindowX * toWindowY + 0.5f))));
+		}
 	}
 
-private:
 	// Compute shader source code
 	static constexpr const char* computeShaderSource = R"(
 #version 430 core
@@ -3835,36 +7094,247 @@ void main() {
 }
     )";
 
+	// Tile-compacted version: every workgroup sums its hits with a shared memory
+	// tree reduction, then one invocation appends a single record for the whole tile
+	static constexpr const char* tileComputeShaderSource = R"(
+#version 430 core
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(binding = 0) uniform sampler2D obstacleTexture;
+
+struct CollisionTile {
+    int count;
+    float sumR;
+    float sumB;
+    float centroidX;
+    float centroidY;
+};
+
+layout(std430, binding = 0) buffer CollisionTileBuffer {
+    int count;
+    CollisionTile tiles[];
+} tileBuffer;
+
+const uint TILE_PIXELS = 256u;
+
+shared float sharedCount[TILE_PIXELS];
+shared float sharedR[TILE_PIXELS];
+shared float sharedB[TILE_PIXELS];
+shared float sharedX[TILE_PIXELS];
+shared float sharedY[TILE_PIXELS];
+
+void main() {
+    ivec2 texCoord = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 texSize = textureSize(obstacleTexture, 0);
+    uint lid = gl_LocalInvocationIndex;
+
+    // No early return here, every invocation has to reach the barriers
+    float hit = 0.0;
+    float r = 0.0;
+    float b = 0.0;
+
+    if(texCoord.x < texSize.x && texCoord.y < texSize.y) {
+        vec3 obstacleData = texelFetch(obstacleTexture, texCoord, 0).rgb;
+
+        if(obstacleData.r > 0.0 && (obstacleData.g > 0.0 || obstacleData.b > 0.0)) {
+            hit = 1.0;
+            r = obstacleData.g;
+            b = obstacleData.b;
+        }
+    }
+
+    sharedCount[lid] = hit;
+    sharedR[lid] = r;
+    sharedB[lid] = b;
+    sharedX[lid] = hit * float(texCoord.x);
+    sharedY[lid] = hit * float(texCoord.y);
+
+    barrier();
+
+    for(uint stride = TILE_PIXELS / 2u; stride > 0u; stride >>= 1u) {
+        if(lid < stride) {
+            sharedCount[lid] += sharedCount[lid + stride];
+            sharedR[lid] += sharedR[lid + stride];
+            sharedB[lid] += sharedB[lid + stride];
+            sharedX[lid] += sharedX[lid + stride];
+            sharedY[lid] += sharedY[lid + stride];
+        }
+
+        barrier();
+    }
+
+    // One global atomic per tile, and only for tiles that actually hit something
+    if(lid == 0u && sharedCount[0] > 0.0) {
+        int index = atomicAdd(tileBuffer.count, 1);
+
+        tileBuffer.tiles[index].count = int(sharedCount[0]);
+        tileBuffer.tiles[index].sumR = sharedR[0];
+        tileBuffer.tiles[index].sumB = sharedB[0];
+        tileBuffer.tiles[index].centroidX = sharedX[0] / sharedCount[0];
+        tileBuffer.tiles[index].centroidY = sharedY[0] / sharedCount[0];
+    }
+}
+    )";
+
 	int m_width;
 	int m_height;
 	int m_maxCollisionPoints;
+	int m_maxCollisionTiles;
+	Precision m_precision;
 	GLuint m_computeProgram;
-	GLuint m_ssbo;
+	GLuint m_tileComputeProgram;
+
+	// Ring of result buffers, so the CPU reads a pass the GPU finished earlier
+	// instead of stalling on the one it just queued
+	ResultSlot m_slots[NUM_SLOTS];
+	int m_nextSlot = 0;
+	int m_readSlot = 0;
+
+	// Readback scratch, kept around so steady state does not allocate
+	std::vector<GPUCollisionPoint> m_gpuPoints;
+	std::vector<GPUCollisionTile> m_gpuTiles;
 };
 
 // Global instance of our collision detector
 GPUCollisionDetector* gpuCollisionDetector = nullptr;
 
+// Per-pixel by default, damage needs the real hit pixels; toggled with 'p'
+GPUCollisionDetector::Precision collisionPrecision = GPUCollisionDetector::PER_PIXEL;
+
+
+
+
+
+// Decides on which simulation steps the collision pipeline gets to run
+// The cost of a run (readback, damage, blackening, dispatch) is measured, and when the average
+// goes over budget the scheduler backs off to every 2nd, 3rd, ... step, then creeps back when it can
+class CollisionScheduler {
+public:
+	float budget_ms = 2.0f;
+	int max_interval = 8;
+
+	// Simulation time since the last dispatch, handed to the damage code with the results
+	float accumulated_time = 0;
+
+	bool shouldRun(float dt) {
+		accumulated_time += dt;
+		steps_since_run++;
+
+		if (steps_since_run < interval) {
+			skipped_for_budget++;
+			return false;
+		}
+
+		return true;
+	}
+
+	void ran() {
+		accumulated_time = 0;
+		steps_since_run = 0;
+	}
+
+	// Every slot still in flight, so this step's pass has to wait for the next one
+	void gpuBusy() {
+		skipped_for_gpu++;
+	}
+
+	void recordCost(float ms) {
+		average_ms = average_ms * 0.9f + ms * 0.1f;
+
+		if (average_ms > budget_ms && interval < max_interval)
+			interval++;
+		else if (average_ms < budget_ms * 0.5f && interval > 1)
+			interval--;
+	}
+
+	// Prints at most once a second, and only if something was skipped
+	void report() {
+		if (GLOBAL_TIME - last_report_time < 1.0f)
+			return;
+
+		if (skipped_for_budget > 0 || skipped_for_gpu > 0) {
+			LOG_INFO("Collision scheduler skipped ", skipped_for_budget, " steps over budget and ",
+				skipped_for_gpu, " waiting on the GPU (avg ", average_ms, " ms, budget ",
+				budget_ms, " ms, running every ", interval, " steps)");
+		}
+
+		skipped_for_budget = 0;
+		skipped_for_gpu = 0;
+		last_report_time = GLOBAL_TIME;
+	}
+
+private:
+	int interval = 1;
+	int steps_since_run = 0;
+	float average_ms = 0;
+	int skipped_for_budget = 0;
+	int skipped_for_gpu = 0;
+	float last_report_time = 0;
+};
 
+CollisionScheduler collisionScheduler;
 
 
 
-void generateFluidStampCollisionsDamage() {
+void generateFluidStampCollisionsDamage(float covered_time);
+
+// Runs every simulation step: applies whatever detection passes the GPU has finished,
+// then queues a new one if the scheduler has room for it
+void runCollisionPipeline() {
 	// Initialize the GPU collision detector if it doesn't exist yet
 	if (!gpuCollisionDetector) {
-		gpuCollisionDetector = new GPUCollisionDetector(WIDTH, HEIGHT);
+		frameAllocations.allowAllocations(); // Also after a resolution change
+		gpuCollisionDetector = new GPUCollisionDetector(SIM_WIDTH, SIM_HEIGHT, collisionPrecision);
+		collisionPoints.reserve(gpuCollisionDetector->maxResults());
+	}
+
+	gpuCollisionDetector->setPrecision(collisionPrecision);
+
+	if (!collisionScheduler.shouldRun(DT)) {
+		collisionScheduler.report();
+		return;
+	}
+
+	std::chrono::high_resolution_clock::time_point start_time = std::chrono::high_resolution_clock::now();
+
+	float covered_time = 0;
+
+	while (gpuCollisionDetector->collectCollisions(collisionPoints, covered_time)) {
+		generateFluidStampCollisionsDamage(covered_time);
+		processCollectedBlackeningPoints();
 	}
 
-	// Clear previous collision points
-	collisionPoints.clear();
+	if (gpuCollisionDetector->dispatchCollisions(obstacleTexture, collisionScheduler.accumulated_time))
+		collisionScheduler.ran();
+	else
+		collisionScheduler.gpuBusy();
+
+	std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start_time;
 
-	// Use GPU to detect collisions
-	collisionPoints = gpuCollisionDetector->detectCollisions(obstacleTexture);
+	collisionScheduler.recordCost(elapsed.count());
+	collisionScheduler.report();
+}
+
+
+
+// The fixed cadence this replaced took damage * DT every size_t(FPS / 10) steps; these are that run's
+// health per colliding pixel and how many runs it made a second, DT is still the nominal 1 / FPS here
+const float HIT_DAMAGE_PER_RUN = DT;
+const float HIT_DAMAGE_SCALE = 1.0f / (size_t(FPS / 10.0) * DT);
 
+// Damage is scaled by covered_time, the simulation time the detection pass stands for
+// The results are read back 1 or 2 steps after they were sampled (more when the scheduler backs off),
+// and are tested against the stamps where they are now, so a fast stamp can be hit a little behind itself
+void generateFluidStampCollisionsDamage(float covered_time) {
 	if (collisionPoints.empty())
 		return;
 
-	auto generateFluidCollisionsForStamps = [&](std::vector<Stamp>& stamps, const std::string& type) {
+	auto generateFluidCollisionsForStamps = [&](auto& stamps, StampKind kind) {
+		auto& transforms = stamps.template column<Transform>();
+		auto& lifetimes = stamps.template column<Lifetime>();
+		auto& healths = stamps.template column<Health>();
+		auto& sprites = stamps.template column<Sprite>();
+
 		int stampHitCount = 0;
 
 		for (size_t i = 0; i < stamps.size(); i++)
@@ -3872,14 +7342,14 @@ void generateFluidStampCollisionsDamage() {
 			const float aspect = WIDTH / float(HEIGHT);
 
 			// Calculate adjusted Y coordinate that accounts for aspect ratio
-			const float adjustedPosY = (stamps[i].posY - 0.5f) * aspect + 0.5f;
+			const float adjustedPosY = (transforms[i].posY - 0.5f) * aspect + 0.5f;
 
-			const float stamp_width_in_normalized_units = stamps[i].width / float(WIDTH);
-			const float stamp_height_in_normalized_units = stamps[i].height / float(HEIGHT);
+			const float stamp_width_in_normalized_units = sprites[i].width / float(WIDTH);
+			const float stamp_height_in_normalized_units = sprites[i].height / float(HEIGHT);
 
 			// Skip offscreen stamps
-			if (stamps[i].posX < -stamp_width_in_normalized_units / 2.0f ||
-				stamps[i].posX > 1.0f + stamp_width_in_normalized_units / 2.0f ||
+			if (transforms[i].posX < -stamp_width_in_normalized_units / 2.0f ||
+				transforms[i].posX > 1.0f + stamp_width_in_normalized_units / 2.0f ||
 				adjustedPosY < -stamp_height_in_normalized_units / 2.0f ||
 				adjustedPosY > 1.0f + stamp_height_in_normalized_units / 2.0f)
 			{
@@ -3887,7 +7357,11 @@ void generateFluidStampCollisionsDamage() {
 			}
 
 
-			stamps[i].under_fire = false;
+			healths[i].under_fire = false;
+
+			// Culled stamps can't be hit
+			if (lifetimes[i].to_be_culled)
+				continue;
 
 			int stampCollisions = 0;
 			float red_count = 0;
@@ -3896,12 +7370,12 @@ void generateFluidStampCollisionsDamage() {
 			// Test each collision point against this stamp
 			for (const auto& point : collisionPoints) {
 				// Perform the actual collision check
-				bool collides = isCollisionInStamp(point, stamps[i], i, type);
+				bool collides = isCollisionInStamp(point, transforms[i], sprites[i], i, kind);
 
 				if (collides) {
-					stampCollisions++;
-					red_count += point.r;
-					blue_count += point.b;
+					stampCollisions += point.count;
+					red_count += point.r * point.count;
+					blue_count += point.b * point.count;
 				}
 			}
 
@@ -3912,7 +7386,7 @@ void generateFluidStampCollisionsDamage() {
 
 				float damage = 0.0f;
 
-				if (type == "Ally Ship") {
+				if (kind == ALLY_STAMP) {
 					damage = blue_count;
 				}
 				else
@@ -3922,20 +7396,21 @@ void generateFluidStampCollisionsDamage() {
 
 				// This is matter of personal taste
 				if (damage > 1)
-					stamps[i].under_fire = true;
+					healths[i].under_fire = true;
 
 				static float last_did_damage_at = GLOBAL_TIME;
 
-				stamps[i].health -= damage * DT;
-				//cout << stamps[i].health << endl;
+				healths[i].health -= damage * HIT_DAMAGE_PER_RUN * HIT_DAMAGE_SCALE * covered_time;
+				//cout << healths[i].health << endl;
 
 				last_did_damage_at = GLOBAL_TIME;
 			}
 		}
 		};
 
-	generateFluidCollisionsForStamps(allyShips, "Ally Ship");
-	generateFluidCollisionsForStamps(enemyShips, "Enemy Ship");
+	generateFluidCollisionsForStamps(allyShips, ALLY_STAMP);
+	generateFluidCollisionsForStamps(enemyShips, ENEMY_STAMP);
+	generateFluidCollisionsForStamps(foregroundChunks, FOREGROUND_STAMP);
 }
 
 
@@ -4036,7 +7511,7 @@ void diffuseVelocity() {
 	// Set uniforms
 	glUniform1i(glGetUniformLocation(diffuseVelocityProgram, "velocityTexture"), 0);
 	glUniform1i(glGetUniformLocation(diffuseVelocityProgram, "obstacleTexture"), 1);
-	glUniform2f(glGetUniformLocation(diffuseVelocityProgram, "texelSize"), 1.0f / WIDTH, 1.0f / HEIGHT);
+	glUniform2f(glGetUniformLocation(diffuseVelocityProgram, "texelSize"), 1.0f / SIM_WIDTH, 1.0f / SIM_HEIGHT);
 	glUniform1f(glGetUniformLocation(diffuseVelocityProgram, "viscosity"), VISCOSITY);
 	glUniform1f(glGetUniformLocation(diffuseVelocityProgram, "dt"), DT);
 
@@ -4068,7 +7543,7 @@ void diffuseColor() {
 	// Set uniforms
 	glUniform1i(glGetUniformLocation(diffuseColorProgram, "colorTexture"), 0);
 	glUniform1i(glGetUniformLocation(diffuseColorProgram, "obstacleTexture"), 1);
-	glUniform2f(glGetUniformLocation(diffuseColorProgram, "texelSize"), 1.0f / WIDTH, 1.0f / HEIGHT);
+	glUniform2f(glGetUniformLocation(diffuseColorProgram, "texelSize"), 1.0f / SIM_WIDTH, 1.0f / SIM_HEIGHT);
 	glUniform1f(glGetUniformLocation(diffuseColorProgram, "diffusionRate"), DIFFUSION);
 	glUniform1f(glGetUniformLocation(diffuseColorProgram, "dt"), DT);
 
@@ -4100,7 +7575,7 @@ void diffuseFriendlyColor() {
 	// Set uniforms
 	glUniform1i(glGetUniformLocation(diffuseColorProgram, "colorTexture"), 0);
 	glUniform1i(glGetUniformLocation(diffuseColorProgram, "obstacleTexture"), 1);
-	glUniform2f(glGetUniformLocation(diffuseColorProgram, "texelSize"), 1.0f / WIDTH, 1.0f / HEIGHT);
+	glUniform2f(glGetUniformLocation(diffuseColorProgram, "texelSize"), 1.0f / SIM_WIDTH, 1.0f / SIM_HEIGHT);
 	glUniform1f(glGetUniformLocation(diffuseColorProgram, "diffusionRate"), DIFFUSION);
 	glUniform1f(glGetUniformLocation(diffuseColorProgram, "dt"), DT);
 
@@ -4203,6 +7678,54 @@ GLuint createTexture(GLint internalFormat, GLenum format, bool filtering, int wi
 	return texture;
 }
 
+// Scratch targets, textures a pass writes from scratch every step, kept by size and format
+// The resolution governor steps back and forth between a few sizes, so a resize mostly
+// gets its scratch targets back from here instead of allocating new ones
+class ScratchTexturePool {
+public:
+	GLuint acquire(GLint internalFormat, GLenum format, bool filtering, int width, int height) {
+		std::vector<GLuint>& free_list = m_free[Key(width, height, internalFormat, filtering)];
+
+		if (free_list.empty())
+			return createTexture(internalFormat, format, filtering, width, height);
+
+		GLuint texture = free_list.back();
+		free_list.pop_back();
+		return texture;
+	}
+
+	void release(GLuint texture, GLint internalFormat, bool filtering, int width, int height) {
+		if (texture != 0)
+			m_free[Key(width, height, internalFormat, filtering)].push_back(texture);
+	}
+
+	// Only one spare size is worth keeping, the one just stepped away from
+	void trim(int width, int height) {
+		for (auto it = m_free.begin(); it != m_free.end();) {
+			if (std::get<0>(it->first) == width && std::get<1>(it->first) == height) {
+				++it;
+				continue;
+			}
+
+			if (!it->second.empty())
+				glDeleteTextures(GLsizei(it->second.size()), it->second.data());
+
+			it = m_free.erase(it);
+		}
+	}
+
+	void cleanup() {
+		trim(0, 0);
+	}
+
+private:
+	typedef std::tuple<int, int, GLint, bool> Key;
+
+	std::map<Key, std::vector<GLuint>> m_free;
+};
+
+ScratchTexturePool scratchTexturePool;
+
 
 
 void initGPUImageProcessing() {
@@ -4211,35 +7734,539 @@ void initGPUImageProcessing() {
 
 
 
-	multiTargetBlackeningProgram = createShaderProgram(vertexShaderSource, multiTargetBlackeningFragmentShader);
 
 
 	// Create framebuffer for processing
 	glGenFramebuffers(1, &processingFBO);
+}
+
+
+
+// Compute shader alternative to BulletParticles, toggled with 'g'
+// Bullet state never leaves the GPU: spawns are uploaded, then every step one pass moves the bullets,
+// kills the ones that hit an obstacle of the other side, appends the survivors and forks to the other
+// buffer, and the dye splats are drawn straight from that buffer with an indirect instanced draw
+// The CPU only reads back a handful of counters, a few frames late
+class GPUBulletSystem {
+public:
+	static const GLuint CAPACITY = 1 << 18;
+
+	// std430 layout of one bullet, shared by every bullet shader
+	struct GPUBullet {
+		float posX, posY, velX, velY;
+		float birth_time, death_time, sinusoidal_frequency, sinusoidal_amplitude; // Amplitude is negative when shifted
+		float path_randomization, random_forking, colour_radius, scroll;
+		GLuint faction, seed, pad0, pad1;
+	};
+
+	// Mirrors the BulletControl block, the indirect dispatch and draw arguments live in it too
+	struct Control {
+		GLuint liveCount;
+		GLuint appendCount;
+		GLuint dispatchArgs[3];
+		GLuint drawArgs[4];
+		GLuint hits;     // Running totals from here on
+		GLuint forks;
+		GLuint expired;
+		GLuint dropped;
+	};
+
+	~GPUBulletSystem() {
+		if (!m_initialized)
+			return;
+
+		glDeleteProgram(m_spawnProgram);
+		glDeleteProgram(m_prepareProgram);
+		glDeleteProgram(m_integrateProgram);
+		glDeleteProgram(m_finishProgram);
+		glDeleteProgram(m_splatProgram);
+		glDeleteBuffers(2, m_stateSSBO);
+		glDeleteBuffers(1, &m_spawnSSBO);
+		glDeleteBuffers(1, &m_controlSSBO);
+		glDeleteBuffers(1, &m_readbackBuffer);
+
+		if (m_readbackFence)
+			glDeleteSync(m_readbackFence);
+	}
+
+	static const size_t MAX_PENDING = 16384; // Spawns queued between two steps, the rest are dropped
+
+	GPUBulletSystem() {
+		m_pending.reserve(MAX_PENDING);
+	}
+
+	// Queued until the next step(), safe to call before there's a GL context
+	void spawn(const BulletSpawn& s) {
+		if (m_pending.size() >= MAX_PENDING) {
+			m_spawnsDropped++;
+			return;
+		}
+
+		GPUBullet b;
+		b.posX = s.posX;
+		b.posY = s.posY;
+		b.velX = s.velX;
+		b.velY = s.velY;
+		b.birth_time = s.birth_time;
+		b.death_time = s.death_time;
+		b.sinusoidal_frequency = s.sinusoidal_frequency;
+		b.sinusoidal_amplitude = s.sinusoidal_shift ? -s.sinusoidal_amplitude : s.sinusoidal_amplitude;
+		b.path_randomization = s.path_randomization;
+		b.random_forking = s.random_forking;
+		b.colour_radius = s.colour_radius;
+		b.scroll = s.is_dying_bullet ? 1.0f : 0.0f;
+		b.faction = s.faction;
+		// Each bullet's shader hash starts from the bullet stream, so GPU runs follow the level seed too
+		b.seed = bulletRng.next();
+		b.pad0 = b.pad1 = 0;
+		m_pending.push_back(b);
+	}
+
+	// Move, collide, fork and cull, then splat into the colour textures
+	// The obstacle texture is whatever the last reapplyAllStamps left in it, the same as the CPU path sees
+	void step(GLuint obstacleTexture) {
+		collectCounts();
+
+		// Nothing alive, nothing queued, nothing in flight
+		if (m_pending.empty() && m_stats.liveCount == 0 && !m_readbackFence && !m_spawnedSinceReadback)
+			return;
+
+		if (!m_initialized)
+			init();
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_stateSSBO[m_source]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_controlSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_stateSSBO[1 - m_source]);
+
+		if (!m_pending.empty()) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_spawnSSBO);
+
+			if (m_pending.size() > m_spawnCapacity) {
+				m_spawnCapacity = m_pending.size() * 2;
+				glBufferData(GL_SHADER_STORAGE_BUFFER, m_spawnCapacity * sizeof(GPUBullet), nullptr, GL_DYNAMIC_DRAW);
+			}
+
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, m_pending.size() * sizeof(GPUBullet), m_pending.data());
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_spawnSSBO);
+
+			glUseProgram(m_spawnProgram);
+			glUniform1ui(glGetUniformLocation(m_spawnProgram, "spawnCount"), GLuint(m_pending.size()));
+			glUniform1ui(glGetUniformLocation(m_spawnProgram, "capacity"), CAPACITY);
+			glDispatchCompute(GLuint((m_pending.size() + 63) / 64), 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+			m_pending.clear();
+			m_spawnedSinceReadback = true;
+		}
+
+		// Clamp the count and write the indirect dispatch arguments
+		glUseProgram(m_prepareProgram);
+		glUniform1ui(glGetUniformLocation(m_prepareProgram, "capacity"), CAPACITY);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+		glUseProgram(m_integrateProgram);
+		glUniform1i(glGetUniformLocation(m_integrateProgram, "obstacleTexture"), 0);
+		glUniform1f(glGetUniformLocation(m_integrateProgram, "time"), GLOBAL_TIME);
+		glUniform1f(glGetUniformLocation(m_integrateProgram, "dt"), DT);
+		glUniform1f(glGetUniformLocation(m_integrateProgram, "aspect"), HEIGHT / float(WIDTH));
+		glUniform1f(glGetUniformLocation(m_integrateProgram, "screenAspect"), WIDTH / float(HEIGHT));
+		glUniform1f(glGetUniformLocation(m_integrateProgram, "scrollDT"), foreground_vel * DT);
+		glUniform1ui(glGetUniformLocation(m_integrateProgram, "capacity"), CAPACITY);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, obstacleTexture);
+
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_controlSSBO);
+		glDispatchComputeIndirect(offsetof(Control, dispatchArgs));
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		// The appended count becomes the live count and the instance count of the splat draw
+		glUseProgram(m_finishProgram);
+		glUniform1ui(glGetUniformLocation(m_finishProgram, "capacity"), CAPACITY);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		m_source = 1 - m_source;
+
+		splat();
+
+		// Read the counters back once the GPU gets there, never wait for it
+		if (!m_readbackFence) {
+			glBindBuffer(GL_COPY_READ_BUFFER, m_controlSSBO);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, m_readbackBuffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(Control));
+			m_readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			m_spawnedSinceReadback = false;
+		}
+
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
 
-	// Create temporary textures for processing
-	glGenTextures(1, &tempTexture1);
-	glGenTextures(1, &tempTexture2);
+	// Bullets alive as of the last counters that came back
+	GLuint liveCount() const {
+		return m_stats.liveCount;
+	}
+
+	void report() const {
+		std::cout << "GPU bullets: " << m_stats.liveCount << " live, " << m_stats.hits << " hits, "
+			<< m_stats.forks << " forks, " << m_stats.expired << " expired, "
+			<< m_stats.dropped << " dropped for capacity, " << m_spawnsDropped << " spawns dropped for the queue (totals)" << std::endl;
+	}
+
+private:
+	void init() {
+		m_spawnProgram = GPUCollisionDetector::createComputeShaderProgram(withCommon(spawnComputeShaderSource).c_str());
+		m_prepareProgram = GPUCollisionDetector::createComputeShaderProgram(withCommon(prepareComputeShaderSource).c_str());
+		m_integrateProgram = GPUCollisionDetector::createComputeShaderProgram(withCommon(integrateComputeShaderSource).c_str());
+		m_finishProgram = GPUCollisionDetector::createComputeShaderProgram(withCommon(finishComputeShaderSource).c_str());
+		m_splatProgram = createShaderProgram(withCommon(splatVertexShaderSource).c_str(), splatFragmentShaderSource);
+
+		glGenBuffers(2, m_stateSSBO);
+		for (GLuint buffer : m_stateSSBO) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(CAPACITY) * sizeof(GPUBullet), nullptr, GL_DYNAMIC_COPY);
+		}
+
+		glGenBuffers(1, &m_spawnSSBO);
+
+		Control control = {};
+		control.dispatchArgs[1] = control.dispatchArgs[2] = 1;
+		control.drawArgs[0] = 4;
+
+		glGenBuffers(1, &m_controlSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_controlSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Control), &control, GL_DYNAMIC_COPY);
+
+		glGenBuffers(1, &m_readbackBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_readbackBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(Control), nullptr, GL_STREAM_READ);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		m_initialized = true;
+	}
+
+	void collectCounts() {
+		if (!m_readbackFence)
+			return;
+
+		GLenum waitResult = glClientWaitSync(m_readbackFence, 0, 0);
+
+		if (waitResult != GL_ALREADY_SIGNALED && waitResult != GL_CONDITION_SATISFIED)
+			return;
+
+		glDeleteSync(m_readbackFence);
+		m_readbackFence = 0;
+
+		glBindBuffer(GL_COPY_READ_BUFFER, m_readbackBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(Control), &m_stats);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	// Additive quads into the same textures addColor writes, ally bullets are red and enemy bullets blue
+	void splat() {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glUseProgram(m_splatProgram);
+		glBindVertexArray(vao);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_stateSSBO[m_source]);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_controlSSBO);
+
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture[colorIndex], 0);
+		glUniform1ui(glGetUniformLocation(m_splatProgram, "faction"), ALLY_FACTION);
+		glDrawArraysIndirect(GL_TRIANGLE_STRIP, (const void*)offsetof(Control, drawArgs));
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, friendlyColorTexture[friendlyColorIndex], 0);
+		glUniform1ui(glGetUniformLocation(m_splatProgram, "faction"), ENEMY_FACTION);
+		glDrawArraysIndirect(GL_TRIANGLE_STRIP, (const void*)offsetof(Control, drawArgs));
+
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glDisable(GL_BLEND);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// Declarations shared by all of the bullet shaders
+	static constexpr const char* commonShaderSource = R"(
+struct Bullet {
+    vec4 motion;   // position xy, velocity xy
+    vec4 timing;   // birth time, death time, sinusoidal frequency, sinusoidal amplitude (negative when shifted)
+    vec4 shape;    // path randomization, random forking, colour radius, scroll (1 for dying bullets)
+    uvec4 info;    // faction, random seed
+};
+
+layout(std430, binding = 1) buffer BulletControl {
+    uint liveCount;
+    uint appendCount;
+    uint dispatchArgs[3];
+    uint drawArgs[4];
+    uint hits;
+    uint forks;
+    uint expired;
+    uint dropped;
+};
+)";
+
+	static std::string withCommon(const char* source) {
+		return std::string("#version 430 core\n") + commonShaderSource + source;
+	}
+
+	static constexpr const char* spawnComputeShaderSource = R"(
+layout(local_size_x = 64) in;
+
+layout(std430, binding = 0) buffer LiveBullets { Bullet bullets[]; };
+layout(std430, binding = 3) readonly buffer SpawnedBullets { Bullet spawned[]; };
+
+uniform uint spawnCount;
+uniform uint capacity;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= spawnCount)
+        return;
+
+    uint index = atomicAdd(liveCount, 1u);
+
+    if (index < capacity)
+        bullets[index] = spawned[i];
+    else
+        atomicAdd(dropped, 1u);
 }
+)";
 
+	static constexpr const char* prepareComputeShaderSource = R"(
+layout(local_size_x = 1) in;
 
+uniform uint capacity;
 
-void setupProcessingTexture(GLuint textureID, int width, int height) {
+void main() {
+    liveCount = min(liveCount, capacity);
+    appendCount = 0u;
+    dispatchArgs[0] = (liveCount + 255u) / 256u;
+    dispatchArgs[1] = 1u;
+    dispatchArgs[2] = 1u;
+}
+)";
 
-	if (textureID != 0)
-		glDeleteTextures(1, &textureID);
+	// The same motion as BulletParticles::update and move_and_fork_bullets,
+	// and the same death rules as BulletParticles::cull and mark_colliding_bullets
+	static constexpr const char* integrateComputeShaderSource = R"(
+layout(local_size_x = 256) in;
 
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+layout(std430, binding = 0) readonly buffer SourceBullets { Bullet source[]; };
+layout(std430, binding = 2) writeonly buffer DestinationBullets { Bullet destination[]; };
+
+layout(binding = 0) uniform sampler2D obstacleTexture;
+
+uniform float time;
+uniform float dt;
+uniform float aspect;        // HEIGHT / WIDTH
+uniform float screenAspect;  // WIDTH / HEIGHT
+uniform float scrollDT;
+uniform uint capacity;
+
+uint hashBullet(uint h)
+{
+    h = (h ^ (h >> 16)) * 0x7feb352du;
+    h = (h ^ (h >> 15)) * 0x846ca68bu;
+    return h ^ (h >> 16);
+}
+
+float random01(inout uint state)
+{
+    state = hashBullet(state + 0x9e3779b9u);
+    return float(state >> 8) / 16777215.0;
+}
+
+vec2 randomUnitVector(inout uint state)
+{
+    float a = random01(state) * 6.28318531;
+    return vec2(cos(a), sin(a));
+}
+
+// Obstacle R holds what kind of stamp is there: 0.25 ally, 0.5 power up, 0.75 enemy, 1.0 foreground
+// Ally bullets stop on enemies and the foreground, enemy bullets on allies and the foreground
+bool hitsObstacle(vec2 position, uint faction)
+{
+    ivec2 size = textureSize(obstacleTexture, 0);
+    ivec2 texel = ivec2(position * vec2(size));
+
+    if (any(lessThan(texel, ivec2(0))) || any(greaterThanEqual(texel, size)))
+        return false;
+
+    float kind = texelFetch(obstacleTexture, texel, 0).r;
+
+    if (faction == 0u)
+        return kind > 0.6;
+
+    return (kind > 0.1 && kind < 0.4) || kind > 0.9;
+}
+
+void append(Bullet b)
+{
+    uint index = atomicAdd(appendCount, 1u);
+
+    if (index < capacity)
+        destination[index] = b;
+    else
+        atomicAdd(dropped, 1u);
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= liveCount)
+        return;
+
+    Bullet b = source[i];
+    uint state = b.info.y;
+
+    // Forward along the path, then sideways along the perpendicular
+    vec2 dir = vec2(b.motion.z * aspect * dt, b.motion.w * dt);
+    float len = length(dir);
+    vec2 perp = len > 0.0 ? vec2(-dir.y, dir.x) / len : vec2(0.0);
+    float wave = sin((time - b.timing.x) * b.timing.z) * b.timing.w;
+
+    vec2 position = b.motion.xy + dir + perp * wave;
+    position.x += b.shape.w * scrollDT;
+
+    // Random walking, like lightning
+    if (b.shape.x > 0.0)
+        position += randomUnitVector(state) * b.shape.x;
+
+    b.motion.xy = position;
+
+    float adjustedY = (position.y - 0.5) * screenAspect + 0.5;
+
+    if ((b.timing.y >= 0.0 && b.timing.y <= time) ||
+        position.x < 0.0 || position.x > 1.0 || adjustedY < 0.0 || adjustedY > 1.0) {
+        atomicAdd(expired, 1u);
+        return;
+    }
+
+    if (hitsObstacle(position, b.info.x)) {
+        atomicAdd(hits, 1u);
+        return;
+    }
+
+    // Split the lightning
+    if (b.shape.y > 0.0) {
+        float r = random01(state);
+
+        if (r < b.shape.y) {
+            Bullet fork = b;
+            fork.motion.zw += randomUnitVector(state) * r;
+            fork.info.y = hashBullet(state ^ 0x5bd1e995u);
+            append(fork);
+            atomicAdd(forks, 1u);
+        }
+    }
+
+    b.info.y = state;
+    append(b);
+}
+)";
+
+	static constexpr const char* finishComputeShaderSource = R"(
+layout(local_size_x = 1) in;
+
+uniform uint capacity;
+
+void main() {
+    liveCount = min(appendCount, capacity);
+    drawArgs[0] = 4u;
+    drawArgs[1] = liveCount;
+    drawArgs[2] = 0u;
+    drawArgs[3] = 0u;
+}
+)";
+
+	static constexpr const char* splatVertexShaderSource = R"(
+layout(std430, binding = 0) readonly buffer Bullets { Bullet bullets[]; };
+
+uniform uint faction;
+
+out vec2 Offset;   // From the bullet, in texture coordinates
+flat out float Radius;
+
+void main() {
+    Bullet b = bullets[gl_InstanceID];
+    Radius = b.shape.z;
+
+    // The other side's bullets go to the other texture, push them off screen
+    if (b.info.x != faction) {
+        Offset = vec2(0.0);
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0 - 1.0;
+    Offset = corner * Radius;
+    gl_Position = vec4((b.motion.xy + Offset) * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+	// Same falloff as addColorFragmentShader, the blending does the adding
+	static constexpr const char* splatFragmentShaderSource = R"(
+#version 430 core
+
+in vec2 Offset;
+flat in float Radius;
+
+out float FragColor;
+
+void main() {
+    float distance = length(Offset);
+
+    if (distance >= Radius)
+        discard;
+
+    float falloff = 1.0 - (distance / Radius);
+    FragColor = falloff * falloff;
 }
+)";
 
+	bool m_initialized = false;
+	GLuint m_spawnProgram = 0;
+	GLuint m_prepareProgram = 0;
+	GLuint m_integrateProgram = 0;
+	GLuint m_finishProgram = 0;
+	GLuint m_splatProgram = 0;
+
+	// Ping-pong state, m_source holds the live bullets
+	GLuint m_stateSSBO[2] = { 0, 0 };
+	int m_source = 0;
+
+	GLuint m_spawnSSBO = 0;
+	size_t m_spawnCapacity = 0;
+	std::vector<GPUBullet> m_pending;
+	size_t m_spawnsDropped = 0;
+
+	GLuint m_controlSSBO = 0;
+	GLuint m_readbackBuffer = 0;
+	GLsync m_readbackFence = 0;
+	bool m_spawnedSinceReadback = false;
+	Control m_stats = {};
+};
+
+GPUBulletSystem* gpuBullets = nullptr;
 
+// fireBullet and make_dying_bullets go through here, forks stay on whichever side made them
+void emitBullet(const BulletSpawn& s) {
+	if (!gpu_bullets) {
+		bullets.emit(s);
+		return;
+	}
 
+	if (!gpuBullets)
+		gpuBullets = new GPUBulletSystem();
 
+	gpuBullets->spawn(s);
+}
 
 
 
@@ -4256,85 +8283,176 @@ private:
 		glm::vec4 color;
 	};
 
-public:
-
-	std::unordered_map<char, int> charWidths; // Map to store actual widths
+	// A laid out string, its quads are relative to the top left of the text
+	// The slots and their strings are reused in place, so a cache miss doesn't allocate either
+	struct GlyphRun {
+		std::string text;
+		float scale = 0;
+		glm::vec4 color;
+		uint64_t hash = 0;
+		size_t first = 0;      // Into m_runVertices
+		size_t count = 0;      // Vertices, four per character
+		float width = 0;
+		size_t last_used = 0;  // Frame number
+		bool valid = false;
+	};
 
-	// Add this method to calculate character widths
-	void calculateCharacterWidths() {
-		// Read back the font texture data from GPU
-		int dataSize = atlas.atlasWidth * atlas.atlasHeight * 4; // RGBA format
-		std::vector<unsigned char> textureData(dataSize);
+	static const int MAX_RUNS = 64;
+	static const size_t MAX_GLYPHS = 4096;  // Per frame, and in the run cache
 
-		glBindTexture(GL_TEXTURE_2D, atlas.textureID);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, textureData.data());
+	GlyphRun m_cachedRuns[MAX_RUNS];
+	std::vector<Vertex> m_runVertices;  // The cached runs' quads, reset when it fills up
+	std::vector<Vertex> m_frameVertices;  // Everything queued this frame, placed on screen
+	size_t m_frame = 1;
+	size_t m_indexedGlyphs = 0;
 
+	size_t m_hits = 0;
+	size_t m_misses = 0;
+	size_t m_draws = 0;
 
+	static uint64_t runHash(const std::string& text, float scale, const glm::vec4& color) {
+		uint64_t h = 1469598103934665603ull; // FNV-1a
 
+		for (char c : text)
+			h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
 
+		const float params[5] = { scale, color.x, color.y, color.z, color.w };
+		for (float p : params) {
+			uint32_t bits;
+			std::memcpy(&bits, &p, sizeof(bits));
+			h = (h ^ bits) * 1099511628211ull;
+		}
 
-		// Analyze each character
-		for (unsigned short c_ = 0; c_ < 256; c_++)
-		{
-			unsigned char c = static_cast<unsigned char>(c_);
+		return h;
+	}
 
-			// ASCII range
-			int atlasX = (c % atlas.charsPerRow) * atlas.charWidth;
-			int atlasY = (c / atlas.charsPerRow) * atlas.charHeight;
+	// Index buffer for n quads, it never changes so it's only rebuilt when the text outgrows it
+	void reserveGlyphs(size_t glyphs) {
+		if (glyphs <= m_indexedGlyphs)
+			return;
 
-			// Find leftmost non-empty column
-			int leftEdge = atlas.charWidth - 1; // Start from rightmost position
+		m_indexedGlyphs = std::max(glyphs, m_indexedGlyphs * 2);
 
-			// Find rightmost non-empty column
-			int rightEdge = 0; // Start from leftmost position
+		std::vector<GLuint> indices;
+		indices.reserve(m_indexedGlyphs * 6);
+
+		for (GLuint i = 0; i < m_indexedGlyphs; i++) {
+			GLuint first = i * 4;
+			indices.push_back(first + 0);
+			indices.push_back(first + 1);
+			indices.push_back(first + 2);
+			indices.push_back(first + 0);
+			indices.push_back(first + 2);
+			indices.push_back(first + 3);
+		}
 
-			// Scan all columns for this character
-			for (int x = 0; x < atlas.charWidth; x++) {
-				bool columnHasPixels = false;
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		glBindVertexArray(0);
+	}
 
-				// Check if any pixel in this column is non-transparent
-				for (int y = 0; y < atlas.charHeight; y++) {
-					int pixelIndex = ((atlasY + y) * atlas.atlasWidth + (atlasX + x)) * 4;
-					if (pixelIndex >= 0 && pixelIndex < dataSize - 3) {
-						// Check alpha value (using red channel for grayscale font)
-						if (textureData[pixelIndex] > 20) { // Non-transparent threshold
-							columnHasPixels = true;
-							break;
-						}
-					}
-				}
+	// Finds the string in the cache, or lays it out into the least recently used slot
+	const GlyphRun& glyphRun(const std::string& text, float scale, const glm::vec4& color) {
+		const uint64_t hash = runHash(text, scale, color);
+		GlyphRun* oldest = &m_cachedRuns[0];
 
-				if (columnHasPixels) {
-					// Update left edge (minimum value)
-					leftEdge = std::min(leftEdge, x);
-					// Update right edge (maximum value)
-					rightEdge = std::max(rightEdge, x);
-				}
+		for (GlyphRun& run : m_cachedRuns) {
+			if (run.valid && run.hash == hash && run.scale == scale && run.color == color && run.text == text) {
+				run.last_used = m_frame;
+				m_hits++;
+				return run;
 			}
 
-			// If no pixels were found (space or empty character)
-			if (rightEdge < leftEdge) {
-				// Default width for space character
-				if (c == ' ') {
-					charWidths[c] = atlas.charWidth / 3; // Make space 1/3 of cell width
-				}
-				else {
-					charWidths[c] = atlas.charWidth / 4; // Default minimum width
-				}
-			}
-			else {
-				// Calculate width based on the actual character bounds
-				int actualWidth = (rightEdge - leftEdge) + 1;
+			if (!run.valid || (oldest->valid && run.last_used < oldest->last_used))
+				oldest = &run;
+		}
 
-				// Add some padding
-				int paddedWidth = actualWidth + 4; // 2 pixels on each side
+		m_misses++;
 
-				// Store this character's width (minimum width of 1/4 of the cell)
-				charWidths[c] = std::max(paddedWidth, atlas.charWidth / 4);
-			}
+		// Out of room, every run gets laid out again as it's next used
+		if (m_runVertices.size() + text.size() * 4 > m_runVertices.capacity()) {
+			for (GlyphRun& run : m_cachedRuns)
+				run.valid = false;
+
+			m_runVertices.clear();
+			oldest = &m_cachedRuns[0];
+		}
+
+		GlyphRun& run = *oldest;
+		run.text = text;
+		run.scale = scale;
+		run.color = color;
+		run.hash = hash;
+		run.first = m_runVertices.size();
+		run.last_used = m_frame;
+		run.valid = true;
+
+		float xpos = 0;
+
+		for (char c : text) {
+			// Get ASCII value of the character
+			unsigned char charValue = static_cast<unsigned char>(c);
+
+			// Calculate position in the atlas using ASCII value
+			int atlasX = (charValue % atlas.charsPerRow) * atlas.charWidth;
+			int atlasY = (charValue / atlas.charsPerRow) * atlas.charHeight;
+
+			// Calculate texture coordinates
+			float texLeft = atlasX / (float)atlas.atlasWidth;
+			float texRight = (atlasX + atlas.charWidth) / (float)atlas.atlasWidth;
+			float texTop = atlasY / (float)atlas.atlasHeight;
+			float texBottom = (atlasY + atlas.charHeight) / (float)atlas.atlasHeight;
+
+			// Get the character's calculated width
+			float charWidth = static_cast<float>(charWidths[charValue]);
+
+			// Calculate quad vertices
+			float quadLeft = xpos;
+			float quadRight = xpos + atlas.charWidth * scale; // Use full cell width for texture
+			float quadTop = 0;
+			float quadBottom = atlas.charHeight * scale;
+
+			m_runVertices.push_back({ {quadLeft, quadTop, 0.0f}, {texLeft, texTop}, color });
+			m_runVertices.push_back({ {quadRight, quadTop, 0.0f}, {texRight, texTop}, color });
+			m_runVertices.push_back({ {quadRight, quadBottom, 0.0f}, {texRight, texBottom}, color });
+			m_runVertices.push_back({ {quadLeft, quadBottom, 0.0f}, {texLeft, texBottom}, color });
+
+			// Advance cursor using the calculated width
+			// add 8 pixels of padding between characters
+			xpos += (8 + charWidth) * scale;
+		}
+
+		run.count = m_runVertices.size() - run.first;
+		run.width = xpos;
+		return run;
+	}
+
+public:
+
+	std::unordered_map<char, int> charWidths; // Map to store actual widths
+
+	// Add this method to calculate character widths
+	void calculateCharacterWidths() {
+		int widths[256];
+
+		if (const int32_t* packed = assetPack.glyphWidths()) {
+			std::copy(packed, packed + 256, widths);
 		}
+		else {
+			// Read back the font texture data from GPU
+			std::vector<unsigned char> textureData(atlas.atlasWidth * atlas.atlasHeight * 4); // RGBA format
+
+			glBindTexture(GL_TEXTURE_2D, atlas.textureID);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, textureData.data());
+
+			measureGlyphWidths(atlas, textureData.data(), 4, widths);
+		}
+
+		for (int c = 0; c < 256; c++)
+			charWidths[static_cast<char>(c)] = widths[c];
 	}
 
 
@@ -4383,6 +8501,14 @@ public:
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 
+		// The vertex buffer keeps its size, it's orphaned and refilled once per frame
+		glBufferData(GL_ARRAY_BUFFER, MAX_GLYPHS * 4 * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+		glBindVertexArray(0);
+
+		m_runVertices.reserve(MAX_GLYPHS * 4);
+		m_frameVertices.reserve(MAX_GLYPHS * 4);
+		reserveGlyphs(MAX_GLYPHS);
+
 		// Set up projection matrix
 		setProjection(windowWidth, windowHeight);
 
@@ -4402,164 +8528,604 @@ public:
 	}
 
 
+	// Queues the text, everything queued is drawn together by flush()
 	void renderText(const std::string& text, float x, float y, float scale, glm::vec4 color, bool centered = false) {
+		const GlyphRun& run = glyphRun(text, scale, color);
+
+		// If text should be centered, calculate the starting position
+		if (centered)
+			x = WIDTH / 2.0f - run.width / 2.0f;
+
+		if (m_frameVertices.size() + run.count > m_frameVertices.capacity())
+			frameAllocations.allowAllocations(); // More text than ever before
+
+		for (size_t i = run.first; i < run.first + run.count; i++) {
+			Vertex v = m_runVertices[i];
+			v.position.x += x;
+			v.position.y += y;
+			m_frameVertices.push_back(v);
+		}
+	}
+
+	// One draw for all of this frame's text
+	void flush() {
+		m_frame++;
+
+		if (m_frameVertices.empty())
+			return;
+
+		const size_t glyphs = m_frameVertices.size() / 4;
+
+		if (glyphs > m_indexedGlyphs)
+			frameAllocations.allowAllocations();
+
+		reserveGlyphs(glyphs);
+
 		glUseProgram(shaderProgram);
 
 		// Set uniforms
 		GLuint projLoc = glGetUniformLocation(shaderProgram, "projection");
 		glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-		GLuint fontTexLoc = glGetUniformLocation(shaderProgram, "fontTexture");
-		glUniform1i(fontTexLoc, 0);
+		GLuint fontTexLoc = glGetUniformLocation(shaderProgram, "fontTexture");
+		glUniform1i(fontTexLoc, 0);
+
+		GLuint useColorLoc = glGetUniformLocation(shaderProgram, "useColor");
+		glUniform1i(useColorLoc, 0); // Set to 1 if your font atlas is colored
+
+		glm::mat4 model = glm::mat4(1.0f);
+		GLuint modelLoc = glGetUniformLocation(shaderProgram, "model");
+		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, atlas.textureID);
+
+		glBindVertexArray(VAO);
+
+		// Orphan the old storage so the driver doesn't wait for last frame's draw
+		const size_t capacity = std::max(MAX_GLYPHS, m_indexedGlyphs) * 4;
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, m_frameVertices.size() * sizeof(Vertex), m_frameVertices.data());
+
+		// Enable blending for transparent font
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		glDrawElements(GL_TRIANGLES, (GLsizei)(glyphs * 6), GL_UNSIGNED_INT, 0);
+		m_draws++;
+
+		// Reset state
+		glDisable(GL_BLEND);
+		glBindVertexArray(0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		m_frameVertices.clear();
+	}
+
+	void report() {
+		std::cout << "Text: " << m_hits << " cached glyph runs drawn, " << m_misses << " laid out, "
+			<< m_runVertices.size() / 4 << " of " << MAX_GLYPHS << " cached glyphs used, "
+			<< m_draws << " draws over " << m_frame - 1 << " frames" << std::endl;
+	}
+};
+
+
+
+TextRenderer* textRenderer = nullptr;
+
+
+
+// Draws every ship, foreground chunk and power up as a tight instanced quad
+// The instances are rebuilt each frame in draw order, and consecutive instances go out in one call
+// A call only has to be split where the damage mask page changes or a sprite has its own texture
+class SpriteBatch {
+public:
+	struct Instance {
+		float posX, posY;             // Screen texture coordinates, Y already aspect adjusted
+		float width, height;          // Pixels
+		float u, v, du, dv;           // Rect in the atlas layer
+		float damageU, damageV, damageDU, damageDV;
+		float layer;                  // -1 when the sprite is drawn from its own texture
+		float opacity;
+		float under_fire;
+		float has_damage;
+	};
+
+	void init(size_t capacity) {
+		// Unit quad, drawn as a strip
+		const float corners[] = { 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+
+		glGenVertexArrays(1, &m_vao);
+		glGenBuffers(1, &m_quadVBO);
+		glGenBuffers(1, &m_instanceVBO);
+
+		glBindVertexArray(m_vao);
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+		for (GLuint i = 0; i < 4; i++) {
+			glVertexAttribPointer(1 + i, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(i * 4 * sizeof(float)));
+			glVertexAttribDivisor(1 + i, 1);
+			glEnableVertexAttribArray(1 + i);
+		}
+
+		glBindVertexArray(0);
+
+		m_instances.reserve(capacity);
+		m_runs.reserve(capacity);
+		reserveInstanceBuffer(capacity);
+	}
+
+	void begin() {
+		m_instances.clear();
+		m_runs.clear();
+	}
+
+	// Foreground chunks and power ups never flash when they're under fire
+	template<typename Stamps>
+	void add(const Stamps& stamps, bool flash_under_fire) {
+		const auto& transforms = stamps.template column<Transform>();
+		const auto& lifetimes = stamps.template column<Lifetime>();
+		const auto& sprites = stamps.template column<Sprite>();
+
+		const float aspect = WIDTH / float(HEIGHT);
+
+		for (size_t j = 0; j < stamps.size(); j++) {
+			const Transform& transform = transforms[j];
+			const Sprite& stamp = sprites[j];
+
+			// Calculate adjusted Y coordinate that accounts for aspect ratio
+			const float adjustedPosY = (transform.posY - 0.5f) * aspect + 0.5f;
+
+			const float stamp_width_in_normalized_units = stamp.width / float(WIDTH);
+			const float stamp_height_in_normalized_units = stamp.height / float(HEIGHT);
+
+			// Skip anything that's completely off screen
+			if (transform.posX < -stamp_width_in_normalized_units / 2.0f ||
+				transform.posX > 1.0f + stamp_width_in_normalized_units / 2.0f ||
+				adjustedPosY < -stamp_height_in_normalized_units / 2.0f ||
+				adjustedPosY > 1.0f + stamp_height_in_normalized_units / 2.0f)
+			{
+				continue;
+			}
+
+			size_t variationIndex = stamp.currentVariationIndex;
+			if (variationIndex >= stamp.textureIDs().size() || stamp.textureIDs()[variationIndex] == 0) {
+				for (size_t i = 0; i < stamp.textureIDs().size(); i++) {
+					if (stamp.textureIDs()[i] != 0) {
+						variationIndex = i;
+						break;
+					}
+				}
+				if (variationIndex >= stamp.textureIDs().size() || stamp.textureIDs()[variationIndex] == 0) {
+					continue;
+				}
+			}
+
+			Instance instance;
+			Run run;
+			instance.posX = transform.posX;
+			instance.posY = adjustedPosY;
+			instance.width = float(stamp.width);
+			instance.height = float(stamp.height);
+			instance.u = instance.v = instance.du = instance.dv = 0;
+
+			if (variationIndex < stamp.atlasRects().size() && stamp.atlasRects()[variationIndex].valid()) {
+				const AtlasRect& rect = stamp.atlasRects()[variationIndex];
+				SpriteAtlas::uvTransform(rect, instance.u, instance.v, instance.du, instance.dv);
+				instance.width = float(rect.width);
+				instance.height = float(rect.height);
+				instance.layer = float(rect.page);
+				run.texture = 0;
+			}
+			else {
+				instance.layer = -1.0f;
+				run.texture = stamp.textureIDs()[variationIndex];
+			}
+
+			// added in opacity, so that the stamp can fade away over time upon death
+			instance.opacity = lifetimes[j].stamp_opacity;
+
+			bool under_fire = false;
+
+			if constexpr (Stamps::template has<Health>())
+				under_fire = flash_under_fire && stamps.template get<Health>(j).under_fire;
+
+			instance.under_fire = under_fire ? 1.0f : 0.0f;
+
+			// The damage mask is applied here, on top of the untouched template
+			instance.has_damage = stamp.damageMask.valid() ? 1.0f : 0.0f;
+			instance.damageU = instance.damageV = instance.damageDU = instance.damageDV = 0;
+			run.damagePage = -1;
+
+			if (stamp.damageMask.valid()) {
+				stamp.damageMask.uvTransform(instance.damageU, instance.damageV, instance.damageDU, instance.damageDV);
+				run.damagePage = stamp.damageMask.rect().page;
+			}
+
+			// Pixels this quad covers, against a whole screen for the old full-screen pass
+			m_shadedPixels += 0.5625 * instance.width * instance.height;
+			m_fullScreenPixels += double(WIDTH) * HEIGHT;
+
+			m_instances.push_back(instance);
+			m_runs.push_back(run);
+		}
+	}
+
+	void draw() {
+		const size_t count = m_instances.size();
+		m_sprites += count;
+
+		if (count == 0)
+			return;
+
+		// Orphan last frame's buffer rather than wait for the GPU to be done with it
+		reserveInstanceBuffer(std::max(count, m_bufferCapacity));
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(Instance), m_instances.data());
+
+		glUseProgram(stampTextureProgram);
+
+		glUniformMatrix4fv(glGetUniformLocation(stampTextureProgram, "projection"), 1, GL_FALSE, glm::value_ptr(orthoMatrix));
+		glUniform2f(glGetUniformLocation(stampTextureProgram, "screenSize"), (float)WIDTH, (float)HEIGHT);
+		glUniform1f(glGetUniformLocation(stampTextureProgram, "time"), GLOBAL_TIME);
+		glUniform1i(glGetUniformLocation(stampTextureProgram, "spriteAtlas"), 0);
+		glUniform1i(glGetUniformLocation(stampTextureProgram, "damageMask"), 1);
+		glUniform1i(glGetUniformLocation(stampTextureProgram, "spriteTexture"), 2);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, spriteAtlas.texture());
+
+		glBindVertexArray(m_vao);
+
+		size_t start = 0;
+
+		while (start < count) {
+			GLuint texture = m_runs[start].texture;
+			int damagePage = m_runs[start].damagePage;
+			size_t end = start + 1;
+
+			// Undamaged sprites fit in any run, sprites with their own texture get a run to themselves
+			while (end < count && texture == 0 && m_runs[end].texture == 0 &&
+				(m_runs[end].damagePage < 0 || damagePage < 0 || m_runs[end].damagePage == damagePage)) {
+				if (damagePage < 0)
+					damagePage = m_runs[end].damagePage;
+
+				end++;
+			}
+
+			if (damagePage >= 0) {
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, damageMaskAtlas.pageTexture(damagePage));
+			}
+
+			if (texture != 0) {
+				glActiveTexture(GL_TEXTURE2);
+				glBindTexture(GL_TEXTURE_2D, texture);
+			}
+
+			glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, GLsizei(end - start), GLuint(start));
+			m_drawCalls++;
+
+			start = end;
+		}
+
+		glBindVertexArray(0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+
+	void report() {
+		if (m_sprites > 0) {
+			std::cout << "Sprites: " << m_sprites << " drawn in " << m_drawCalls << " instanced calls, "
+				<< size_t(m_shadedPixels / 1000) << "K pixels shaded (" << size_t(m_fullScreenPixels / 1000)
+				<< "K with full-screen quads)" << std::endl;
+		}
+
+		spriteAtlas.report();
+
+		m_sprites = 0;
+		m_drawCalls = 0;
+		m_shadedPixels = 0;
+		m_fullScreenPixels = 0;
+	}
+
+	void cleanup() {
+		glDeleteBuffers(1, &m_quadVBO);
+		glDeleteBuffers(1, &m_instanceVBO);
+		glDeleteVertexArrays(1, &m_vao);
+	}
+
+private:
+	// What has to be bound for an instance, kept next to the instances instead of in the GPU buffer
+	struct Run {
+		GLuint texture;  // 0 when the sprite is in the atlas
+		int damagePage;  // -1 when the sprite is undamaged
+	};
+
+	// Leaves the buffer bound
+	void reserveInstanceBuffer(size_t capacity) {
+		m_bufferCapacity = std::max<size_t>(capacity, 1);
+		glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, m_bufferCapacity * sizeof(Instance), nullptr, GL_STREAM_DRAW);
+	}
+
+	GLuint m_vao = 0;
+	GLuint m_quadVBO = 0;
+	GLuint m_instanceVBO = 0;
+	size_t m_bufferCapacity = 0;
+
+	std::vector<Instance> m_instances;
+	std::vector<Run> m_runs;
+
+	// Since the last report
+	size_t m_sprites = 0;
+	size_t m_drawCalls = 0;
+	double m_shadedPixels = 0;
+	double m_fullScreenPixels = 0;
+};
+
+SpriteBatch spriteBatch;
+
+// Dynamic resolution: GPU timer queries measure the simulation and render passes, and when they don't
+// fit the frame budget the fluid drops to a lower internal resolution (SIM_WIDTH x SIM_HEIGHT)
+// The composite in renderToScreen samples the fluid textures with filtering, which is the upscale
+class ResolutionGovernor {
+public:
+	enum Pass { SIMULATION_PASS, RENDER_PASS, NUM_PASSES };
+
+	static const int LATENCY = 4;         // Frames of queries in flight, results are read this late so nothing stalls
+	static const int DOWN_FRAMES = 15;    // Over budget this many frames in a row before stepping down
+	static const int UP_FRAMES = 120;     // Comfortably under budget this long before stepping back up
+	static const int SETTLE_FRAMES = 60;  // Measurements ignored after a change while caches and EMAs settle
+
+	void init() {
+		glGenQueries(LATENCY * NUM_PASSES, &m_queries[0][0]);
+
+		for (int i = 0; i < LATENCY; i++)
+			for (int j = 0; j < NUM_PASSES; j++)
+				m_issued[i][j] = false;
+	}
+
+	void cleanup() {
+		glDeleteQueries(LATENCY * NUM_PASSES, &m_queries[0][0]);
+	}
+
+	// GL_TIME_ELAPSED queries can't nest, the passes never overlap
+	void begin(Pass pass) {
+		glBeginQuery(GL_TIME_ELAPSED, m_queries[m_frame % LATENCY][pass]);
+	}
+
+	void end(Pass pass) {
+		glEndQuery(GL_TIME_ELAPSED);
+		m_issued[m_frame % LATENCY][pass] = true;
+	}
+
+	// Once per displayed frame, after the render pass
+	// Returns true when the scale changed and the fluid textures need reallocating
+	bool update() {
+		m_frame++;
+
+		// The slot that's about to be reused holds the oldest frame's queries
+		const int slot = m_frame % LATENCY;
+
+		for (int pass = 0; pass < NUM_PASSES; pass++) {
+			if (!m_issued[slot][pass])
+				continue;
+
+			m_issued[slot][pass] = false;
+
+			GLint available = 0;
+			glGetQueryObjectiv(m_queries[slot][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+
+			if (!available)
+				continue;
+
+			GLuint64 elapsed_ns = 0;
+			glGetQueryObjectui64v(m_queries[slot][pass], GL_QUERY_RESULT, &elapsed_ns);
+
+			float ms = elapsed_ns / 1.0e6f;
+			float& average = (pass == SIMULATION_PASS) ? m_sim_ms : m_render_ms;
+			average = (average < 0) ? ms : average + 0.1f * (ms - average);
+		}
+
+		if (!m_enabled || m_sim_ms < 0 || m_render_ms < 0)
+			return false;
 
-		GLuint useColorLoc = glGetUniformLocation(shaderProgram, "useColor");
-		glUniform1i(useColorLoc, 0); // Set to 1 if your font atlas is colored
+		if (m_settle > 0) {
+			m_settle--;
+			return false;
+		}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, atlas.textureID);
+		// The render pass composites at window resolution, only the simulation scales with the step
+		const float cost = m_sim_ms + m_render_ms;
+		const float budget = budgetMs();
 
-		glBindVertexArray(VAO);
+		if (cost > budget && m_step + 1 < NUM_STEPS) {
+			if (++m_over >= DOWN_FRAMES)
+				return setStep(m_step + 1);
+		}
+		else {
+			m_over = 0;
+		}
 
-		// If text should be centered, calculate the starting position
-		if (centered) {
-			float textWidth = 0;
-			for (char c : text) {
-				// Use the calculated width for each character
-				float charWidth = static_cast<float>(charWidths[c]);// charWidths.count(c) ? charWidths[c] : atlas.charWidth / 2;
-				textWidth += (8 + charWidth) * scale;
+		if (m_step > 0) {
+			float ratio = STEPS[m_step - 1] / STEPS[m_step];
+			float predicted = m_sim_ms * ratio * ratio + m_render_ms;
+
+			// Stepping up has to leave real headroom, or it would just come straight back down
+			if (predicted < budget * 0.8f) {
+				if (++m_under >= UP_FRAMES)
+					return setStep(m_step - 1);
+			}
+			else {
+				m_under = 0;
 			}
-			x = WIDTH / 2.0f - textWidth / 2.0f;
 		}
 
-		// For each character, create a quad with appropriate texture coordinates
-		std::vector<Vertex> vertices;
-		std::vector<GLuint> indices;
+		return false;
+	}
 
-		float xpos = x;
-		float ypos = y;
-		GLuint indexOffset = 0;
+	float scale() const {
+		return STEPS[m_step];
+	}
 
-		for (char c : text) {
-			// Get ASCII value of the character
-			unsigned char charValue = static_cast<unsigned char>(c);
+	// A window dimension at the current scale
+	int scaled(int size) const {
+		return std::max(1, int(size * scale() + 0.5f));
+	}
 
-			// Calculate position in the atlas using ASCII value
-			int atlasX = (charValue % atlas.charsPerRow) * atlas.charWidth;
-			int atlasY = (charValue / atlas.charsPerRow) * atlas.charHeight;
+	float budgetMs() const {
+		return 1000.0f / FPS * 0.9f; // Leave a little for the CPU side and the swap
+	}
 
-			// Calculate texture coordinates
-			float texLeft = atlasX / (float)atlas.atlasWidth;
-			float texRight = (atlasX + atlas.charWidth) / (float)atlas.atlasWidth;
-			float texTop = atlasY / (float)atlas.atlasHeight;
-			float texBottom = (atlasY + atlas.charHeight) / (float)atlas.atlasHeight;
+	// Smoothed GPU milliseconds of both passes, negative until there's a measurement
+	float costMs() const {
+		return (m_sim_ms < 0 || m_render_ms < 0) ? -1.0f : m_sim_ms + m_render_ms;
+	}
 
-			// Get the character's calculated width
-			float charWidth = static_cast<float>(charWidths[charValue]);// charWidths.count(charValue) ? charWidths[charValue] : atlas.charWidth / 2;
+	// Returns true when the scale changed
+	bool setStep(int step) {
+		step = std::min(std::max(step, 0), NUM_STEPS - 1);
 
-			// Calculate quad vertices
-			float quadLeft = xpos;
-			float quadRight = xpos + atlas.charWidth * scale; // Use full cell width for texture
-			float quadTop = ypos;
-			float quadBottom = ypos + atlas.charHeight * scale;
+		if (step == m_step)
+			return false;
 
-			// Add vertices
-			vertices.push_back({ {quadLeft, quadTop, 0.0f}, {texLeft, texTop}, color });
-			vertices.push_back({ {quadRight, quadTop, 0.0f}, {texRight, texTop}, color });
-			vertices.push_back({ {quadRight, quadBottom, 0.0f}, {texRight, texBottom}, color });
-			vertices.push_back({ {quadLeft, quadBottom, 0.0f}, {texLeft, texBottom}, color });
+		m_step = step;
+		m_changes++;
+		m_settle = SETTLE_FRAMES;
+		m_over = 0;
+		m_under = 0;
+		m_sim_ms = -1;
+		m_render_ms = -1;
+		return true;
+	}
 
-			// Add indices
-			indices.push_back(indexOffset + 0);
-			indices.push_back(indexOffset + 1);
-			indices.push_back(indexOffset + 2);
-			indices.push_back(indexOffset + 0);
-			indices.push_back(indexOffset + 2);
-			indices.push_back(indexOffset + 3);
+	void setEnabled(bool enabled) {
+		if (enabled == m_enabled)
+			return;
 
-			indexOffset += 4;
+		m_enabled = enabled;
+		m_over = 0;
+		m_under = 0;
+	}
 
-			// Advance cursor using the calculated width
-			// add 8 pixels of padding between characters
-			xpos += (8 + charWidth) * scale;
-		}
+	bool enabled() const {
+		return m_enabled;
+	}
 
-		// Upload vertex and index data
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_DYNAMIC_DRAW);
+	void report() {
+		std::cout << "Resolution: " << int(scale() * 100.0f + 0.5f) << "% (" << SIM_WIDTH << "x" << SIM_HEIGHT
+			<< " fluid for a " << WIDTH << "x" << HEIGHT << " window), " << (m_enabled ? "governed" : "fixed")
+			<< ", GPU " << m_sim_ms << " ms simulation + " << m_render_ms << " ms render against a "
+			<< budgetMs() << " ms budget, " << m_changes << " changes" << std::endl;
+	}
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_DYNAMIC_DRAW);
+	static const int NUM_STEPS = 5;
+	static constexpr float STEPS[NUM_STEPS] = { 1.0f, 0.85f, 0.7f, 0.6f, 0.5f };
 
-		// Draw text
-		glm::mat4 model = glm::mat4(1.0f);
-		GLuint modelLoc = glGetUniformLocation(shaderProgram, "model");
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+private:
+	GLuint m_queries[LATENCY][NUM_PASSES] = {};
+	bool m_issued[LATENCY][NUM_PASSES] = {};
+	size_t m_frame = 0;
+
+	bool m_enabled = true;
+	int m_step = 0;
+	int m_over = 0;
+	int m_under = 0;
+	int m_settle = 0;
+	size_t m_changes = 0;
+
+	// Smoothed GPU milliseconds, negative until the first result comes back
+	float m_sim_ms = -1;
+	float m_render_ms = -1;
+};
 
-		// Enable blending for transparent font
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+constexpr float ResolutionGovernor::STEPS[ResolutionGovernor::NUM_STEPS];
 
-		glDrawElements(GL_TRIANGLES, (GLsizei)indices.size(), GL_UNSIGNED_INT, 0);
+ResolutionGovernor resolutionGovernor;
 
-		// Reset state
-		glDisable(GL_BLEND);
-		glBindVertexArray(0);
-		glBindTexture(GL_TEXTURE_2D, 0);
-	}
-};
+// Reallocates the fluid textures at the governor's internal resolution, after it or the window changes
+// Dye and velocity are carried over with a filtered blit so the screen doesn't flash empty,
+// the obstacle texture is rebuilt every step anyway
+void resizeSimulationTextures() {
+	const int width = resolutionGovernor.scaled(WIDTH);
+	const int height = resolutionGovernor.scaled(HEIGHT);
 
+	struct SimulationTexture {
+		GLuint* texture;
+		GLint internalFormat;
+		GLenum format;
+		bool filtering;
+		bool scratch; // Written from scratch every step, nothing to carry over
+	};
 
+	const SimulationTexture textures[] = {
+		{ &velocityTexture[0], GL_RG32F, GL_RG, true, false },
+		{ &velocityTexture[1], GL_RG32F, GL_RG, true, false },
+		{ &pressureTexture[0], GL_R32F, GL_RED, true, false },
+		{ &pressureTexture[1], GL_R32F, GL_RED, true, false },
+		{ &divergenceTexture, GL_R32F, GL_RED, true, true },
+		{ &colorTexture[0], GL_R32F, GL_RED, true, false },
+		{ &colorTexture[1], GL_R32F, GL_RED, true, false },
+		{ &friendlyColorTexture[0], GL_R32F, GL_RED, true, false },
+		{ &friendlyColorTexture[1], GL_R32F, GL_RED, true, false },
+		{ &vorticityTexture, GL_R32F, GL_RED, true, true },
+		{ &vorticityForceTexture, GL_RG32F, GL_RG, true, true },
+		{ &obstacleTexture, GL_RGB32F, GL_RGB, false, true },
+	};
 
-TextRenderer* textRenderer = nullptr;
+	GLuint readFBO = 0;
+	glGenFramebuffers(1, &readFBO);
 
+	for (const SimulationTexture& t : textures) {
+		if (t.scratch) {
+			scratchTexturePool.release(*t.texture, t.internalFormat, t.filtering, SIM_WIDTH, SIM_HEIGHT);
+			*t.texture = scratchTexturePool.acquire(t.internalFormat, t.format, t.filtering, width, height);
+			continue;
+		}
 
+		GLuint resized = createTexture(t.internalFormat, t.format, t.filtering, width, height);
 
+		if (t.filtering) {
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *t.texture, 0);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, processingFBO);
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, resized, 0);
+			glBlitFramebuffer(0, 0, SIM_WIDTH, SIM_HEIGHT, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		}
 
+		glDeleteTextures(1, t.texture);
+		*t.texture = resized;
+	}
 
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &readFBO);
 
+	scratchTexturePool.trim(SIM_WIDTH, SIM_HEIGHT);
 
-void applyBlackeningEffectGPU(GLuint originalTexture, GLuint maskTexture, GLuint outputTexture, int width, int height) {
-	glBindFramebuffer(GL_FRAMEBUFFER, processingFBO);
+	SIM_WIDTH = width;
+	SIM_HEIGHT = height;
+
+	// Its dispatch size and readback buffers depend on the resolution, runCollisionPipeline makes a new one
+	// Passes still in flight are dropped, the next one covers their time
+	delete gpuCollisionDetector;
+	gpuCollisionDetector = nullptr;
+
+	LOG_INFO("Fluid resolution ", int(resolutionGovernor.scale() * 100.0f + 0.5f), "% (", width, "x", height, ")");
+}
 
-	// Set up multiple render targets
-//	GLenum attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, outputTexture, 0);
-	//	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, maskTexture, 0);
-	//	glDrawBuffers(2, attachments);
-
-		// Check framebuffer status
-		//GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-		//if (status != GL_FRAMEBUFFER_COMPLETE) {
-		//	std::cerr << "Framebuffer not complete: " << status << std::endl;
-		//	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		//	return;
-		//}
 
-	glViewport(0, 0, width, height);
 
-	glUseProgram(multiTargetBlackeningProgram);
-	glUniform1i(glGetUniformLocation(multiTargetBlackeningProgram, "originalTexture"), 0);
-	glUniform1i(glGetUniformLocation(multiTargetBlackeningProgram, "maskTexture"), 1);
-	glUniform1f(glGetUniformLocation(multiTargetBlackeningProgram, "random_number"), rand() / float(RAND_MAX));
 
-	GLuint projectionLocation = glGetUniformLocation(multiTargetBlackeningProgram, "projection");
-	glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(orthoMatrix));
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, originalTexture);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, maskTexture);
 
-	glBindVertexArray(vao);
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 
-	// Reset to single render target
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
-	glDrawBuffer(GL_COLOR_ATTACHMENT0);
 
-	glViewport(0, 0, WIDTH, HEIGHT);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
 
 
 
@@ -4576,8 +9142,28 @@ void initGL() {
 		exit(1);
 	}
 
+	typedef std::chrono::high_resolution_clock clock;
+	const clock::time_point startupStart = clock::now();
+
+	loadLevelConfig("level1/level.cfg");
+	seedRngStreams(seed_override ? seed_override : levelConfig.seed);
+	reserveEntityPools();
+	spriteBatch.init(levelConfig.max_ally_ships + levelConfig.max_enemy_ships + levelConfig.max_foreground_chunks + levelConfig.max_powerups);
+
+	// Packed images are already decoded, the rest are decoded up front in parallel
+	// From here on the loaders only upload
+	if (!loose_assets && !assetPack.isOpen())
+		assetPack.open(ASSET_PACK_PATH);
+
+	// What the first frames don't need is left to the streamer
+	assetStreamer.init(levelConfig.stream_assets != 0, levelConfig.stream_upload_kb * 1024);
+
+	imageDecoder.decodeAll(startupImageRequests());
+	const clock::time_point decoded = clock::now();
+
 	loadStampTextures();
 	loadBulletTemplates();
+	const clock::time_point templatesUploaded = clock::now();
 
 	// Create shader programs
 	advectProgram = createShaderProgram(vertexShaderSource, advectFragmentShader);
@@ -4588,26 +9174,32 @@ void initGL() {
 	// detectCollisionProgram has been removed
 	addColorProgram = createShaderProgram(vertexShaderSource, addColorFragmentShader);
 	diffuseColorProgram = createShaderProgram(vertexShaderSource, diffuseColorFragmentShader);
-	stampObstacleProgram = createShaderProgram(vertexShaderSource, stampObstacleFragmentShader);
+	stampObstacleProgram = createShaderProgram(vertexShaderSource, withStampDamage(stampObstacleFragmentShader).c_str());
 	diffuseVelocityProgram = createShaderProgram(vertexShaderSource, diffuseVelocityFragmentShader);
-	stampTextureProgram = createShaderProgram(vertexShaderSource, stampTextureFragmentShader);
+	stampTextureProgram = createShaderProgram(stampTextureVertexShader, withStampDamage(stampTextureFragmentShader).c_str());
 	renderProgram = createShaderProgram(vertexShaderSource, renderFragmentShader);
 
 	curlProgram = createShaderProgram(vertexShaderSource, curlFragmentShader);
 	vorticityForceProgram = createShaderProgram(vertexShaderSource, vorticityForceFragmentShader);
 	applyForceProgram = createShaderProgram(vertexShaderSource, applyForceFragmentShader);
 
-	batchBlackeningProgram = createShaderProgram(vertexShaderSource, batchBlackeningFragmentShader);
+	blackeningSplatProgram = createShaderProgram(blackeningSplatVertexShader, blackeningSplatFragmentShader);
+	const clock::time_point shadersBuilt = clock::now();
+
+	// The fluid starts at whatever scale the governor is on, so a reshape keeps it
+	SIM_WIDTH = resolutionGovernor.scaled(WIDTH);
+	SIM_HEIGHT = resolutionGovernor.scaled(HEIGHT);
+	resolutionGovernor.init();
 
 	glGenTextures(1, &vorticityTexture);
 	glBindTexture(GL_TEXTURE_2D, vorticityTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, WIDTH, HEIGHT, 0, GL_RED, GL_FLOAT, nullptr);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, SIM_WIDTH, SIM_HEIGHT, 0, GL_RED, GL_FLOAT, nullptr);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 	glGenTextures(1, &vorticityForceTexture);
 	glBindTexture(GL_TEXTURE_2D, vorticityForceTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, WIDTH, HEIGHT, 0, GL_RG, GL_FLOAT, nullptr);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, SIM_WIDTH, SIM_HEIGHT, 0, GL_RG, GL_FLOAT, nullptr);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
@@ -4616,25 +9208,41 @@ void initGL() {
 	textRenderer = new TextRenderer("font.png", WIDTH, HEIGHT);
 
 	for (int i = 0; i < 2; i++) {
-		colorTexture[i] = createTexture(GL_R32F, GL_RED, true, WIDTH, HEIGHT);
+		colorTexture[i] = createTexture(GL_R32F, GL_RED, true, SIM_WIDTH, SIM_HEIGHT);
 	}
 
 	for (int i = 0; i < 2; i++) {
-		friendlyColorTexture[i] = createTexture(GL_R32F, GL_RED, true, WIDTH, HEIGHT);
+		friendlyColorTexture[i] = createTexture(GL_R32F, GL_RED, true, SIM_WIDTH, SIM_HEIGHT);
 	}
 
 	// Create textures for simulation
 	for (int i = 0; i < 2; i++)
 	{
-		velocityTexture[i] = createTexture(GL_RG32F, GL_RG, true, WIDTH, HEIGHT);
-		pressureTexture[i] = createTexture(GL_R32F, GL_RED, true, WIDTH, HEIGHT);
+		velocityTexture[i] = createTexture(GL_RG32F, GL_RG, true, SIM_WIDTH, SIM_HEIGHT);
+		pressureTexture[i] = createTexture(GL_R32F, GL_RED, true, SIM_WIDTH, SIM_HEIGHT);
 	}
 
-	divergenceTexture = createTexture(GL_R32F, GL_RED, true, WIDTH, HEIGHT);
-	obstacleTexture = createTexture(GL_RGB32F, GL_RGB, false, WIDTH, HEIGHT);
+	divergenceTexture = createTexture(GL_R32F, GL_RED, true, SIM_WIDTH, SIM_HEIGHT);
+	obstacleTexture = createTexture(GL_RGB32F, GL_RGB, false, SIM_WIDTH, SIM_HEIGHT);
 	//	collisionTexture = createTexture(GL_RGBA32F, GL_RGBA, false, WIDTH, HEIGHT);
 	backgroundTexture = loadTexture("level1/grid_wide.png");
-	backgroundTexture2 = loadTexture("level1/grid_wide2.png");
+
+	if (assetStreamer.enabled()) {
+		const unsigned char transparent[4] = { 0, 0, 0, 0 };
+
+		glGenTextures(1, &overlayPlaceholder);
+		glBindTexture(GL_TEXTURE_2D, overlayPlaceholder);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, transparent);
+		backgroundTexture2 = overlayPlaceholder;
+	}
+	else {
+		backgroundTexture2 = overlayTextures[currentOverlay] = loadTexture(currentOverlay.c_str());
+	}
+
+	imageDecoder.clear();
+	streamLevelAhead(levelConfig.stream_ahead);
 
 	orthoMatrix = glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f, -10.0f, 10.0f);
 
@@ -4705,6 +9313,17 @@ void initGL() {
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	auto ms = [](clock::time_point a, clock::time_point b) { return std::chrono::duration<float, std::milli>(b - a).count(); };
+	const clock::time_point startupEnd = clock::now();
+
+	std::cout << "Startup: " << ms(startupStart, startupEnd) << " ms, "
+		<< assetPack.uploads() << " images uploaded from the pack, "
+		<< imageDecoder.files() << " images decoded in " << imageDecoder.wallMs() << " ms on " << imageDecoder.threads()
+		<< " threads (" << imageDecoder.decodeMs() << " ms of decoding, " << imageDecoder.late() << " decoded late), "
+		<< "template uploads " << ms(decoded, templatesUploaded) << " ms, "
+		<< "shaders " << ms(templatesUploaded, shadersBuilt) << " ms, "
+		<< "font, simulation textures and backgrounds " << ms(shadersBuilt, startupEnd) << " ms" << std::endl;
 }
 
 
@@ -4728,11 +9347,12 @@ void advectColor() {
 	glUniform1i(glGetUniformLocation(advectProgram, "obstacleTexture"), 2);
 	glUniform1f(glGetUniformLocation(advectProgram, "dt"), DT);
 	glUniform1f(glGetUniformLocation(advectProgram, "gridScale"), 1.0f);
-	glUniform2f(glGetUniformLocation(advectProgram, "texelSize"), 1.0f / WIDTH, 1.0f / HEIGHT);
+	glUniform2f(glGetUniformLocation(advectProgram, "texelSize"), 1.0f / SIM_WIDTH, 1.0f / SIM_HEIGHT);
 
 	// Eddy parameters - same as in advectVelocity
 	glUniform1f(glGetUniformLocation(advectProgram, "eddyIntensity"), eddyIntensity);
 	glUniform1f(glGetUniformLocation(advectProgram, "eddyDensity"), eddyDensity);
+	glUniform3iv(glGetUniformLocation(advectProgram, "eddyOctaves"), 1, qualityGovernor.level().eddy_octaves);
 
 	projectionLocation = glGetUniformLocation(advectProgram, "projection");
 	glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(orthoMatrix));
@@ -4774,11 +9394,12 @@ void advectFriendlyColor() {
 	glUniform1i(glGetUniformLocation(advectProgram, "obstacleTexture"), 2);
 	glUniform1f(glGetUniformLocation(advectProgram, "dt"), DT);
 	glUniform1f(glGetUniformLocation(advectProgram, "gridScale"), 1.0f);
-	glUniform2f(glGetUniformLocation(advectProgram, "texelSize"), 1.0f / WIDTH, 1.0f / HEIGHT);
+	glUniform2f(glGetUniformLocation(advectProgram, "texelSize"), 1.0f / SIM_WIDTH, 1.0f / SIM_HEIGHT);
 
 	// Eddy parameters - same as above
 	glUniform1f(glGetUniformLocation(advectProgram, "eddyIntensity"), eddyIntensity);
 	glUniform1f(glGetUniformLocation(advectProgram, "eddyDensity"), eddyDensity);
+	glUniform3iv(glGetUniformLocation(advectProgram, "eddyOctaves"), 1, qualityGovernor.level().eddy_octaves);
 
 	//std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
 	//std::chrono::duration<float, std::milli> elapsed;
@@ -4822,11 +9443,12 @@ void advectVelocity() {
 	glUniform1i(glGetUniformLocation(advectProgram, "obstacleTexture"), 2);
 	glUniform1f(glGetUniformLocation(advectProgram, "dt"), DT);
 	glUniform1f(glGetUniformLocation(advectProgram, "gridScale"), 1.0f);
-	glUniform2f(glGetUniformLocation(advectProgram, "texelSize"), 1.0f / WIDTH, 1.0f / HEIGHT);
+	glUniform2f(glGetUniformLocation(advectProgram, "texelSize"), 1.0f / SIM_WIDTH, 1.0f / SIM_HEIGHT);
 
 	// Eddy parameters
 	glUniform1f(glGetUniformLocation(advectProgram, "eddyIntensity"), eddyIntensity); // Adjust for desired strength
 	glUniform1f(glGetUniformLocation(advectProgram, "eddyDensity"), eddyDensity);   // Adjust for more/fewer eddies
+	glUniform3iv(glGetUniformLocation(advectProgram, "eddyOctaves"), 1, qualityGovernor.level().eddy_octaves);
 
 	//std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
 	//std::chrono::duration<float, std::milli> elapsed;
@@ -4868,7 +9490,7 @@ void computeDivergence() {
 	// Set uniforms
 	glUniform1i(glGetUniformLocation(divergenceProgram, "velocityTexture"), 0);
 	glUniform1i(glGetUniformLocation(divergenceProgram, "obstacleTexture"), 1);
-	glUniform2f(glGetUniformLocation(divergenceProgram, "texelSize"), 1.0f / WIDTH, 1.0f / HEIGHT);
+	glUniform2f(glGetUniformLocation(divergenceProgram, "texelSize"), 1.0f / SIM_WIDTH, 1.0f / SIM_HEIGHT);
 
 	// Bind textures
 	glActiveTexture(GL_TEXTURE0);
@@ -4911,7 +9533,7 @@ void solvePressure(int iterations) {
 		glUniform1i(glGetUniformLocation(pressureProgram, "pressureTexture"), 0);
 		glUniform1i(glGetUniformLocation(pressureProgram, "divergenceTexture"), 1);
 		glUniform1i(glGetUniformLocation(pressureProgram, "obstacleTexture"), 2);
-		glUniform2f(glGetUniformLocation(pressureProgram, "texelSize"), 1.0f / WIDTH, 1.0f / HEIGHT);
+		glUniform2f(glGetUniformLocation(pressureProgram, "texelSize"), 1.0f / SIM_WIDTH, 1.0f / SIM_HEIGHT);
 		glUniform1f(glGetUniformLocation(pressureProgram, "alpha"), alpha);
 		glUniform1f(glGetUniformLocation(pressureProgram, "rBeta"), rBeta);
 
@@ -4946,7 +9568,7 @@ void subtractPressureGradient() {
 	glUniform1i(glGetUniformLocation(gradientSubtractProgram, "pressureTexture"), 0);
 	glUniform1i(glGetUniformLocation(gradientSubtractProgram, "velocityTexture"), 1);
 	glUniform1i(glGetUniformLocation(gradientSubtractProgram, "obstacleTexture"), 2);
-	glUniform2f(glGetUniformLocation(gradientSubtractProgram, "texelSize"), 1.0f / WIDTH, 1.0f / HEIGHT);
+	glUniform2f(glGetUniformLocation(gradientSubtractProgram, "texelSize"), 1.0f / SIM_WIDTH, 1.0f / SIM_HEIGHT);
 	glUniform1f(glGetUniformLocation(gradientSubtractProgram, "scale"), 1.0f);
 
 	// Bind textures
@@ -5065,11 +9687,8 @@ void addColor(float posX, float posY, float radius)
 
 	glUseProgram(addColorProgram);
 
-	float x_shift = 0.01f * rand() / float(RAND_MAX);
-	float y_shift = 0.01f * rand() / float(RAND_MAX);
-
-	float mousePosX = posX;// +x_shift;
-	float mousePosY = posY;// +y_shift;
+	float mousePosX = posX;
+	float mousePosY = posY;
 
 
 	GLuint projectionLocation = glGetUniformLocation(addColorProgram, "projection");
@@ -5188,49 +9807,6 @@ void addMouseColor()
 
 
 
-void updateDynamicTexture(Stamp& stamp) {
-	for (size_t i = 0; i < stamp.textureIDs.size(); i++) {
-		if (stamp.textureIDs[i] != 0 && i < stamp.pixelData.size() && !stamp.pixelData[i].empty()) {
-			// Only process blackening if the texture actually exists
-			if (stamp.blackeningTexture != 0) {
-				// Ensure the temporary textures are ready
-				setupProcessingTexture(tempTexture1, stamp.width, stamp.height);
-				setupProcessingTexture(tempTexture2, stamp.width, stamp.height);
-
-				// Create a texture from the backup data
-				GLuint originalTexture;
-				glGenTextures(1, &originalTexture);
-				glBindTexture(GL_TEXTURE_2D, originalTexture);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, stamp.width, stamp.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, stamp.pixelData[i].data());
-
-
-
-
-				// Apply the blackening effect to the original texture using the mask
-				applyBlackeningEffectGPU(originalTexture, stamp.blackeningTexture, stamp.textureIDs[i], stamp.width, stamp.height);
-
-				// Clean up temporary texture
-				glDeleteTextures(1, &originalTexture);
-
-				// Update the pixelData to match what's now in the GPU texture
-				glBindTexture(GL_TEXTURE_2D, stamp.textureIDs[i]);
-				glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, stamp.pixelData[i].data());
-			}
-			else {
-				// For stamps without blackening, just ensure the texture is updated
-				glBindTexture(GL_TEXTURE_2D, stamp.textureIDs[i]);
-				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, stamp.width, stamp.height,
-					(stamp.channels == 1) ? GL_RED :
-					(stamp.channels == 3) ? GL_RGB : GL_RGBA,
-					GL_UNSIGNED_BYTE, stamp.pixelData[i].data());
-			}
-		}
-	}
-}
 
 
 
@@ -5251,26 +9827,26 @@ void updateObstacle() {
 		case ALLY:
 			if (allyTemplates.empty()) return;
 			newStamp = deepCopyStamp(allyTemplates[currentAllyTemplateIndex]);
-			// Explicitly ensure blackeningTexture is 0
-			newStamp.blackeningTexture = 0;
+			// Explicitly ensure the copy has no damage mask
+			newStamp.damageMask.reset();
 			break;
 		case ENEMY:
 			if (enemyTemplates.empty()) return;
 			newStamp = deepCopyStamp(enemyTemplates[currentEnemyTemplateIndex]);
-			// Explicitly ensure blackeningTexture is 0
-			newStamp.blackeningTexture = 0;
+			// Explicitly ensure the copy has no damage mask
+			newStamp.damageMask.reset();
 			break;
 		case BULLET:
 			if (bulletTemplates.empty()) return;
 			newStamp = deepCopyStamp(bulletTemplates[0]); // Always use the first bullet template
-			// Explicitly ensure blackeningTexture is 0
-			newStamp.blackeningTexture = 0;
+			// Explicitly ensure the copy has no damage mask
+			newStamp.damageMask.reset();
 			break;
 		case POWERUP:
 			if (powerUpTemplates.empty()) return;
 			newStamp = deepCopyStamp(powerUpTemplates[currentPowerUpTemplateIndex]);
-			// Explicitly ensure blackeningTexture is 0
-			newStamp.blackeningTexture = 0;
+			// Explicitly ensure the copy has no damage mask
+			newStamp.damageMask.reset();
 			break;
 		}
 
@@ -5279,7 +9855,7 @@ void updateObstacle() {
 
 		// Set variation based on arrow key state
 		if (upKeyPressed) {
-			if (0)//newStamp.textureIDs.size() > 1 && newStamp.textureIDs[1] != 0)
+			if (0)//newStamp.textureIDs().size() > 1 && newStamp.textureIDs()[1] != 0)
 			{
 				newStamp.currentVariationIndex = 1;
 			}
@@ -5289,7 +9865,7 @@ void updateObstacle() {
 			}
 		}
 		else if (downKeyPressed) {
-			if (0)//newStamp.textureIDs.size() > 2 && newStamp.textureIDs[2] != 0) 
+			if (0)//newStamp.textureIDs().size() > 2 && newStamp.textureIDs()[2] != 0) 
 			{
 				//newStamp.currentVariationIndex = 2;
 			}
@@ -5303,40 +9879,49 @@ void updateObstacle() {
 		}
 
 		// Fall back to first available texture if necessary
-		if (newStamp.currentVariationIndex >= newStamp.textureIDs.size() ||
-			newStamp.textureIDs[newStamp.currentVariationIndex] == 0) {
-			for (size_t i = 0; i < newStamp.textureIDs.size(); i++) {
-				if (newStamp.textureIDs[i] != 0) {
+		if (newStamp.currentVariationIndex >= newStamp.textureIDs().size() ||
+			newStamp.textureIDs()[newStamp.currentVariationIndex] == 0) {
+			for (size_t i = 0; i < newStamp.textureIDs().size(); i++) {
+				if (newStamp.textureIDs()[i] != 0) {
 					newStamp.currentVariationIndex = i;
 					break;
 				}
 			}
 		}
 
+		// Spawning copies the template's cannons and such
+		frameAllocations.allowAllocations();
+
+		const char* added = "";
+
 		// Add the stamp to the appropriate vector based on the template type
 		switch (currentTemplateType) {
 		case ALLY:
-			allyShips.push_back(newStamp);
-			std::cout << "Added new ally ship";
+			if (playerIndex() == SIZE_MAX)
+				playerShip = allyShips.push_back(newStamp);
+			else
+				allyShips.push_back(newStamp);
+
+			added = "ally ship";
 			break;
 
 		case ENEMY:
 			enemyShips.push_back(newStamp);
-			std::cout << "Added new enemy ship";
+			added = "enemy ship";
 			break;
 
 		case POWERUP:
 			size_t num_powerup_tempates = powerUpTemplates.size();
-			size_t index = rand() % num_powerup_tempates;
+			size_t index = spawnRng.below(uint32_t(num_powerup_tempates));
 
 			newStamp = powerUpTemplates[SINUSOIDAL_POWERUP + index];
-			// Explicitly ensure blackeningTexture is 0
-			newStamp.blackeningTexture = 0;
+			// Explicitly ensure the copy has no damage mask
+			newStamp.damageMask.reset();
 
 			newStamp.powerup = powerup_type(SINUSOIDAL_POWERUP + index);
 
 			newStamp.posX = 1.0f;
-			newStamp.posY = rand() / float(RAND_MAX);
+			newStamp.posY = spawnRng.uniform();
 
 			newStamp.birth_time = GLOBAL_TIME;
 			newStamp.death_time = -1.0f;
@@ -5344,17 +9929,17 @@ void updateObstacle() {
 			newStamp.local_velY = 0.0f;
 			allyPowerUps.push_back(newStamp);
 
-			std::cout << "Added new power up";
+			added = "power up";
 			break;
 		}
 
-		std::string variationName = "unknown";
-		if (newStamp.currentVariationIndex < newStamp.textureNames.size()) {
-			variationName = newStamp.textureNames[newStamp.currentVariationIndex];
+		const char* variationName = "unknown";
+		if (newStamp.currentVariationIndex < newStamp.textureNames().size()) {
+			variationName = newStamp.textureNames()[newStamp.currentVariationIndex].c_str();
 		}
 
-		std::cout << " at position (" << mousePosX << ", " << mousePosY << ") with texture: "
-			<< newStamp.baseFilename << " (variation: " << variationName << ")" << std::endl;
+		LOG_INFO("Added new ", added, " at position (", mousePosX, ", ", mousePosY, ") with texture: ",
+			newStamp.baseFilename(), " (variation: ", variationName, ")");
 	}
 
 	lastRightMouseDown = rightMouseDown;
@@ -5370,255 +9955,381 @@ void updateObstacle() {
 
 void move_and_fork_bullets(void)
 {
-	auto update_bullets = [&](std::vector<Stamp>& stamps, string type)
-		{
-			float aspect = HEIGHT / float(WIDTH);
-
-			for (auto& stamp : stamps)
-			{
-				stamp.prevPosX = stamp.posX;
-				stamp.prevPosY = stamp.posY; 
+	bullets.update();
 
-				//std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
-				//std::chrono::duration<float, std::milli> elapsed;
-				//elapsed = global_time_end - app_start_time;
+	// Add in random walking, like lightning, and split the lightning
+	// Only the bullets that were alive before this step move, the forks start moving next step
+	const size_t count = bullets.size();
 
-				// Store the original direction vector
-				float dirX = stamp.local_velX * aspect * DT;
-				float dirY = stamp.local_velY * DT;
+	// The walk takes eight unit vectors at a time, bullets without path_randomization just scale theirs to nothing
+	float rand_x[RngLanes::LANES], rand_y[RngLanes::LANES];
 
-				// Normalize the direction vector
-				float dirLength = sqrt(dirX * dirX + dirY * dirY);
-				if (dirLength > 0) {
-					dirX /= dirLength;
-					dirY /= dirLength;
-				}
+	for (size_t i = 0; i < count; i += RngLanes::LANES)
+	{
+		bulletLanes.unitVectors(rand_x, rand_y);
 
-				// Calculate the perpendicular direction vector (rotate 90 degrees)
-				float perpX = -dirY;
-				float perpY = dirX;
+		const size_t lanes = min<size_t>(RngLanes::LANES, count - i);
+		float* posX = &bullets.posX[i];
+		float* posY = &bullets.posY[i];
+		const float* path_randomization = &bullets.path_randomization[i];
 
-				// Calculate time-based sinusoidal amplitude
-				// Use the birth_time to ensure continuous motion
-				float timeSinceCreation = GLOBAL_TIME - stamp.birth_time;
-				float frequency = stamp.sinusoidal_frequency; // Controls how many waves appear
-				float amplitude = stamp.sinusoidal_amplitude; // Controls wave height
+		for (size_t l = 0; l < lanes; l++)
+		{
+			posX[l] += rand_x[l] * path_randomization[l];
+			posY[l] += rand_y[l] * path_randomization[l];
+		}
+	}
 
+	for (size_t i = 0; i < count; i++)
+	{
+		if (bullets.random_forking[i] <= 0)
+			continue;
 
-				float sinValue = 0;
+		float r = bulletRng.uniform();
 
-				if (stamp.sinusoidal_shift)
-					sinValue = -sin(timeSinceCreation * frequency);
-				else
-					sinValue = sin(timeSinceCreation * frequency);
+		// to do: make the forked lightning smaller
+		if (r < bullets.random_forking[i])
+		{
+			BulletSpawn newBullet = bullets.spawnFrom(i);
 
-				// Move forward along original path
-				float forwardSpeed = dirLength; // Original velocity magnitude
-				stamp.posX += dirX * forwardSpeed;
-				stamp.posY += dirY * forwardSpeed;
+			float fork_x = 0, fork_y = 0;
+			RandomUnitVector(bulletRng, fork_x, fork_y);
+			newBullet.velX += fork_x * r;
+			newBullet.velY += fork_y * r;
 
-				// Add sinusoidal motion perpendicular to the path
-				stamp.posX += perpX * sinValue * amplitude;
-				stamp.posY += perpY * sinValue * amplitude;
+			bullets.emit(newBullet);
+		}
+	}
+}
 
-				// Add in random walking, like lightning (from original code)
-				float rand_x = 0, rand_y = 0;
-				RandomUnitVector(rand_x, rand_y);
-				stamp.posX += rand_x * stamp.path_randomization;
-				stamp.posY += rand_y * stamp.path_randomization;
 
+// Pixel perfect test of a 1x1 bullet against a stamp whose bounding box is already known
+bool isBulletCollision(float posX, float posY, const Sprite& b, float bMinX, float bMinY, float bMaxX, float bMaxY)
+{
+	float aspect = WIDTH / float(HEIGHT);
+	float y = (posY - 0.5f) * aspect + 0.5f;
 
-				float r = rand() / float(RAND_MAX);
+	if (posX < bMinX || posX > bMaxX || y < bMinY || y > bMaxY)
+		return false;
 
-				//if (stamp.is_dying_bullet)
-				//{
-				//	stamp.posX += stamp.global_velX;
-				//	stamp.posY += stamp.global_velY;
-				//}
+	int texBx = int((posX - bMinX) / (bMaxX - bMinX) * b.width);
+	int texBy = int((y - bMinY) / (bMaxY - bMinY) * b.height);
 
-				// Split the lightning
-				// to do: make the forked lightning smaller
-				if (r < stamp.random_forking)
-				{
-					Stamp newBullet = stamp;
+	return isOpaquePixel(b, b.currentVariationIndex, texBx, texBy);
+}
 
-					float rand_x = 0, rand_y = 0;
-					RandomUnitVector(rand_x, rand_y);
-					newBullet.local_velX += rand_x * r;
-					newBullet.local_velY += rand_y * r;
+void mark_colliding_bullets(void)
+{
+	// The ship's bounding box is worked out once, then tested against every bullet of the other faction
+	auto mark_hits = [&](const auto& ships, BulletFaction faction)
+		{
+			const auto& transforms = ships.template column<Transform>();
+			const auto& sprites = ships.template column<Sprite>();
 
-					if (type == "ally")
-						allyBullets.push_back(newBullet);
+			for (size_t j = 0; j < ships.size(); ++j)
+			{
+				float minX, minY, maxX, maxY;
+				calculateBoundingBox(transforms[j], sprites[j], minX, minY, maxX, maxY);
 
-					if (type == "enemy")
-						enemyBullets.push_back(newBullet);
+				for (size_t i = 0; i < bullets.size(); ++i)
+				{
+					if (bullets.faction[i] != faction)
+						continue;
 
+					if (isBulletCollision(bullets.posX[i], bullets.posY[i], sprites[j], minX, minY, maxX, maxY))
+						bullets.death_time[i] = GLOBAL_TIME;
 				}
-
-				// If a dying bullet, then move it along with the foreground
-				if (stamp.is_dying_bullet)
-					stamp.posX += foreground_vel * DT;
 			}
 		};
 
-	update_bullets(allyBullets, "ally");
-	update_bullets(enemyBullets, "enemy");
+	mark_hits(enemyShips, ALLY_FACTION);
+	mark_hits(foregroundChunks, ALLY_FACTION);
+	mark_hits(allyShips, ENEMY_FACTION);
+
+	// get rid of enemy bullets that hit enemy the foreground
+	mark_hits(foregroundChunks, ENEMY_FACTION);
+}
+
+void cull_marked_bullets(void)
+{
+	// Old, offscreen and colliding bullets are all removed in the same compaction pass
+	bullets.cull();
 }
 
 
-void mark_colliding_bullets(void)
+// Times the bullet kernel on 100k bullets, run with --bench-bullets
+void benchmarkBullets(void)
 {
-	//std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
-	//std::chrono::duration<float, std::milli> elapsed;
-	//elapsed = global_time_end - app_start_time;
+	const size_t count = 100000;
+	const int steps = 200;
 
-	for (size_t i = 0; i < allyBullets.size(); ++i)
-		for (size_t j = 0; j < enemyShips.size(); ++j)
-			if (isPixelPerfectCollision(allyBullets[i], enemyShips[j]))
-				allyBullets[i].death_time = GLOBAL_TIME;
+	auto fill = [&]()
+		{
+			Rng rng = makeRng(BENCHMARK_RNG);
+			bullets.clear();
+			bullets.reserve(count);
 
-	for (size_t i = 0; i < enemyBullets.size(); ++i)
-		for (size_t j = 0; j < allyShips.size(); ++j)
-			if (isPixelPerfectCollision(enemyBullets[i], allyShips[j]))
-				enemyBullets[i].death_time = GLOBAL_TIME;
+			for (size_t i = 0; i < count; i++)
+			{
+				BulletSpawn b;
+				b.posX = rng.uniform();
+				b.posY = rng.uniform();
+				RandomUnitVector(rng, b.velX, b.velY);
+				b.velX *= 0.01f;
+				b.velY *= 0.01f;
+				b.sinusoidal_amplitude = 0.005f * rng.uniform();
+				b.sinusoidal_shift = (i & 1) != 0;
+				b.birth_time = -(rng.uniform());
+				b.death_time = 10.0f * rng.uniform();
+				b.is_dying_bullet = (i % 3) == 0;
+				b.faction = (i & 2) ? ENEMY_FACTION : ALLY_FACTION;
+				bullets.emit(b);
+			}
 
-	// get rid of enemy bullets that hit enemy the foreground
-	for (size_t i = 0; i < enemyBullets.size(); ++i)
-	{
-		for (size_t j = 0; j < enemyShips.size(); ++j)
+			GLOBAL_TIME = 0;
+		};
+
+	auto time_kernel = [&](void (BulletParticles::* kernel)(size_t, size_t))
 		{
-			if (false == enemyShips[j].is_foreground)
-				continue;
+			fill();
 
-			if (isPixelPerfectCollision(enemyBullets[i], enemyShips[j]))
-				enemyBullets[i].death_time = GLOBAL_TIME;
-		}
-	}
-}
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
 
-void mark_old_bullets(void)
-{
-	//std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
-	//std::chrono::duration<float, std::milli> elapsed;
-	//elapsed = global_time_end - app_start_time;
+			for (int i = 0; i < steps; i++)
+			{
+				(bullets.*kernel)(0, bullets.size());
+				GLOBAL_TIME += DT;
+			}
 
-	for (size_t i = 0; i < allyBullets.size(); ++i)
-	{
-		if (allyBullets[i].death_time < 0.0f)
-			continue;
+			std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+			return elapsed.count() / steps;
+		};
 
-		if (allyBullets[i].death_time <= GLOBAL_TIME)
-			allyBullets[i].to_be_culled = true;
-	}
+	float scalar_ms = time_kernel(&BulletParticles::updateScalar);
+	std::vector<float> scalarX = bullets.posX;
 
-	for (size_t i = 0; i < enemyBullets.size(); ++i)
-	{
-		if (enemyBullets[i].death_time < 0.0f)
-			continue;
+	cout << "Bullet benchmark, " << count << " bullets, " << steps << " steps" << endl;
+	cout << "  scalar update: " << scalar_ms << " ms/step" << endl;
 
-		if (enemyBullets[i].death_time <= GLOBAL_TIME)
-			enemyBullets[i].to_be_culled = true;
-	}
+#ifdef __AVX2__
+	float avx2_ms = time_kernel(&BulletParticles::updateAVX2);
 
+	float max_error = 0;
+	for (size_t i = 0; i < count; i++)
+		max_error = max(max_error, fabsf(bullets.posX[i] - scalarX[i]));
 
-}
+	cout << "  AVX2 update: " << avx2_ms << " ms/step (" << scalar_ms / avx2_ms << "x, max difference " << max_error << ")" << endl;
+#else
+	cout << "  AVX2 update: not compiled in" << endl;
+#endif
 
-void mark_offscreen_bullets(void)
-{
-	auto update_bullets = [&](std::vector<Stamp>& stamps)
+	// Age the bullets so that the compaction has something to remove
+	GLOBAL_TIME = 5.0f;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	bullets.cull();
+	std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	cout << "  cull: " << elapsed.count() << " ms, " << bullets.size() << " of " << count << " bullets left" << endl;
+
+	// The random walk's unit vectors, the old rand() and trig against one stream and against eight lanes
+	std::vector<float> walkX(count), walkY(count);
+
+	auto time_walk = [&](auto draw)
 		{
-			for (auto& stamp : stamps)
-			{
-				float aspect = WIDTH / float(HEIGHT);
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
 
-				// Calculate adjusted Y coordinate that accounts for aspect ratio
-				float adjustedPosY = (stamp.posY - 0.5f) * aspect + 0.5f;
+			for (int i = 0; i < steps; i++)
+				draw();
 
-				// Check if the stamp is outside the visible area
-				// The bullet stamp is 1x1 pixels, so this is an easy calculation
-				if (stamp.posX < 0 || stamp.posX > 1 ||
-					adjustedPosY < 0 || adjustedPosY > 1)
-				{
-					stamp.to_be_culled = true;
-				}
-			}
+			std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+			return elapsed.count() / steps;
 		};
 
-	update_bullets(allyBullets);
-	update_bullets(enemyBullets);
+	const float pi = 3.14159265f;
+	float rand_ms = time_walk([&]()
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				float a = (rand() / float(RAND_MAX)) * 2.0f * pi;
+				walkX[i] = cos(a);
+				walkY[i] = sin(a);
+			}
+		});
+
+	Rng rng = makeRng(BENCHMARK_RNG);
+	float stream_ms = time_walk([&]()
+		{
+			for (size_t i = 0; i < count; i++)
+				rng.unitVector(walkX[i], walkY[i]);
+		});
+
+	RngLanes lanes = makeRngLanes(BENCHMARK_RNG);
+	float lanes_ms = time_walk([&]()
+		{
+			for (size_t i = 0; i + RngLanes::LANES <= count; i += RngLanes::LANES)
+				lanes.unitVectors(&walkX[i], &walkY[i]);
+		});
+
+	float max_length_error = 0;
+	for (size_t i = 0; i < count; i++)
+		max_length_error = max(max_length_error, fabsf(walkX[i] * walkX[i] + walkY[i] * walkY[i] - 1.0f));
+
+	cout << "  unit vectors: rand() " << rand_ms << " ms, stream " << stream_ms << " ms, lanes " << lanes_ms
+		<< " ms (" << rand_ms / lanes_ms << "x, max length error " << max_length_error << ")" << endl;
+
+	bullets.clear();
+	GLOBAL_TIME = 0;
 }
 
-void cull_marked_bullets(void)
+
+
+// Ships as whole Stamps in one array (the layout before archetypes) against the ShipArchetype,
+// running the same move, offscreen and opacity systems over both
+// The bytes/entity figures are what each loop walks over, for real cache miss counts run this under perf stat -e cache-misses
+void benchmarkEntities(void)
 {
-	auto update_bullets = [&](std::vector<Stamp>& stamps, string type)
+	const size_t count = 100000;
+	const int steps = 200;
+
+	std::vector<Stamp> flat;
+	ShipArchetype table;
+	flat.reserve(count);
+	table.reserve(count);
+
+	Rng rng = makeRng(BENCHMARK_RNG);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		Stamp stamp;
+		stamp.width = 32 + rng.below(96);
+		stamp.height = 32 + rng.below(96);
+		stamp.posX = 1.5f * rng.uniform();
+		stamp.posY = rng.uniform();
+		stamp.local_velX = -0.1f * rng.uniform();
+		stamp.local_velY = 0.01f * (rng.uniform() - 0.5f);
+		flat.push_back(stamp);
+		table.push_back(stamp);
+	}
+
+	auto time_steps = [&](auto system)
 		{
-			// Use iterator-based erase to safely remove elements
-			auto it = stamps.begin();
-			while (it != stamps.end()) {
-				if (it->to_be_culled) {
-					// Stamp destructor will handle texture cleanup
-					cout << "culling " << type << " bullet" << endl;
-					it = stamps.erase(it);
-				}
-				else {
-					++it;
-				}
-			}
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+			for (int i = 0; i < steps; i++)
+				system();
+
+			std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+			return elapsed.count() / steps;
 		};
 
-	update_bullets(allyBullets, "Ally");
-	update_bullets(enemyBullets, "Enemy");
-}
+	// move_ships
+	float flat_move_ms = time_steps([&]()
+		{
+			for (Stamp& stamp : flat)
+			{
+				stamp.prevPosX = stamp.posX;
+				stamp.prevPosY = stamp.posY;
+				stamp.posX += stamp.local_velX * DT + foreground_vel * DT;
+				stamp.posY += stamp.local_velY * DT;
+			}
+		});
+
+	float table_move_ms = time_steps([&]()
+		{
+			std::vector<Transform>& transforms = table.column<Transform>();
+			const std::vector<Velocity>& velocities = table.column<Velocity>();
 
+			for (size_t i = 0; i < table.size(); i++)
+			{
+				transforms[i].prevPosX = transforms[i].posX;
+				transforms[i].prevPosY = transforms[i].posY;
+				transforms[i].posX += velocities[i].local_velX * DT + foreground_vel * DT;
+				transforms[i].posY += velocities[i].local_velY * DT;
+			}
+		});
 
+	// mark_offscreen_ships
+	float flat_offscreen_ms = time_steps([&]()
+		{
+			for (Stamp& stamp : flat)
+				if (stamp.posX < -(stamp.width / float(WIDTH)) / 2.0f)
+					stamp.to_be_culled = true;
+		});
 
+	float table_offscreen_ms = time_steps([&]()
+		{
+			const std::vector<Transform>& transforms = table.column<Transform>();
+			const std::vector<Sprite>& sprites = table.column<Sprite>();
+			std::vector<Lifetime>& lifetimes = table.column<Lifetime>();
 
+			for (size_t i = 0; i < table.size(); i++)
+				if (transforms[i].posX < -(sprites[i].width / float(WIDTH)) / 2.0f)
+					lifetimes[i].to_be_culled = true;
+		});
 
-std::map<std::string, std::vector<size_t>> identifyChunkedForegrounds(const std::vector<Stamp>& ships) {
-	std::map<std::string, std::vector<size_t>> chunkedGroups;
+	// proceed_stamp_opacity
+	float flat_opacity_ms = time_steps([&]()
+		{
+			for (Stamp& stamp : flat)
+				if (stamp.to_be_culled)
+					stamp.stamp_opacity -= 0.25f;
+		});
 
-	for (size_t i = 0; i < ships.size(); i++) {
-		const Stamp& stamp = ships[i];
+	float table_opacity_ms = time_steps([&]()
+		{
+			for (Lifetime& lifetime : table.column<Lifetime>())
+				if (lifetime.to_be_culled)
+					lifetime.stamp_opacity -= 0.25f;
+		});
+
+	// Both layouts have to end up in the same place
+	float max_error = 0;
+	size_t mismatches = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		max_error = max(max_error, fabsf(flat[i].posX - table.get<Transform>(i).posX));
+		mismatches += flat[i].to_be_culled != table.get<Lifetime>(i).to_be_culled;
+	}
+
+	// Bytes of array each system walks over per entity: whole Stamps in the flat layout,
+	// only the components it reads in the archetype (all of a Sprite though, for its width)
+	const size_t flat_bytes = sizeof(Stamp);
+	const size_t move_bytes = sizeof(Transform) + sizeof(Velocity);
+	const size_t offscreen_bytes = sizeof(Transform) + sizeof(Sprite) + sizeof(Lifetime);
+	const size_t opacity_bytes = sizeof(Lifetime);
+
+	cout << "Entity benchmark, " << count << " ships, " << steps << " steps" << endl;
+	cout << "  sizeof(Stamp) " << sizeof(Stamp) << ", Transform " << sizeof(Transform) << ", Velocity " << sizeof(Velocity)
+		<< ", Lifetime " << sizeof(Lifetime) << ", Health " << sizeof(Health) << ", Sprite " << sizeof(Sprite) << endl;
+	cout << "  move: " << flat_move_ms << " ms flat, " << table_move_ms << " ms archetype ("
+		<< flat_move_ms / table_move_ms << "x), " << flat_bytes << " vs " << move_bytes << " bytes/entity" << endl;
+	cout << "  offscreen: " << flat_offscreen_ms << " ms flat, " << table_offscreen_ms << " ms archetype ("
+		<< flat_offscreen_ms / table_offscreen_ms << "x), " << flat_bytes << " vs " << offscreen_bytes << " bytes/entity" << endl;
+	cout << "  opacity: " << flat_opacity_ms << " ms flat, " << table_opacity_ms << " ms archetype ("
+		<< flat_opacity_ms / table_opacity_ms << "x), " << flat_bytes << " vs " << opacity_bytes << " bytes/entity" << endl;
+	cout << "  max position difference " << max_error << ", " << mismatches << " culling mismatches" << endl;
+}
 
-		// Check if this is a foreground chunk (will have a baseFilename containing "_chunk_")
-		if (stamp.is_foreground && stamp.baseFilename.find("_chunk_") != std::string::npos) {
-			// Extract the original baseFilename (everything before the _chunk_ part)
-			size_t chunkPos = stamp.baseFilename.find("_chunk_");
-			if (chunkPos != std::string::npos) {
-				std::string originalBaseFilename = stamp.baseFilename.substr(0, chunkPos);
-				chunkedGroups[originalBaseFilename].push_back(i);
-			}
-		}
-	}
 
-	return chunkedGroups;
-}
 
 
 
 void move_ships(void) {
-	// First, identify all chunked foregrounds
-	std::map<std::string, std::vector<size_t>> chunkedForegrounds = identifyChunkedForegrounds(enemyShips);
-
-	// Create a set of indices that are part of chunked foregrounds
-	std::set<size_t> chunkedIndices;
-	for (const auto& group : chunkedForegrounds) {
-		for (size_t idx : group.second) {
-			chunkedIndices.insert(idx);
-		}
-	}
+	// Only the Transform and Velocity arrays are touched here
+	std::vector<Transform>& allyTransforms = allyShips.column<Transform>();
+	const std::vector<Velocity>& allyVelocities = allyShips.column<Velocity>();
 
 	// Process ally ships as before
-	for (auto& stamp : allyShips) {
-		//if (stamp.to_be_culled) continue;
+	for (size_t i = 0; i < allyShips.size(); i++) {
+		Transform& stamp = allyTransforms[i];
 
 		stamp.prevPosX = stamp.posX;
 		stamp.prevPosY = stamp.posY;
 
 		const float aspect = WIDTH / float(HEIGHT);
 
-		stamp.posX += stamp.local_velX * DT;// / aspect;
-		stamp.posY += stamp.local_velY * DT;
+		stamp.posX += allyVelocities[i].local_velX * DT;// / aspect;
+		stamp.posY += allyVelocities[i].local_velY * DT;
 
 		// Calculate adjusted Y coordinate that accounts for aspect ratio
 		float adjustedPosY = (stamp.posY - 0.5f) * aspect + 0.5f;
@@ -5642,32 +10353,28 @@ void move_ships(void) {
 
 
 
-	for (auto& stamp : enemyShips)
-	{
-		if (stamp.is_foreground)// || stamp.to_be_culled)
-			continue;
-
-		stamp.prevPosX = stamp.posX;
-		stamp.prevPosY = stamp.posY;
-
-		const float aspect = WIDTH / float(HEIGHT);
-
-		stamp.posX += stamp.local_velX * DT;
-		stamp.posY += stamp.local_velY * DT;
-
-		stamp.posX += foreground_vel * DT;
+	// Enemy ships and foreground chunks both scroll along with the foreground
+	auto scroll_ships = [](auto& ships)
+		{
+			auto& transforms = ships.template column<Transform>();
+			const auto& velocities = ships.template column<Velocity>();
 
+			for (size_t i = 0; i < ships.size(); i++)
+			{
+				Transform& stamp = transforms[i];
 
-		//			if (stamp.local_velY > 0.001)
-//				stamp.currentVariationIndex = 1;
-//			else if (stamp.local_velY < -0.001)
-//				stamp.currentVariationIndex = 2;
-//			else
-//				stamp.currentVariationIndex = 0;
+				stamp.prevPosX = stamp.posX;
+				stamp.prevPosY = stamp.posY;
 
+				stamp.posX += velocities[i].local_velX * DT;
+				stamp.posY += velocities[i].local_velY * DT;
 
+				stamp.posX += foreground_vel * DT;
+			}
+		};
 
-	}
+	scroll_ships(enemyShips);
+	scroll_ships(foregroundChunks);
 
 
 	// Process non-chunked enemy ships as before
@@ -5743,62 +10450,23 @@ void move_ships(void) {
 //		//stamp.global_velY = vel_y;
 //	}
 
-	// Process chunked foregrounds as groups
-	for (const auto& [baseFilename, indices] : chunkedForegrounds) {
-		if (indices.empty()) continue;
-
-		// Get the first chunk to use as reference
-		const Stamp& referenceChunk = enemyShips[indices[0]];
-
-		// Calculate time parameter
-		float t = GLOBAL_TIME - referenceChunk.birth_time;
-		t /= referenceChunk.death_time - referenceChunk.birth_time;
-
-		// Get position for original full-sized foreground
-		//vec2 vd = get_curve_point(referenceChunk.curve_path, t);
-		//vec2 vd2 = get_straight_point(referenceChunk.curve_path, t);
-
-		//vd.x = lerp(vd.x, vd2.x, 0.15f);
-		//vd.y = lerp(vd.y, vd2.y, 0.15f);
-
-		// Calculate original stamp width and height in normalized coordinates
-		float originalWidth = referenceChunk.data_original_width / float(WIDTH);
-		float originalHeight = referenceChunk.data_original_height / float(HEIGHT);
-
-
-
-		// Now update all chunks based on where the original would be
-		for (size_t idx : indices) {
-			Stamp& chunk = enemyShips[idx];
-
-			// Calculate normalized chunk size
-			float chunkWidth = chunk.width / float(WIDTH);
-			float chunkHeight = chunk.height / float(HEIGHT);
-
-			chunk.prevPosX = chunk.posX;
-			chunk.prevPosY = chunk.posY;
-
-			chunk.posX += chunk.local_velX * DT;
-			chunk.posY += chunk.local_velY * DT;
-			chunk.posX += foreground_vel * DT;
-
-		}
-	}
 }
 
 
-void make_dying_bullets(const Stamp& stamp, const bool enemy)
+// Explosion for ship i of an archetype
+template <typename Ships>
+void make_dying_bullets(const Ships& ships, size_t i, const bool enemy)
 {
-	if (stamp.to_be_culled)
+	if (ships.template get<Lifetime>(i).to_be_culled)
 		return;
 
-	sound.play();
+	const Transform& transform = ships.template get<Transform>(i);
+	const Sprite& stamp = ships.template get<Sprite>(i);
 
-	//std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
-	//std::chrono::duration<float, std::milli> elapsed;
-	//elapsed = global_time_end - app_start_time;
+	sound.play();
 
-	Stamp newCentralStamp = bulletTemplates[0];
+	BulletSpawn newCentralStamp;
+	newCentralStamp.faction = enemy ? ENEMY_FACTION : ALLY_FACTION;
 
 	float x_rad = stamp.width / float(WIDTH) / 2.0f;
 	float y_rad = stamp.height / float(HEIGHT) / 2.0f;
@@ -5806,106 +10474,93 @@ void make_dying_bullets(const Stamp& stamp, const bool enemy)
 	float avg_rad = max(x_rad, y_rad);// 0.5 * (x_rad + y_rad);
 
 	newCentralStamp.colour_radius = avg_rad / 2.0f;
-	newCentralStamp.force_radius = avg_rad / 2.0f;
 
-	newCentralStamp.posX = stamp.posX;
-	newCentralStamp.posY = stamp.posY;
+	newCentralStamp.posX = transform.posX;
+	newCentralStamp.posY = transform.posY;
 
 	newCentralStamp.birth_time = GLOBAL_TIME;
 	newCentralStamp.death_time = GLOBAL_TIME + 0.1f;
 
 	newCentralStamp.is_dying_bullet = true;
 
-	if (enemy)
-		enemyBullets.push_back(newCentralStamp);
-	else
-		allyBullets.push_back(newCentralStamp);
+	emitBullet(newCentralStamp);
+
+	const QualityLevel& quality = qualityGovernor.level();
 
-	for (size_t j = 0; j < 3; j++)
+	for (size_t j = 0; j < quality.explosion_sparks[0]; j++)
 	{
-		Stamp newStamp = newCentralStamp;
+		BulletSpawn newStamp = newCentralStamp;
 
 		newStamp.colour_radius = avg_rad / 4;
-		newStamp.force_radius = avg_rad / 4;
 
-		RandomUnitVector(newStamp.local_velX, newStamp.local_velY);
+		RandomUnitVector(explosionRng, newStamp.velX, newStamp.velY);
 
-		newStamp.local_velX /= 250.0f / (rand() / float(RAND_MAX));
-		newStamp.local_velY /= 250.0f / (rand() / float(RAND_MAX));
-		newStamp.path_randomization = (rand() / float(RAND_MAX)) * 0.01f;
+		newStamp.velX /= 250.0f / (explosionRng.uniform());
+		newStamp.velY /= 250.0f / (explosionRng.uniform());
+		newStamp.path_randomization = (explosionRng.uniform()) * 0.01f;
 		newStamp.birth_time = GLOBAL_TIME;
-		newStamp.death_time = GLOBAL_TIME + 1.0f * rand() / float(RAND_MAX);
+		newStamp.death_time = GLOBAL_TIME + 1.0f * explosionRng.uniform();
 
-		if (enemy)
-			enemyBullets.push_back(newStamp);
-		else
-			allyBullets.push_back(newStamp);
+		emitBullet(newStamp);
 	}
 
-	for (size_t j = 0; j < 5; j++)
+	for (size_t j = 0; j < quality.explosion_sparks[1]; j++)
 	{
-		Stamp newStamp = newCentralStamp;
+		BulletSpawn newStamp = newCentralStamp;
 
 		newStamp.colour_radius = avg_rad / 8;
-		newStamp.force_radius = avg_rad / 8;
 
-		RandomUnitVector(newStamp.local_velX, newStamp.local_velY);
+		RandomUnitVector(explosionRng, newStamp.velX, newStamp.velY);
 
-		newStamp.local_velX /= 100.0f / (rand() / float(RAND_MAX));
-		newStamp.local_velY /= 100.0f / (rand() / float(RAND_MAX));
-		newStamp.path_randomization = (rand() / float(RAND_MAX)) * 0.01f;
+		newStamp.velX /= 100.0f / (explosionRng.uniform());
+		newStamp.velY /= 100.0f / (explosionRng.uniform());
+		newStamp.path_randomization = (explosionRng.uniform()) * 0.01f;
 		newStamp.birth_time = GLOBAL_TIME;
-		newStamp.death_time = GLOBAL_TIME + 3.0f * rand() / float(RAND_MAX);
+		newStamp.death_time = GLOBAL_TIME + 3.0f * explosionRng.uniform();
 
-		if (enemy)
-			enemyBullets.push_back(newStamp);
-		else
-			allyBullets.push_back(newStamp);
+		emitBullet(newStamp);
 	}
 }
 
 
 void mark_dying_ships(void)
 {
-
-
-	for (size_t i = 0; i < allyShips.size(); ++i)
-	{
-		if (allyShips[i].to_be_culled)
-			continue;
-
-		if (allyShips[i].health <= 0)
+	auto mark_dying = [&](auto& ships, bool enemy)
 		{
-			cout << "mark_dying_ships" << endl;
+			auto& lifetimes = ships.template column<Lifetime>();
+			const auto& healths = ships.template column<Health>();
 
-			make_dying_bullets(allyShips[i], false);
-			allyShips[i].to_be_culled = true;
-		}
-	}
+			for (size_t i = 0; i < ships.size(); ++i)
+			{
+				if (lifetimes[i].to_be_culled)
+					continue;
 
-	for (size_t i = 0; i < enemyShips.size(); ++i)
-	{
-		if (enemyShips[i].to_be_culled)
-			continue;
+				if (healths[i].health <= 0)
+				{
+					if (!enemy)
+						LOG_DEBUG("mark_dying_ships");
 
-		if (enemyShips[i].health <= 0)
-		{
-			make_dying_bullets(enemyShips[i], true);
-			enemyShips[i].to_be_culled = true;
-		}
-	}
+					make_dying_bullets(ships, i, enemy);
+					lifetimes[i].to_be_culled = true;
+				}
+			}
+		};
+
+	mark_dying(allyShips, false);
+	mark_dying(enemyShips, true);
+	mark_dying(foregroundChunks, true);
 }
 
 
 
 
 
-bool isPixelPerfectCollision_AvgOut(const Stamp& a, const Stamp& b, vec2& avg_out) {
+bool isPixelPerfectCollision_AvgOut(const Transform& aTransform, const Sprite& a, const Transform& bTransform, const Sprite& b, vec2& avg_out) {
 	float aMinX, aMinY, aMaxX, aMaxY;
 	float bMinX, bMinY, bMaxX, bMaxY;
 
-	calculateBoundingBox(a, aMinX, aMinY, aMaxX, aMaxY);
-	calculateBoundingBox(b, bMinX, bMinY, bMaxX, bMaxY);
+	calculateBoundingBox(aTransform, a, aMinX, aMinY, aMaxX, aMaxY);
+	calculateBoundingBox(bTransform, b, bMinX, bMinY, bMaxX, bMaxY);
 
 	avg_out.x = avg_out.y = 0;
 
@@ -5962,82 +10617,53 @@ void mark_colliding_ships(void)
 	// to do: once this is complete and tested, then do enemy ship to enemy ship collisions,
 	// to do: so that enemy ships don't penetrate the foreground
 
-	for (size_t i = 0; i < allyShips.size(); ++i)
-	{
-		for (size_t j = 0; j < enemyShips.size(); ++j)
+	auto collide_with = [&](const auto& others)
 		{
-			if (isPixelPerfectCollision(allyShips[i], enemyShips[j]))
+			const auto& otherTransforms = others.template column<Transform>();
+			const auto& otherSprites = others.template column<Sprite>();
+
+			for (size_t i = 0; i < allyShips.size(); ++i)
 			{
-				if (0)//enemyShips[j].is_foreground)
+				for (size_t j = 0; j < others.size(); ++j)
 				{
-					// For foreground objects, we want to push the ship away
-
-					bool found_non_collision = false;
-
-					//for (size_t k = 0; k < 100; k++)
-					//{
-					//	vec2 avg_out;
-
-					//	if (false == isPixelPerfectCollision_AvgOut(allyShips[i], enemyShips[j], avg_out))
-					//	{
-					//		found_non_collision = true;
-					//		break;
-					//	}
-
-					//	avg_out.x /= allyShips[i].width;
-					//	avg_out.y /= allyShips[i].height;
-
-					//	if (avg_out.x < 0.45)
-					//		allyShips[i].posX += 0.001;
-					//	else if (avg_out.x > 0.55)
-					//		allyShips[i].posX -= 0.001;
-
-					//	if (avg_out.y < 0.45)
-					//		allyShips[i].posY += 0.001;
-					//	else if (avg_out.y > 0.55)
-					//		allyShips[i].posY -= 0.001;
-					//}
-
-					// In case the player gets stuck between a foreground object and the edge of the screen
-					if (found_non_collision == false)
+					if (isPixelPerfectCollision(allyShips.get<Transform>(i), allyShips.get<Sprite>(i), otherTransforms[j], otherSprites[j]))
 					{
-
-
-						make_dying_bullets(allyShips[i], false);
-						allyShips[i].health = 0;
-						allyShips[i].to_be_culled = true;
+						// Destroy the ship immediately
+						make_dying_bullets(allyShips, i, false);
+						allyShips.get<Health>(i).health = 0;
+						allyShips.get<Lifetime>(i).to_be_culled = true;
 					}
-
 				}
-				else
-				{
-
+			}
+		};
 
+	collide_with(enemyShips);
 
-					// For regular enemies, destroy the ship immediately
-					make_dying_bullets(allyShips[i], false);
-					allyShips[i].health = 0;
-					allyShips[i].to_be_culled = true;
-				}
-			}
-		}
-	}
+	// to do: push the ship away from the foreground instead (isPixelPerfectCollision_AvgOut gives the direction),
+	// to do: and only destroy it when it gets stuck between a foreground object and the edge of the screen
+	collide_with(foregroundChunks);
 }
 
 
 void mark_offscreen_ships(void)
 {
-	auto update_ships = [&](std::vector<Stamp>& stamps)
+	auto update_ships = [&](auto& stamps)
 		{
-			for (auto& stamp : stamps)
+			const auto& transforms = stamps.template column<Transform>();
+			const auto& sprites = stamps.template column<Sprite>();
+			auto& lifetimes = stamps.template column<Lifetime>();
+
+			for (size_t i = 0; i < stamps.size(); i++)
 			{
+				const Transform& stamp = transforms[i];
+
 				const float aspect = WIDTH / float(HEIGHT);
 
 				// Calculate adjusted Y coordinate that accounts for aspect ratio
 				const float adjustedPosY = (stamp.posY - 0.5f) * aspect + 0.5f;
 
-				const float stamp_width_in_normalized_units = stamp.width / float(WIDTH);
-				const float stamp_height_in_normalized_units = stamp.height / float(HEIGHT);
+				const float stamp_width_in_normalized_units = sprites[i].width / float(WIDTH);
+				const float stamp_height_in_normalized_units = sprites[i].height / float(HEIGHT);
 
 				// get rid of enemy ships that completely cross the left edge of the screen
 				if (stamp.posX < -stamp_width_in_normalized_units / 2.0f)// ||
@@ -6045,7 +10671,7 @@ void mark_offscreen_ships(void)
 				//	adjustedPosY < -stamp_height_in_normalized_units / 2.0f ||
 				//	adjustedPosY > 1.0f + stamp_height_in_normalized_units / 2.0f)
 				{
-					stamp.to_be_culled = true;
+					lifetimes[i].to_be_culled = true;
 				}
 
 
@@ -6053,53 +10679,53 @@ void mark_offscreen_ships(void)
 				//if (stamp.posX < -0.5 || stamp.posX > 1.5 ||
 				//	adjustedPosY < -0.5 || adjustedPosY > 1.5)
 				//{
-				//	stamp.to_be_culled = true;
+				//	lifetimes[i].to_be_culled = true;
 				//}
 			}
 		};
 
 	//update_ships(allyShips);
 	update_ships(enemyShips);
+	update_ships(foregroundChunks);
 }
 
 
 
 void proceed_stamp_opacity(void)
 {
-	auto update_ships = [&](std::vector<Stamp>& stamps, string type)
+	// Only touches the Lifetime array
+	auto update_ships = [&](auto& stamps, const char* type)
 		{
-			for (size_t i = 0; i < stamps.size(); i++)
+			for (Lifetime& lifetime : stamps.template column<Lifetime>())
 			{
-				if (stamps[i].to_be_culled)
+				if (lifetime.to_be_culled)
 				{
-					stamps[i].stamp_opacity -= 0.25;
+					lifetime.stamp_opacity -= 0.25;
 				}
 			}
 		};
 
 	update_ships(allyShips, "Ally");
 	update_ships(enemyShips, "Enemy");
+	update_ships(foregroundChunks, "Foreground");
 }
 
 
 void cull_marked_ships(void)
 {
-	auto update_ships = [&](std::vector<Stamp>& stamps, string type)
+	auto update_ships = [&](auto& stamps, const char* type)
 		{
-			auto it = stamps.begin();
-			while (it != stamps.end()) {
-				if (it->to_be_culled && it->stamp_opacity <= 0) {
-					cout << "culling " << type << " ship" << endl;
-					it = stamps.erase(it);
-				}
-				else {
-					++it;
-				}
-			}
+			const auto& lifetimes = stamps.template column<Lifetime>();
+
+			size_t culled = stamps.removeIf([&](size_t i) { return lifetimes[i].to_be_culled && lifetimes[i].stamp_opacity <= 0; });
+
+			if (culled > 0)
+				LOG_INFO("culling ", culled, " ", type, " ship(s)");
 		};
 
 	update_ships(allyShips, "Ally");
 	update_ships(enemyShips, "Enemy");
+	update_ships(foregroundChunks, "Foreground");
 }
 
 
@@ -6114,7 +10740,7 @@ void cull_marked_ships(void)
 
 void move_powerups(void)
 {
-	auto update_powerups = [&](std::vector<Stamp>& stamps)
+	auto update_powerups = [&](PowerUpArchetype& stamps)
 		{
 			//for (auto& stamp : stamps)
 			//{
@@ -6124,8 +10750,17 @@ void move_powerups(void)
 			//	stamp.posY += stamp.global_velY;
 			//}
 
-			for (auto& stamp : stamps)
+			std::vector<Transform>& transforms = stamps.column<Transform>();
+			const std::vector<Velocity>& velocities = stamps.column<Velocity>();
+			const std::vector<Wave>& waves = stamps.column<Wave>();
+			const std::vector<Lifetime>& lifetimes = stamps.column<Lifetime>();
+
+			for (size_t i = 0; i < stamps.size(); i++)
 			{
+				Transform& stamp = transforms[i];
+				const Velocity& velocity = velocities[i];
+				const Wave& wave = waves[i];
+
 				stamp.prevPosX = stamp.posX;
 				stamp.prevPosY = stamp.posY;
 
@@ -6135,8 +10770,8 @@ void move_powerups(void)
 				//elapsed = global_time_end - app_start_time;
 
 				// Store the original direction vector
-				float dirX = stamp.local_velX * aspect;
-				float dirY = stamp.local_velY;
+				float dirX = velocity.local_velX * aspect;
+				float dirY = velocity.local_velY;
 
 				// Normalize the direction vector
 				float dirLength = sqrt(dirX * dirX + dirY * dirY);
@@ -6151,21 +10786,21 @@ void move_powerups(void)
 
 				// Calculate time-based sinusoidal amplitude
 				// Use the birth_time to ensure continuous motion
-				float timeSinceCreation = GLOBAL_TIME - stamp.birth_time;
-				float frequency = stamp.sinusoidal_frequency; // Controls how many waves appear
-				float amplitude = stamp.sinusoidal_amplitude; // Controls wave height
+				float timeSinceCreation = GLOBAL_TIME - lifetimes[i].birth_time;
+				float frequency = wave.sinusoidal_frequency; // Controls how many waves appear
+				float amplitude = wave.sinusoidal_amplitude; // Controls wave height
 
 				float sinValue = 0;
 
-				if (stamp.sinusoidal_shift)
+				if (wave.sinusoidal_shift)
 					sinValue = -sin(timeSinceCreation * frequency);
 				else
 					sinValue = sin(timeSinceCreation * frequency);
 
 				// Move forward along original path
 				float forwardSpeed = dirLength; // Original velocity magnitude
-				stamp.posX += stamp.local_velX * aspect;
-				stamp.posY += stamp.local_velY;
+				stamp.posX += velocity.local_velX * aspect;
+				stamp.posY += velocity.local_velY;
 
 				// Add sinusoidal motion perpendicular to the path
 				stamp.posX += perpX * sinValue * amplitude;
@@ -6185,25 +10820,27 @@ void mark_colliding_powerups(void)
 	{
 		for (size_t j = 0; j < allyPowerUps.size(); ++j)
 		{
-			if (isPixelPerfectCollision(allyShips[i], allyPowerUps[j]))
+			if (isPixelPerfectCollision(allyShips.get<Transform>(i), allyShips.get<Sprite>(i), allyPowerUps.get<Transform>(j), allyPowerUps.get<Sprite>(j)))
 			{
-				allyPowerUps[j].to_be_culled = true;
+				allyPowerUps.get<Lifetime>(j).to_be_culled = true;
 
-				if (allyPowerUps[j].powerup == SINUSOIDAL_POWERUP)
+				const powerup_type powerup = allyPowerUps.get<Powerup>(j).powerup;
+
+				if (powerup == SINUSOIDAL_POWERUP)
 				{
 					has_sinusoidal_fire = true;
 					ally_fire = SINUSOIDAL;
 				}
-				else if (allyPowerUps[j].powerup == RANDOM_POWERUP)
+				else if (powerup == RANDOM_POWERUP)
 				{
 					has_random_fire = true;
 					ally_fire = RANDOM;
 				}
-				else if (allyPowerUps[j].powerup == X3_POWERUP)
+				else if (powerup == X3_POWERUP)
 				{
 					x3_fire = true;
 				}
-				else if (allyPowerUps[j].powerup == X5_POWERUP)
+				else if (powerup == X5_POWERUP)
 				{
 					x5_fire = true;
 				}
@@ -6214,14 +10851,18 @@ void mark_colliding_powerups(void)
 
 void mark_offscreen_powerups(void)
 {
-	auto update_powerups = [&](std::vector<Stamp>& stamps)
+	auto update_powerups = [&](PowerUpArchetype& stamps)
 		{
-			for (auto& stamp : stamps)
+			const std::vector<Transform>& transforms = stamps.column<Transform>();
+			const std::vector<Sprite>& sprites = stamps.column<Sprite>();
+			std::vector<Lifetime>& lifetimes = stamps.column<Lifetime>();
+
+			for (size_t i = 0; i < stamps.size(); i++)
 			{
-				const float stamp_width_in_normalized_units = stamp.width / float(WIDTH);
+				const float stamp_width_in_normalized_units = sprites[i].width / float(WIDTH);
 
-				if (stamp.posX < -stamp_width_in_normalized_units / 2.0f)
-					stamp.to_be_culled = true;
+				if (transforms[i].posX < -stamp_width_in_normalized_units / 2.0f)
+					lifetimes[i].to_be_culled = true;
 			}
 		};
 
@@ -6231,18 +10872,14 @@ void mark_offscreen_powerups(void)
 
 void cull_marked_powerups(void)
 {
-	auto update_powerups = [&](std::vector<Stamp>& stamps)
+	auto update_powerups = [&](PowerUpArchetype& stamps)
 		{
-			auto it = stamps.begin();
-			while (it != stamps.end()) {
-				if (it->to_be_culled) {
-					cout << "culling marked powerup" << endl;
-					it = stamps.erase(it);
-				}
-				else {
-					++it;
-				}
-			}
+			const std::vector<Lifetime>& lifetimes = stamps.column<Lifetime>();
+
+			size_t culled = stamps.removeIf([&](size_t i) { return lifetimes[i].to_be_culled; });
+
+			if (culled > 0)
+				LOG_INFO("culling ", culled, " marked powerup(s)");
 		};
 
 	update_powerups(allyPowerUps);
@@ -6255,21 +10892,11 @@ void cull_marked_powerups(void)
 
 
 void simulationStep() {
-	auto updateDynamicTextures = [&](std::vector<Stamp>& stamps)
-		{
-			for (auto& stamp : stamps)
-				updateDynamicTexture(stamp);
-		};
-
-	updateDynamicTextures(allyShips);
-	updateDynamicTextures(enemyShips);
-	updateDynamicTextures(allyBullets);
-	updateDynamicTextures(enemyBullets);
+	// Every pass in here renders into the fluid textures
+	glViewport(0, 0, SIM_WIDTH, SIM_HEIGHT);
 
 	move_and_fork_bullets();
 	mark_colliding_bullets();
-	mark_old_bullets();
-	mark_offscreen_bullets();
 	cull_marked_bullets();
 
 	move_powerups();
@@ -6289,22 +10916,32 @@ void simulationStep() {
 	red_mode = true;
 
 	// Process ally bullets
-	for (size_t i = 0; i < allyBullets.size(); i++)
+	for (size_t i = 0; i < bullets.size(); i++)
 	{
-		//addForce(allyBullets[i].posX, allyBullets[i].posY, allyBullets[i].prevPosX, allyBullets[i].prevPosY, allyBullets[i].force_radius, 10.0);
+		if (bullets.faction[i] != ALLY_FACTION)
+			continue;
 
-		addColor(allyBullets[i].posX, allyBullets[i].posY, allyBullets[i].colour_radius);
+		//addForce(bullets.posX[i], bullets.posY[i], bullets.prevPosX[i], bullets.prevPosY[i], bullets.colour_radius[i], 10.0);
+
+		addColor(bullets.posX[i], bullets.posY[i], bullets.colour_radius[i]);
 	}
 
 	red_mode = false;
 
 	// Process enemy bullets
-	for (size_t i = 0; i < enemyBullets.size(); i++) {
-		addColor(enemyBullets[i].posX, enemyBullets[i].posY, enemyBullets[i].colour_radius);
+	for (size_t i = 0; i < bullets.size(); i++) {
+		if (bullets.faction[i] != ENEMY_FACTION)
+			continue;
+
+		addColor(bullets.posX[i], bullets.posY[i], bullets.colour_radius[i]);
 	}
 
 	red_mode = old_red_mode;
 
+	// GPU bullets move, collide and splat their dye in one go
+	if (gpuBullets)
+		gpuBullets->step(obstacleTexture);
+
 
 
 	//addMouseForce();
@@ -6331,18 +10968,13 @@ void simulationStep() {
 	diffuseFriendlyColor();
 
 	//computeDivergence();
-	//solvePressure(20);
+	//solvePressure(qualityGovernor.level().pressure_iterations);
 	//subtractPressureGradient();
 
 	frameCount++;
 
-	// Process collisions at regular intervals
-	// (10 times per second)
-	if (frameCount % size_t(FPS / 10.0) == 0)
-	{
-		generateFluidStampCollisionsDamage();
-		processCollectedBlackeningPoints();
-	}
+	// Collision detection runs asynchronously, as often as its budget allows
+	runCollisionPipeline();
 }
 
 
@@ -6351,6 +10983,7 @@ void simulationStep() {
 void renderToScreen() {
 	// Bind default framebuffer (the screen)
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, WIDTH, HEIGHT);
 
 	// Clear the screen
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -6370,7 +11003,7 @@ void renderToScreen() {
 	glUniform1i(glGetUniformLocation(renderProgram, "friendlyColorTexture"), 3);
 	glUniform1i(glGetUniformLocation(renderProgram, "backgroundTexture"), 4);
 	glUniform1i(glGetUniformLocation(renderProgram, "backgroundTexture2"), 5);
-	glUniform2f(glGetUniformLocation(renderProgram, "texelSize"), 1.0f / WIDTH, 1.0f / HEIGHT);
+	glUniform2f(glGetUniformLocation(renderProgram, "texelSize"), 1.0f / SIM_WIDTH, 1.0f / SIM_HEIGHT);
 	glUniform1f(glGetUniformLocation(renderProgram, "time"), GLOBAL_TIME);
 
 	// Bind textures
@@ -6400,76 +11033,13 @@ void renderToScreen() {
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	glUseProgram(stampTextureProgram);
-
-	projectionLocation = glGetUniformLocation(stampTextureProgram, "projection");
-	glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(orthoMatrix));
-
-	auto renderStamps = [&](const std::vector<Stamp>& stamps)
-		{
-			for (const auto& stamp : stamps) {
-				// to do: do not draw if offscreen
-				const float aspect = WIDTH / float(HEIGHT);
-
-				// Calculate adjusted Y coordinate that accounts for aspect ratio
-				const float adjustedPosY = (stamp.posY - 0.5f) * aspect + 0.5f;
-
-				const float stamp_width_in_normalized_units = stamp.width / float(WIDTH);
-				const float stamp_height_in_normalized_units = stamp.height / float(HEIGHT);
-
-				// get rid of enemy ships that completely cross the left edge of the screen
-				if (stamp.posX < -stamp_width_in_normalized_units / 2.0f ||
-					stamp.posX > 1.0f + stamp_width_in_normalized_units / 2.0f ||
-					adjustedPosY < -stamp_height_in_normalized_units / 2.0f ||
-					adjustedPosY > 1.0f + stamp_height_in_normalized_units / 2.0f)
-				{
-					continue;
-				}
-
-				size_t variationIndex = stamp.currentVariationIndex;
-				if (variationIndex < 0 || variationIndex >= stamp.textureIDs.size() ||
-					stamp.textureIDs[variationIndex] == 0) {
-					for (size_t i = 0; i < stamp.textureIDs.size(); i++) {
-						if (stamp.textureIDs[i] != 0) {
-							variationIndex = i;
-							break;
-						}
-					}
-					if (variationIndex < 0 || variationIndex >= stamp.textureIDs.size() ||
-						stamp.textureIDs[variationIndex] == 0) {
-						continue;
-					}
-				}
-
-				float stamp_y = (stamp.posY - 0.5f) * aspect + 0.5f;
-
-				glUniform1i(glGetUniformLocation(stampTextureProgram, "stampTexture"), 0);
-				glUniform2f(glGetUniformLocation(stampTextureProgram, "position"), stamp.posX, stamp_y);
-				glUniform2f(glGetUniformLocation(stampTextureProgram, "stampSize"), (float)stamp.width, (float)stamp.height);
-				glUniform1f(glGetUniformLocation(stampTextureProgram, "threshold"), 0.1f);
-				glUniform2f(glGetUniformLocation(stampTextureProgram, "screenSize"), (float)WIDTH, (float)HEIGHT);
-
-				// added in opacity as a uniform, so that the stamp can fade away over time upon death
-				glUniform1f(glGetUniformLocation(stampTextureProgram, "stamp_opacity"), stamp.stamp_opacity);
-
-				if (stamp.is_foreground)
-					glUniform1i(glGetUniformLocation(stampTextureProgram, "under_fire"), false);
-				else
-					glUniform1i(glGetUniformLocation(stampTextureProgram, "under_fire"), stamp.under_fire);
-
-				glUniform1f(glGetUniformLocation(stampTextureProgram, "time"), GLOBAL_TIME);
-
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, stamp.textureIDs[variationIndex]);
-
-				glBindVertexArray(vao);
-				glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-			}
-		};
-
-	renderStamps(allyShips);
-	renderStamps(enemyShips);
-	renderStamps(allyPowerUps);
+	// One instance buffer for every sprite, drawn back to front: allies, foreground, enemies, power ups
+	spriteBatch.begin();
+	spriteBatch.add(allyShips, true);
+	spriteBatch.add(foregroundChunks, false);
+	spriteBatch.add(enemyShips, true);
+	spriteBatch.add(allyPowerUps, false);
+	spriteBatch.draw();
 
 	glDisable(GL_BLEND);
 }
@@ -6492,7 +11062,13 @@ void displayFPS() {
 		lastTime = currentTime;
 	}
 
-	std::string fpsText = "FPS: " + std::to_string(static_cast<int>(fps));
+	// The fluid's internal resolution, when the governor has turned it down
+	char fpsText[32];
+	if (resolutionGovernor.scale() < 1.0f)
+		snprintf(fpsText, sizeof(fpsText), "FPS: %d  %d%%", static_cast<int>(fps), int(resolutionGovernor.scale() * 100.0f + 0.5f));
+	else
+		snprintf(fpsText, sizeof(fpsText), "FPS: %d", static_cast<int>(fps));
+
 	textRenderer->renderText(fpsText, 0.0, 10, 0.5f, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), true);
 }
 
@@ -6500,13 +11076,33 @@ void displayFPS() {
 // GLUT display callback
 void display()
 {
+	frameAllocations.begin();
+	resolutionGovernor.begin(ResolutionGovernor::RENDER_PASS);
+
 	// Render to screen
 	renderToScreen();
 
 	displayFPS();
 
+	// All of the frame's text in one draw
+	textRenderer->flush();
+
+	resolutionGovernor.end(ResolutionGovernor::RENDER_PASS);
+	frameAllocations.end("display");
+
 	// Swap buffers
 	glutSwapBuffers();
+
+	// Automatic quality gives up the cheap knobs before the resolution, and gets them back after it
+	// The resolution stays governed while it's below full, quality can't come back until it has
+	qualityGovernor.update(resolutionGovernor.costMs(), resolutionGovernor.budgetMs(), resolutionGovernor.scale() == 1.0f);
+	resolutionGovernor.setEnabled(!qualityGovernor.automatic() || qualityGovernor.lowest() || resolutionGovernor.scale() < 1.0f);
+
+	if (resolutionGovernor.update())
+		resizeSimulationTextures();
+
+	// Uploads for later segments, spread over the frames
+	assetStreamer.update();
 }
 
 
@@ -6556,7 +11152,12 @@ void idle()
 
 	if (DT > d)
 	{
+		frameAllocations.begin();
+		resolutionGovernor.begin(ResolutionGovernor::SIMULATION_PASS);
 		simulationStep();
+		resolutionGovernor.end(ResolutionGovernor::SIMULATION_PASS);
+		frameAllocations.end("simulationStep");
+
 		GLOBAL_TIME += DT;
 		lastTime = currentTime;
 	}
@@ -6619,49 +11220,49 @@ void keyboardup(unsigned char key, int x, int y) {
 }
 
 
-void testForegroundChunking() {
-	if (foregroundTemplates.empty()) {
-		std::cout << "No foreground templates loaded. Cannot run test." << std::endl;
+void placeLevelSegment() {
+	const LevelSegment& segment = LEVEL_SEGMENTS[nextLevelSegment];
+	const Stamp* foreground = findTemplate(foregroundTemplates, segment.foreground);
+
+	// Never loaded on the spot, the segment waits for the streamer instead
+	if (!foreground) {
+		LOG_WARN("Segment ", nextLevelSegment, " (", segment.foreground, ") hasn't streamed in yet");
+		streamLevelAhead(levelConfig.stream_ahead);
 		return;
 	}
 
+	Stamp originalStamp = deepCopyStamp(*foreground);
 
-
-	Stamp originalStamp = deepCopyStamp(foregroundTemplates[0]);
-
-	std::cout << "Testing foreground chunking with stamp: " << originalStamp.baseFilename << std::endl;
-	std::cout << "Original dimensions: " << originalStamp.width << "x" << originalStamp.height << std::endl;
+	LOG_INFO("Placing segment ", nextLevelSegment, " with stamp: ", originalStamp.baseFilename());
+	LOG_INFO("Original dimensions: ", originalStamp.width, "x", originalStamp.height);
 
 	float normalized_stamp_width = originalStamp.width / float(WIDTH);
 	float normalized_stamp_height = originalStamp.height / float(HEIGHT);
 
 	// to do: tinker with these to get perfect scale and translation
 	originalStamp.posX = 1.5 + normalized_stamp_width / 2.0f;
-	originalStamp.posY = 0.726f;
-	float scaleFactor = 1.337f;
+	originalStamp.posY = segment.posY;
+	float scaleFactor = segment.scale;
 
 	originalStamp.birth_time = GLOBAL_TIME;
 	originalStamp.death_time = -1;// GLOBAL_TIME + 30.0f;
-	originalStamp.is_foreground = true;
 
 
 	vector<ivec2> input_pixel_locations;
 
-	ivec2 iv;
-	iv.x = 100;
-	iv.y = 1080 / 2;
-	input_pixel_locations.push_back(iv);
-
-	iv.x = 3000;
-	iv.y = (1080 / 2);
-	input_pixel_locations.push_back(iv);
+	for (const auto& location : segment.enemies) {
+		ivec2 iv;
+		iv.x = location[0];
+		iv.y = location[1];
+		input_pixel_locations.push_back(iv);
+	}
 
 	vector<vec2> output_screen_locations;
 
 	// foreground width and height must be evenly divisible by 360
-	std::vector<Stamp> chunks = chunkForegroundStamp(originalStamp, 360, scaleFactor, input_pixel_locations, output_screen_locations);
+	std::vector<Stamp> chunks = chunkForegroundStamp(originalStamp, FOREGROUND_CHUNK_SIZE, scaleFactor, input_pixel_locations, output_screen_locations);
 
-	std::cout << "Generated " << chunks.size() << " chunks with scale factor " << scaleFactor << "." << std::endl;
+	LOG_INFO("Generated ", chunks.size(), " chunks with scale factor ", scaleFactor, ".");
 
 	int totalChunkPixels = 0;
 	for (const auto& chunk : chunks) {
@@ -6671,15 +11272,15 @@ void testForegroundChunking() {
 	int totalOriginalPixels = originalStamp.width * originalStamp.height;
 	float coverage = (float)totalChunkPixels / totalOriginalPixels;
 
-	std::cout << "Chunking pixel coverage: " << (coverage * 100.0f) << "%" << std::endl;
-	std::cout << "Chunk dimensions:" << std::endl;
+	LOG_INFO("Chunking pixel coverage: ", coverage * 100.0f, "%");
+	LOG_DEBUG("Chunk dimensions:");
 
 	for (size_t i = 0; i < chunks.size(); i++) {
-		std::cout << "  Chunk " << i << ": " << chunks[i].width << "x" << chunks[i].height
-			<< " at offset (" << chunks[i].data_offsetX << ", " << chunks[i].data_offsetY << ")" << std::endl;
+		LOG_DEBUG("  Chunk ", i, ": ", chunks[i].width, "x", chunks[i].height,
+			" at offset (", chunks[i].data_offsetX, ", ", chunks[i].data_offsetY, ")");
 	}
 
-	std::cout << "Test complete. Adding chunks to game..." << std::endl;
+	LOG_INFO("Test complete. Adding chunks to game...");
 
 	for (Stamp& chunkStamp : chunks) {
 		float normalizedOrigWidth = originalStamp.width / float(WIDTH) * scaleFactor;
@@ -6697,14 +11298,19 @@ void testForegroundChunking() {
 
 		chunkStamp.health = 1000000; // Practically infinite
 
-		enemyShips.push_back(chunkStamp);
+		foregroundChunks.push_back(chunkStamp);
 	}
 
-	for (size_t i = 0; i < output_screen_locations.size(); i++)
+	// An enemy that's still streaming is stood in for by the current one
+	const Stamp* enemy = findTemplate(enemyTemplates, segment.enemy);
+	if (!enemy && !enemyTemplates.empty())
+		enemy = &enemyTemplates[currentEnemyTemplateIndex];
+
+	for (size_t i = 0; enemy && i < output_screen_locations.size(); i++)
 	{
-		Stamp newStamp = deepCopyStamp(enemyTemplates[currentEnemyTemplateIndex]);
-		// Explicitly ensure blackeningTexture is 0
-		newStamp.blackeningTexture = 0;
+		Stamp newStamp = deepCopyStamp(*enemy);
+		// Explicitly ensure the copy has no damage mask
+		newStamp.damageMask.reset();
 
 		newStamp.posX = output_screen_locations[i].x + newStamp.width / float(WIDTH) * 0.5;
 		newStamp.posY = input_pixel_locations[i].y / float(HEIGHT);
@@ -6720,10 +11326,22 @@ void testForegroundChunking() {
 		newStamp.birth_time = GLOBAL_TIME;
 		newStamp.death_time = -1;
 
-		cout << "ADDING ENEMY " << newStamp.posY << endl;
+		LOG_DEBUG("ADDING ENEMY ", newStamp.posY);
 
 		enemyShips.push_back(newStamp);
 	}
+
+	// The overlay swaps in if it's here, otherwise once it is
+	currentOverlay = segment.overlay;
+	if (overlayTextures.count(currentOverlay))
+		backgroundTexture2 = overlayTextures[currentOverlay];
+
+	nextLevelSegment = (nextLevelSegment + 1) % LEVEL_SEGMENT_COUNT;
+
+	if (assetStreamer.enabled())
+		evictLevelAssets(levelConfig.stream_ahead);
+
+	streamLevelAhead(levelConfig.stream_ahead);
 }
 
 
@@ -6734,15 +11352,15 @@ void keyboard(unsigned char key, int x, int y) {
 	{
 	case 'm':
 	{
-		if (allyShips.size() > 0)
-			cout << getPixelValueFromStamp(allyShips[0], 0, 116, 64, 3) / 255.0f << endl;
+		if (playerIndex() != SIZE_MAX)
+			cout << getPixelValueFromStamp(allyShips.get<Sprite>(playerIndex()), 0, 116, 64, 3) / 255.0f << endl;
 
 		break;
 	}
 
 	case '9':
 	{
-		testForegroundChunking();
+		placeLevelSegment();
 		break;
 		//if (foregroundTemplates.empty()) {
 		//	std::cout << "No foreground templates loaded. Make sure foreground*.png files exist." << std::endl;
@@ -6798,7 +11416,7 @@ void keyboard(unsigned char key, int x, int y) {
 		//	}
 
 		//	std::cout << "Added chunked foreground with " << chunks.size() << " chunks "
-		//		<< "using template: " << originalStamp.baseFilename << std::endl;
+		//		<< "using template: " << originalStamp.baseFilename() << std::endl;
 		//}
 		//else {
 		//	// For small stamps, just add them directly as before
@@ -6827,7 +11445,7 @@ void keyboard(unsigned char key, int x, int y) {
 		//	enemyShips.push_back(originalStamp);
 
 		//	std::cout << "Added small foreground element at position (" << start.x << ", " << start.y
-		//		<< ") using template: " << originalStamp.baseFilename << std::endl;
+		//		<< ") using template: " << originalStamp.baseFilename() << std::endl;
 		//}
 
 
@@ -6836,20 +11454,33 @@ void keyboard(unsigned char key, int x, int y) {
 		break;
 	}
 
+	case '1':  // Quality presets
+	case '2':
+	case '3':
+	case '4':
+		qualityGovernor.setLevel(key - '1');
+		std::cout << "Quality: " << qualityGovernor.level().name << std::endl;
+		break;
+
+	case '5':
+		qualityGovernor.setAutomatic();
+		std::cout << "Quality: automatic" << std::endl;
+		break;
+
 	case '8':
 	{
 		size_t num_powerup_tempates = powerUpTemplates.size();
-		size_t index = rand() % num_powerup_tempates;
+		size_t index = spawnRng.below(uint32_t(num_powerup_tempates));
 
 		Stamp newStamp = deepCopyStamp(powerUpTemplates[SINUSOIDAL_POWERUP + index]);
-		// Explicitly ensure blackeningTexture is 0
-		newStamp.blackeningTexture = 0;
+		// Explicitly ensure the copy has no damage mask
+		newStamp.damageMask.reset();
 
 		newStamp.powerup = powerup_type(SINUSOIDAL_POWERUP + index);
 
 		// Position at right edge of screen
 		newStamp.posX = 1.0;// -10;
-		newStamp.posY = rand() / float(RAND_MAX);
+		newStamp.posY = spawnRng.uniform();
 
 		newStamp.birth_time = GLOBAL_TIME;
 		newStamp.death_time = -1.0f;
@@ -6857,15 +11488,15 @@ void keyboard(unsigned char key, int x, int y) {
 		newStamp.local_velY = 0.0f;// 5.0f;
 		allyPowerUps.push_back(newStamp);
 
-		std::cout << "Added new power up";
+		LOG_INFO("Added new power up");
 		break;
 	}
 
 	case '0':
 	{
 		//Stamp newStamp = deepCopyStamp(enemyTemplates[currentEnemyTemplateIndex]);
-		//// Explicitly ensure blackeningTexture is 0
-		//newStamp.blackeningTexture = 0;
+		//// Explicitly ensure the copy has no damage mask
+		//newStamp.damageMask.reset();
 
 		//float normalized_stamp_width = newStamp.width / float(WIDTH);
 		//float normalized_stamp_height = newStamp.height / float(HEIGHT);
@@ -6920,6 +11551,33 @@ void keyboard(unsigned char key, int x, int y) {
 	case 'C':
 		reportCollisions = true;
 		std::cout << "Generating collision report on next frame..." << std::endl;
+		damageMaskAtlas.report();
+		spriteBatch.report();
+		resolutionGovernor.report();
+		qualityGovernor.report();
+		assetStreamer.report();
+		if (textRenderer)
+			textRenderer->report();
+		reportEntityPools();
+		if (gpuBullets)
+			gpuBullets->report();
+		break;
+
+	case 'g':
+	case 'G':
+		gpu_bullets = !gpu_bullets;
+
+		// Made here rather than by the first emitBullet, which runs inside a guarded frame
+		if (gpu_bullets && !gpuBullets)
+			gpuBullets = new GPUBulletSystem();
+
+		std::cout << "Bullets simulated on the " << (gpu_bullets ? "GPU" : "CPU") << std::endl;
+		break;
+
+	case 'p':
+	case 'P':
+		collisionPrecision = (collisionPrecision == GPUCollisionDetector::PER_TILE) ? GPUCollisionDetector::PER_PIXEL : GPUCollisionDetector::PER_TILE;
+		std::cout << "Collision precision: " << (collisionPrecision == GPUCollisionDetector::PER_TILE ? "per tile" : "per pixel") << std::endl;
 		break;
 
 	case 't':  // Cycle to the next template type
@@ -6948,25 +11606,25 @@ void keyboard(unsigned char key, int x, int y) {
 		if (currentTemplateType == ALLY && !allyTemplates.empty()) {
 			currentAllyTemplateIndex = (currentAllyTemplateIndex + 1) % allyTemplates.size();
 			std::cout << "Switched to ally template: "
-				<< allyTemplates[currentAllyTemplateIndex].baseFilename
+				<< allyTemplates[currentAllyTemplateIndex].baseFilename()
 				<< " (" << (currentAllyTemplateIndex + 1) << " of "
 				<< allyTemplates.size() << ")" << std::endl;
 		}
 		else if (currentTemplateType == ENEMY && !enemyTemplates.empty()) {
 			currentEnemyTemplateIndex = (currentEnemyTemplateIndex + 1) % enemyTemplates.size();
 			std::cout << "Switched to enemy template: "
-				<< enemyTemplates[currentEnemyTemplateIndex].baseFilename
+				<< enemyTemplates[currentEnemyTemplateIndex].baseFilename()
 				<< " (" << (currentEnemyTemplateIndex + 1) << " of "
 				<< enemyTemplates.size() << ")" << std::endl;
 		}
 		else if (currentTemplateType == BULLET && !bulletTemplates.empty()) {
 			std::cout << "Using bullet template: "
-				<< bulletTemplates[0].baseFilename << std::endl;
+				<< bulletTemplates[0].baseFilename() << std::endl;
 		}
 		else if (currentTemplateType == POWERUP && !powerUpTemplates.empty()) {
 			currentPowerUpTemplateIndex = (currentPowerUpTemplateIndex + 1) % powerUpTemplates.size();
 			std::cout << "Switched to powerup template: "
-				<< powerUpTemplates[currentPowerUpTemplateIndex].baseFilename
+				<< powerUpTemplates[currentPowerUpTemplateIndex].baseFilename()
 				<< " (" << (currentPowerUpTemplateIndex + 1) << " of "
 				<< powerUpTemplates.size() << ")" << std::endl;
 		}
@@ -6988,13 +11646,13 @@ void specialKeyboard(int key, int x, int y) {
 		upKeyPressed = true;
 
 		//for (auto& stamp : allyShips) {
-		//	if (stamp.textureIDs[0] != 0) {
+		//	if (stamp.textureIDs()[0] != 0) {
 		//		stamp.currentVariationIndex = 1; // up variation
 		//	}
 		//}
 
-		for (auto& stamp : allyShips) {
-			if (stamp.textureIDs[0] != 0) {
+		for (auto& stamp : allyShips.column<Sprite>()) {
+			if (stamp.textureIDs()[0] != 0) {
 				stamp.currentVariationIndex = 0; // center variation
 			}
 		}
@@ -7004,13 +11662,13 @@ void specialKeyboard(int key, int x, int y) {
 		downKeyPressed = true;
 
 		//for (auto& stamp : allyShips) {
-		//	if (stamp.textureIDs[0] != 0) {
+		//	if (stamp.textureIDs()[0] != 0) {
 		//		stamp.currentVariationIndex = 2; // down variation
 		//	}
 		//}
 
-		for (auto& stamp : allyShips) {
-			if (stamp.textureIDs[0] != 0) {
+		for (auto& stamp : allyShips.column<Sprite>()) {
+			if (stamp.textureIDs()[0] != 0) {
 				stamp.currentVariationIndex = 0; // center variation
 			}
 		}
@@ -7024,34 +11682,36 @@ void specialKeyboard(int key, int x, int y) {
 		break;
 	}
 
-	if (allyShips.size() > 0) {
+	if (playerIndex() != SIZE_MAX) {
+		Velocity& player = allyShips.get<Velocity>(playerIndex());
+
 		// Reset velocity
-		allyShips[0].local_velX = 0.0;
-		allyShips[0].local_velY = 0.0;
+		player.local_velX = 0.0;
+		player.local_velY = 0.0;
 
 		// Combine key states to allow diagonal movement
 		if (upKeyPressed) {
-			allyShips[0].local_velY = 1;
+			player.local_velY = 1;
 		}
 		if (downKeyPressed) {
-			allyShips[0].local_velY = -1;
+			player.local_velY = -1;
 		}
 		if (leftKeyPressed) {
-			allyShips[0].local_velX = -1;
+			player.local_velX = -1;
 		}
 		if (rightKeyPressed) {
-			allyShips[0].local_velX = 1;
+			player.local_velX = 1;
 		}
 
-		float vel_length = sqrt(allyShips[0].local_velX * allyShips[0].local_velX + allyShips[0].local_velY * allyShips[0].local_velY);
+		float vel_length = sqrt(player.local_velX * player.local_velX + player.local_velY * player.local_velY);
 
 		if (vel_length > 0)
 		{
-			allyShips[0].local_velX /= vel_length;
-			allyShips[0].local_velY /= vel_length;
+			player.local_velX /= vel_length;
+			player.local_velY /= vel_length;
 
-			allyShips[0].local_velX *= 0.25f * (WIDTH / 1920.0f);
-			allyShips[0].local_velY *= 0.25f * (HEIGHT / 1080.0f);
+			player.local_velX *= 0.25f * (WIDTH / 1920.0f);
+			player.local_velY *= 0.25f * (HEIGHT / 1080.0f);
 		}
 	}
 }
@@ -7075,39 +11735,41 @@ void specialKeyboardUp(int key, int x, int y) {
 
 
 
-	for (auto& stamp : allyShips) {
-		if (stamp.textureIDs[0] != 0) {
+	for (auto& stamp : allyShips.column<Sprite>()) {
+		if (stamp.textureIDs()[0] != 0) {
 			stamp.currentVariationIndex = 0; // center variation
 		}
 	}
 
-	if (allyShips.size() > 0) {
+	if (playerIndex() != SIZE_MAX) {
+		Velocity& player = allyShips.get<Velocity>(playerIndex());
+
 		// Reset velocity if no keys are pressed
-		allyShips[0].local_velX = 0.0;
-		allyShips[0].local_velY = 0.0;
+		player.local_velX = 0.0;
+		player.local_velY = 0.0;
 
 		if (upKeyPressed) {
-			allyShips[0].local_velY = 1;
+			player.local_velY = 1;
 		}
 		if (downKeyPressed) {
-			allyShips[0].local_velY = -1;
+			player.local_velY = -1;
 		}
 		if (leftKeyPressed) {
-			allyShips[0].local_velX = -1;
+			player.local_velX = -1;
 		}
 		if (rightKeyPressed) {
-			allyShips[0].local_velX = 1;
+			player.local_velX = 1;
 		}
 
-		float vel_length = sqrt(allyShips[0].local_velX * allyShips[0].local_velX + allyShips[0].local_velY * allyShips[0].local_velY);
+		float vel_length = sqrt(player.local_velX * player.local_velX + player.local_velY * player.local_velY);
 
 		if (vel_length > 0)
 		{
-			allyShips[0].local_velX /= vel_length;
-			allyShips[0].local_velY /= vel_length;
+			player.local_velX /= vel_length;
+			player.local_velY /= vel_length;
 
-			allyShips[0].local_velX *= 0.25f * (WIDTH / 1920.0f);
-			allyShips[0].local_velY *= 0.25f * (HEIGHT / 1080.0f);
+			player.local_velX *= 0.25f * (WIDTH / 1920.0f);
+			player.local_velY *= 0.25f * (HEIGHT / 1080.0f);
 		}
 	}
 }
@@ -7115,110 +11777,60 @@ void specialKeyboardUp(int key, int x, int y) {
 
 
 void reshape(int w, int h) {
+	// Minimised
+	if (w <= 0 || h <= 0)
+		return;
+
 	glViewport(0, 0, w, h);
+
+	if (w == WIDTH && h == HEIGHT)
+		return;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
 	WIDTH = w;
 	HEIGHT = h;
 
-	// Delete existing shader programs
-	glDeleteProgram(advectProgram);
-	glDeleteProgram(divergenceProgram);
-	glDeleteProgram(pressureProgram);
-	glDeleteProgram(gradientSubtractProgram);
-	glDeleteProgram(addForceProgram);
-
-	glDeleteProgram(diffuseColorProgram);
-	glDeleteProgram(addColorProgram);
-	glDeleteProgram(stampObstacleProgram);
-	glDeleteProgram(diffuseVelocityProgram);
-	glDeleteProgram(stampTextureProgram);
-	//	glDeleteProgram(blackeningProgram);
-	glDeleteProgram(curlProgram);
-	glDeleteProgram(vorticityForceProgram);
-	glDeleteProgram(applyForceProgram);
-	glDeleteProgram(batchBlackeningProgram);
-
-	glDeleteProgram(multiTargetBlackeningProgram);
-
-
-	if (gpuCollisionDetector) {
-		delete gpuCollisionDetector;
-		gpuCollisionDetector = nullptr;
-	}
-
-
-	// Delete OpenGL resources
-	glDeleteFramebuffers(1, &fbo);
-	glDeleteVertexArrays(1, &vao);
-	glDeleteBuffers(1, &vbo);
-
-	// Delete textures
-	glDeleteTextures(2, velocityTexture);
-	glDeleteTextures(2, pressureTexture);
-	glDeleteTextures(1, &divergenceTexture);
-	glDeleteTextures(1, &obstacleTexture);
-	//	glDeleteTextures(1, &collisionTexture);
-	glDeleteTextures(2, colorTexture);
-	glDeleteTextures(2, friendlyColorTexture);
-	glDeleteTextures(1, &backgroundTexture);
-	glDeleteTextures(1, &backgroundTexture2);
-	glDeleteFramebuffers(1, &processingFBO);
-	glDeleteTextures(1, &tempTexture1);
-	glDeleteTextures(1, &tempTexture2);
-	glDeleteTextures(1, &vorticityTexture);
-	glDeleteTextures(1, &vorticityForceTexture);
-
-	// Cleanup textures in templates
-	for (auto& stamp : allyTemplates) {
-		for (auto& textureID : stamp.textureIDs) {
-			if (textureID != 0) {
-				glDeleteTextures(1, &textureID);
-			}
-		}
-	}
+	// Only what's sized by the window is rebuilt, programs, templates and entities carry on as they were
+	// The fluid textures are resampled into the new size and the collision detector is remade on its next pass
+	resizeSimulationTextures();
 
-	for (auto& stamp : enemyTemplates) {
-		for (auto& textureID : stamp.textureIDs) {
-			if (textureID != 0) {
-				glDeleteTextures(1, &textureID);
-			}
-		}
-	}
+	if (textRenderer)
+		textRenderer->setProjection(WIDTH, HEIGHT);
 
-	for (auto& stamp : bulletTemplates) {
-		for (auto& textureID : stamp.textureIDs) {
-			if (textureID != 0) {
-				glDeleteTextures(1, &textureID);
-			}
-		}
-	}
+	LOG_INFO("Resized to ", WIDTH, "x", HEIGHT, " in ",
+		std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count(), " ms");
+}
 
-	for (auto& stamp : powerUpTemplates) {
-		for (auto& textureID : stamp.textureIDs) {
-			if (textureID != 0) {
-				glDeleteTextures(1, &textureID);
-			}
-		}
-	}
+// When the window closes, while its context is still current
+void shutdown() {
+	assetStreamer.cleanup();
 
-	for (auto& stamp : foregroundTemplates) {
-		for (auto& textureID : stamp.textureIDs) {
-			if (textureID != 0) {
-				glDeleteTextures(1, &textureID);
-			}
-		}
-	}
+	// backgroundTexture2 is one of the overlays
+	for (const auto& overlay : overlayTextures)
+		glDeleteTextures(1, &overlay.second);
 
-	allyTemplates.clear();
-	enemyTemplates.clear();
-	bulletTemplates.clear();
-	powerUpTemplates.clear();
-	foregroundTemplates.clear();
+	overlayTextures.clear();
+	backgroundTexture2 = 0;
 
-	if (textRenderer)
-		delete textRenderer;
+	if (overlayPlaceholder)
+		glDeleteTextures(1, &overlayPlaceholder);
 
-	// Reinitialize OpenGL
-	initGL();
+	overlayPlaceholder = 0;
+
+	spriteBatch.cleanup();
+	resolutionGovernor.cleanup();
+	scratchTexturePool.cleanup();
+	damageMaskAtlas.cleanup();
+
+	delete gpuCollisionDetector;
+	gpuCollisionDetector = nullptr;
+
+	delete gpuBullets;
+	gpuBullets = nullptr;
+
+	delete textRenderer;
+	textRenderer = nullptr;
 }
 
 
@@ -7231,9 +11843,12 @@ void printInstructions() {
 	std::cout << "Left Mouse Button: Add velocity and density" << std::endl;
 	std::cout << "Right Mouse Button: Add game objects using current template" << std::endl;
 	std::cout << "R: Toggle between red and blue color modes" << std::endl;
-	std::cout << "C: Generate collision report immediately" << std::endl;
+	std::cout << "C: Generate collision report immediately (also reports damage mask memory)" << std::endl;
+	std::cout << "P: Toggle collision precision (per pixel / per tile, approximate)" << std::endl;
+	std::cout << "G: Toggle GPU bullets (new bullets only, existing ones finish where they are)" << std::endl;
 	std::cout << "L: Load all available game object textures" << std::endl;
 	std::cout << "T: Cycle through loaded textures (obstacles=ally ships, bullets, enemy)" << std::endl;
+	std::cout << "9: Place the next level segment, its assets are streamed in ahead" << std::endl;
 	std::cout << "UP/DOWN Arrow Keys: Change ship orientation when placing" << std::endl;
 	std::cout << "Highlights show colour-obstacle collisions" << std::endl;
 	std::cout << "-----------------------------------" << std::endl;
@@ -7394,6 +12009,43 @@ public:
 
 // Then update the main function to call this instead of printing directly
 int main(int argc, char** argv) {
+	const char* log_path = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--bench-bullets")
+		{
+			benchmarkBullets();
+			return 0;
+		}
+
+		if (std::string(argv[i]) == "--bench-entities")
+		{
+			benchmarkEntities();
+			return 0;
+		}
+
+		// Decodes level1/ into the asset pack and exits, rerun after changing any of the PNGs
+		if (std::string(argv[i]) == "--pack")
+			return writeAssetPack(ASSET_PACK_PATH) ? 0 : 1;
+
+		if (std::string(argv[i]) == "--loose-assets")
+			loose_assets = true;
+
+		// Replays a run, overrides the seed in level.cfg
+		if (std::string(argv[i]) == "--seed" && i + 1 < argc)
+			seed_override = std::strtoull(argv[++i], nullptr, 10);
+
+		if (std::string(argv[i]) == "--log" && i + 1 < argc)
+			log_path = argv[++i];
+	}
+
+	FILE* log_file = log_path ? fopen(log_path, "w") : nullptr;
+	if (log_path && !log_file)
+		std::cerr << "Could not open " << log_path << ", logging to stderr" << std::endl;
+
+	gameLog.start(log_file ? log_file : stderr);
+
 	// Initialize GLUT
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE);
@@ -7482,6 +12134,7 @@ int main(int argc, char** argv) {
 	glutKeyboardUpFunc(keyboardup);
 
 	glutReshapeFunc(reshape);
+	glutCloseFunc(shutdown);
 
 	glutSpecialFunc(specialKeyboard);
 	glutSpecialUpFunc(specialKeyboardUp);